@@ -1,644 +1,10054 @@
-/* 
- * @file Tourism Management System.c
- * @brief A command-line based Tourism Management System for managing user accounts and tour bookings.
- *
- * This application enables users to create an account, log in, book a tour package, 
- * cancel bookings, and change their password. It provides a simple CLI interface
- * with menus for user interactions.
- *
- * Key Functionalities:
- *  - User Registration with duplicate-checking.
- *  - User Login with password verification.
- *  - Tour Booking based on predefined packages.
- *  - Booking Cancellation with refund calculations.
- *  - Password Change and Logout operations.
- *
- * Target Users:
- *  - Developers and students working on system-level projects.
- *
- * Code Style:
- *  - Follows general C programming and Doxygen documentation conventions.
- */
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <time.h>
-
-/** 
- * @enum status
- * @brief Represents the system mode (either in the main menu or after user login).
- */
-enum status { menu, loggedIn };
-
-/** Global variable to track current system state. */
-enum status currentStatus = menu;
-
-/** 
- * @struct user
- * @brief Represents a system user and their booking details.
- */
-typedef struct user {
-    char username[100];       ///< Unique username for the user.
-    char password[100];       ///< Password for authentication.
-    char place[100];          ///< Currently booked tour destination.
-    float price;              ///< Price per ticket for the booked tour.
-    int numberTicket;         ///< Number of tickets booked.
-    struct user *next;        ///< Pointer to the next user in a linked list.
-} user;
-
-/* Function prototypes with Doxygen-style comments: */
-
-/**
- * @brief Displays the list of available tour packages.
- *
- * This function clears the screen and prints the tour menu with pricing details.
- */
-void showMenu(void);
-
-/**
- * @brief Initializes the user list from a file.
- *
- * Reads the "users.txt" file and creates a linked list of users.
- * @param userptr Pointer to the current user linked list (can be NULL).
- * @return Pointer to the head of the initialized user list.
- */
-user* initializeUser(user* userptr);
-
-/**
- * @brief Adds a new user to the system.
- *
- * Prompts for username and password, checks for duplicates, and updates the user list.
- * @param userptr Pointer to the head of the current user list.
- * @return Pointer to the head of the updated user list.
- */
-user* addUser(user* userptr);
-
-/**
- * @brief Authenticates a user trying to log in.
- *
- * Validates user credentials and updates system state on successful login.
- * @param userptr Pointer to the user linked list.
- * @return Pointer to the user record on successful login or the list head otherwise.
- */
-user* login(user* userptr);
-
-/**
- * @brief Handles a tour booking for a logged-in user.
- *
- * Displays available packages, captures user selection, and stores booking details.
- * @param userptr Pointer to the user linked list.
- */
-void booking(user* userptr);
-
-/**
- * @brief Cancels a booked tour for the logged-in user.
- *
- * Searches for the user's booking and resets tour-related fields if found.
- * @param userptr Pointer to the user linked list.
- */
-void cancellation(user* userptr);
-
-/**
- * @brief Changes the password for the logged-in user.
- *
- * Prompts for the current password, validates it, then allows a new password to be set.
- * @param userptr Pointer to the user linked list.
- */
-void changePassword(user* userptr);
-
-/**
- * @brief Logs out the current user.
- *
- * Resets the current user and system state to the default menu state.
- */
-void logout(void);
-
-/**
- * @brief Checks and displays current booking details for the logged-in user.
- *
- * Calculates the total cost based on price and number of tickets.
- * @param userptr Pointer to the user linked list.
- */
-void checkTicket(user* userptr);
-
-/**
- * @brief Writes the current user list to the file.
- *
- * Updates the "users.txt" file with the latest user booking and login details.
- * @param userptr Pointer to the head of the user linked list.
- */
-void filing(user* userptr);
-
-/**
- * @brief Exits the application after displaying project developer details.
- *
- * Displays project and developer details and pauses before exit.
- */
-void exitProgram(void);
-
-/**
- * @brief Displays developer/project information.
- *
- * Prints project title and developer names before clearing the screen after a delay.
- */
-void developers(void);
-
-/**
- * @brief Introduces a delay in the program execution.
- *
- * Uses clock cycles to implement a sleep-like functionality.
- * @param t The delay time in seconds.
- */
-void delay(float t);
-
-/** 
- * @brief Global variable to store the currently logged-in username.
- */
-char currentUser[100];
-
-int main() {
-    /* Change console color for visibility. */
-    system("COLOR FC");
-    
-    developers();
-
-    unsigned int choice1, choice2;
-    
-    user *userptr = NULL;
-    /* Initialize user list from persistent storage. */
-    userptr = initializeUser(userptr);
-    
-    /* Main loop for menu-driven interface. */
-    while (1) {
-        if (currentStatus == menu) {
-            system("CLS");
-
-            printf("\nWelcome to Muhammad*Muhammad*Muhammad Travels!\n");
-
-            /* Display main menu options. */
-            printf("\n1. Add User\n2. Login User\n3. Menu\n4. Exit\n");
-            
-            printf("\nEnter your selection: ");
-            scanf("%u", &choice1);
-            
-            switch(choice1) {
-                case 1:
-                    /* Add a new user account. */
-                    userptr = addUser(userptr);
-                    break;
-                case 2:
-                    /* Attempt to log in the user. */
-                    userptr = login(userptr);
-                    break;
-                case 3:
-                    /* Show available tours. */
-                    showMenu();
-                    break;
-                case 4:
-                    /* Display exit information then terminate the program. */
-                    exitProgram();
-                    exit(0);
-                    break;
-                default:
-                    /* Inform user of invalid entry. */
-                    printf("\nInvalid input! Please select a number from the menu.\n");
-            }
-        }
-        else if (currentStatus == loggedIn) {
-            system("CLS");
-            printf("\nWelcome %s!\n", userptr->username);
-                
-            /* Display logged in user menu options. */
-            printf("\n1. Booking \n2. Check Total \n3. Cancel Booking \n4. Change Password \n5. Logout User \n6. Menu \n7. Exit \n");
-            printf("\nEnter your choice: ");
-            scanf("%u", &choice2);
-            
-            switch(choice2) {
-                case 1:
-                    /* Process a booking request. */
-                    booking(userptr);
-                    system("PAUSE");
-                    system("CLS");
-                    break;
-                case 2:
-                    /* Present the total booking cost. */
-                    checkTicket(userptr);
-                    system("PAUSE");
-                    system("CLS");
-                    break;
-                case 3:
-                    /* Process booking cancellation and notify user about refund. */
-                    cancellation(userptr);
-                    system("PAUSE");
-                    system("CLS");
-                    break;
-                case 4:
-                    /* Allow the user to change password after verifying current credentials. */
-                    changePassword(userptr);
-                    system("PAUSE");
-                    system("CLS");
-                    break;
-                case 5:
-                    /* Log the user out and revert to main menu state. */
-                    logout();
-                    system("PAUSE");
-                    system("CLS");
-                    break;
-                case 6:
-                    /* Display the list of tour packages again. */
-                    showMenu();
-                    system("CLS");
-                    break;
-                case 7:
-                    /* End the program after a proper exit message. */
-                    exitProgram();
-                    exit(0);
-                    break;
-                default:
-                    /* Invalid selection message for logged-in menu. */
-                    printf("\nInvalid choice! Please try again.\n");
-            }
-        }
-    }
-    return 0;
-}
-
-user* initializeUser(user *userptr) {
-    user *tempptr, *ptr, temp;
-    FILE *fp;
-    
-    fp = fopen("users.txt", "r");
-    if (fp == NULL)
-        return NULL;
-    
-    /* If the file is empty, no initialization is needed. */
-    if (fgetc(fp) == EOF)
-        return NULL;
-    
-    rewind(fp);
-    /* Read user information from file and build linked list of users */
-    while (fscanf(fp, "%s %s %s %f %d", temp.username, temp.password, temp.place, &temp.price, &temp.numberTicket) != EOF) {
-        ptr = (user*)malloc(sizeof(user));
-        
-        strcpy(ptr->username, temp.username);
-        strcpy(ptr->password, temp.password);
-        strcpy(ptr->place, temp.place);
-        ptr->price = temp.price;
-        ptr->numberTicket = temp.numberTicket;
-        ptr->next = NULL;
-
-        if (userptr == NULL)
-            userptr = tempptr = ptr;
-        else {
-            userptr->next = ptr;
-            userptr = ptr;
-        }
-    }
-    fclose(fp);
-    return tempptr;
-}
-
-void filing(user *userptr) {
-    FILE *fp;
-    fp = fopen("users.txt", "w");
-    
-    /* Write each user's data into the file to persist state */
-    while (userptr != NULL) {
-        fprintf(fp, "%s %s %s %f %d\n", 
-                userptr->username, userptr->password, userptr->place, userptr->price, userptr->numberTicket);
-        userptr = userptr->next;
-    }
-    fclose(fp);
-}
-
-void showMenu(void) {
-    system("CLS");
-    
-    /* Display available tour packages and pricing details */
-    printf("\nMENU\n\n");
-    printf("1. Paris, France    - Rs 400000\n");
-    printf("2. Tokyo, Japan     - Rs 600000\n");
-    printf("3. Bangkok, Thailand- Rs 250000\n");
-    printf("4. Abu Dhabi, UAE   - Rs 380000\n");
-    printf("5. Miami, USA       - Rs 120000\n");
-    printf("6. Rome, Italy      - Rs 100000\n");
-    printf("7. Munich, Germany  - Rs 300000\n");
-    printf("8. Madrid, Spain    - Rs 320000\n");
-    printf("9. Istanbul, Turkey - Rs 450000\n");
-    printf("10. Gilgit, Pakistan- Rs 75000\n");
-    
-    system("PAUSE");
-}
-
-void checkTicket(user *userptr) {
-    /* Traverse the linked list to locate details for the current user */
-    while (userptr != NULL) {
-        if (!strcmp(userptr->username, currentUser))
-            break;
-        userptr = userptr->next;
-    }
-    
-    /* If no booking exists, inform the user */
-    if (!strcmp(userptr->place, "\0") || userptr->price == 0.0 || userptr->numberTicket == 0) {
-        printf("\nNo ticket booked!\n");
-        return;
-    }
-    
-    float total = userptr->price * userptr->numberTicket;
-    
-    printf("\n%d ticket(s) booked for a total of Rs %.0f for destination %s.\n", 
-           userptr->numberTicket, total, userptr->place);
-}
-
-user* addUser(user* userptr) {
-    user *tempptr = userptr;
-    user *newptr = (user*)malloc(sizeof(user));
-    
-    fflush(stdin);
-    printf("\nEnter new username: ");
-    scanf("%s", newptr->username);
-    
-    /* Check for existing username to prevent duplicates */
-    while (userptr != NULL) {
-        if (!strcmp(userptr->username, newptr->username)) {
-            printf("\nError: Username already exists!\n");
-            delay(2.0);
-            return tempptr;
-        }
-        userptr = userptr->next;
-    }
-    
-    userptr = tempptr;  // Reset pointer for further use.
-    
-    fflush(stdin);
-    printf("\nEnter new password: ");
-    scanf(" %[^\n]s", &newptr->password);
-    
-    printf("\nUser account created successfully!\n");
-    system("PAUSE");
-    
-    newptr->next = NULL;
-    strcpy(newptr->place, "N/A");   // No tour booked initially.
-    newptr->price = 0.0;
-    newptr->numberTicket = 0;
-
-    if (userptr == NULL)
-        userptr = tempptr = newptr;
-    else {
-        while (userptr->next != NULL)
-            userptr = userptr->next;
-        userptr->next = newptr;
-    }
-    filing(tempptr);
-    
-    return tempptr;
-}
-
-user* login(user* userptr) {
-    char username[100];
-    char password[100];
-    
-    fflush(stdin);
-    printf("\nEnter Username: ");
-    scanf(" %s", username);
-    fflush(stdin);
-    printf("\nEnter Password: ");
-    scanf(" %[^\n]s", password);
-    
-    while (userptr != NULL) {
-        /* Validate username and password successively */
-        if ((!strcmp(userptr->username, username)) && (!strcmp(userptr->password, password))) {
-            currentStatus = loggedIn;
-            strcpy(currentUser, username);
-            printf("\nLogin successful!\n");
-            system("PAUSE");
-            return userptr;
-        } else if ((!strcmp(userptr->username, username)) && (strcmp(userptr->password, password))) {
-            printf("\nWrong Password! Access denied.\n");
-            return userptr;
-        }
-        userptr = userptr->next;
-    }
-    
-    printf("\nUser not found! Please register first.\n");
-    delay(2.0);
-    return NULL;
-}
-
-void booking(user *userptr) {
-    user *tempptr = userptr;
-    char place[100];
-    char placeList[10][100] = {"Paris, France", "Tokyo, Japan", "Bangkok, Thailand", "Abu Dhabi, UAE", 
-                                "Miami, USA", "Rome, Italy", "Munich, Germany", "Madrid, Spain", 
-                                "Istanbul, Turkey", "Gilgit, Pakistan"};
-    
-    /* Locate the logged-in user in the linked list */
-    while (userptr != NULL) {
-        if (!strcmp(userptr->username, currentUser))
-            break;
-        userptr = userptr->next;
-    }
-    
-    if (userptr == NULL)
-        return;
-    
-    /* Prevent multiple bookings for same user without cancellation */
-    if (userptr->price != 0.0) {
-        printf("\nYou already have an active booking. Please cancel your previous ticket before booking a new one!\n");
-        return;
-    }
-    
-    showMenu();
-    
-    /* Price list corresponding to tour packages */
-    float priceList[] = {400000.0, 600000.0, 250000.0, 380000.0, 120000.0,
-                         100000.0, 300000.0, 320000.0, 450000.0, 75000.0};
-    
-    fflush(stdin);
-    printf("\nEnter the tour code number: ");
-    scanf(" %[^\n]s", place);
-    
-    char choice;
-    
-    fflush(stdin);
-    printf("\nConfirm booking?\n1. Yes\n2. No\n");
-    printf("\nEnter your choice: ");
-    scanf(" %c", &choice);
-    
-    float price = 0.0;
-    
-    if (choice != '1')
-        return;
-    
-    /* Map the code number to the corresponding package from the lists */
-    if (strcmp(place, "1") == 0) {
-        price = priceList[0];
-        strcpy(place, placeList[0]);
-    } else if (strcmp(place, "2") == 0) {
-        price = priceList[1];
-        strcpy(place, placeList[1]);
-    } else if (strcmp(place, "3") == 0) {
-        price = priceList[2];
-        strcpy(place, placeList[2]);
-    } else if (strcmp(place, "4") == 0) {
-        price = priceList[3];
-        strcpy(place, placeList[3]);
-    } else if (strcmp(place, "5") == 0) {
-        price = priceList[4];
-        strcpy(place, placeList[4]);
-    } else if (strcmp(place, "6") == 0) {
-        price = priceList[5];
-        strcpy(place, placeList[5]);
-    } else if (strcmp(place, "7") == 0) {
-        price = priceList[6];
-        strcpy(place, placeList[6]);
-    } else if (strcmp(place, "8") == 0) {
-        price = priceList[7];
-        strcpy(place, placeList[7]);
-    } else if (strcmp(place, "9") == 0) {
-        price = priceList[8];
-        strcpy(place, placeList[8]);
-    } else if (strcmp(place, "10") == 0) {
-        price = priceList[9];
-        strcpy(place, placeList[9]);
-    } else {
-        printf("\nInvalid tour code number entered!\n");
-        return;
-    }
-    
-    printf("\nEnter the number of tickets for booking: ");
-    scanf("%d", &userptr->numberTicket);
-    
-    /* If number of tickets is zero, abort booking */
-    if (userptr->numberTicket == 0)
-        return;
-    
-    strcpy(userptr->place, place);
-    userptr->price = price;
-    
-    filing(tempptr);
-    printf("\nBooking completed successfully!\n");
-}
-
-void cancellation(user *userptr) {
-    user *tempptr = userptr;
-    
-    /* Locate the current user in the linked list */
-    while (userptr != NULL) {
-        if (!strcmp(userptr->username, currentUser))
-            break;
-        userptr = userptr->next;
-    }
-    
-    int flag = -1;
-    
-    if (userptr == NULL) {
-        printf("\nUser not found in the system!\n");
-        return;
-    }
-    
-    /* Check whether a valid tour is booked by comparing destination names */
-    if (strcmp(userptr->place, "Paris, France") == 0)
-        flag++; 
-    else if (strcmp(userptr->place, "Tokyo, Japan") == 0)
-        flag++; 
-    else if (strcmp(userptr->place, "Bangkok, Thailand") == 0)
-        flag++; 
-    else if (strcmp(userptr->place, "Abu Dhabi, UAE") == 0)
-        flag++; 
-    else if (strcmp(userptr->place, "Miami, USA") == 0)
-        flag++; 
-    else if (strcmp(userptr->place, "Rome, Italy") == 0)
-        flag++; 
-    else if (strcmp(userptr->place, "Munich, Germany") == 0)
-        flag++; 
-    else if (strcmp(userptr->place, "Madrid, Spain") == 0)
-        flag++; 
-    else if (strcmp(userptr->place, "Istanbul, Turkey") == 0)
-        flag++; 
-    else if (strcmp(userptr->place, "Gilgit, Pakistan") == 0)
-        flag++; 
-    else {
-        printf("\nNo tour has been booked to cancel!\n");
-        return;
-    }
-    
-    /* If a valid booking exists, reset tour details and inform user about the refund. */
-    if (flag == 0) {
-        printf("\nYour booking for %s (%d ticket(s)) has been cancelled. A refund of Rs %.0f will be processed.\n", 
-               userptr->place, userptr->numberTicket, userptr->price * userptr->numberTicket);
-        strcpy(userptr->place, "N/A");
-        userptr->price = 0.0;
-        userptr->numberTicket = 0;
-        filing(tempptr);
-    }
-}
-
-void changePassword(user *userptr) {
-    user *tempptr = userptr;
-    char passCurrent[100];
-    
-    fflush(stdin);
-    printf("\nEnter your current password to continue: ");
-    scanf(" %[^\n]s", passCurrent);
-    
-    /* Verify that the entered current password matches stored password. */
-    while (userptr != NULL) {
-        if (!strcmp(userptr->username, currentUser))
-            break;
-        printf("\nInvalid credentials! Please try again.\n");
-        userptr = userptr->next;
-    }
-    
-    if (userptr == NULL)
-        return;
-    
-    if (!strcmp(passCurrent, userptr->password)) {
-        printf("\nEnter your new password: ");
-        scanf(" %[^\n]s", userptr->password);
-        printf("\nPassword updated successfully!\n");
-    } else {
-        printf("\nIncorrect password provided. Password was not changed.\n");
-    }
-    
-    filing(tempptr);
-}
-
-void logout(void) {
-    /* Ensure that a user is logged in before attempting to log out. */
-    if (currentStatus == menu || strcmp(currentUser, "\0") == 0) {
-        printf("\nError: No user is currently logged in. Please log in first.\n");
-        return;
-    }
-    
-    strcpy(currentUser, "\0");
-    currentStatus = menu;
-    printf("\nYou have been successfully logged out.\n");
-}
-
-void exitProgram(void) {
-    /* Display project and developer information on exit */
-    printf("\nProgramming Fundamentals Laboratory Project BS(CS)-1E\n");
-    printf("\nDevelopers:\n");
-    printf("Muhammad Talha     --> 21K-3349\n");
-    printf("Muhammad Hamza     --> 21K-4579\n");
-    printf("Muhammad Hasan     --> 21K-4885\n");
-    system("PAUSE");
-}
-
-void developers(void) {
-    /* Provide project introduction and developer credits before main menu */
-    printf("\nProject: Tourism Management System\n");
-    printf("\nDevelopers: Talha, Hamza, and Hasan\n");
-    
-    delay(3.5);
-    system("CLS");
-}
-
-void delay(float t) {
-    clock_t start = clock();
-    /* Delay execution for the specified time in seconds */
-    while ((clock() - start) < (t * 1000));
-    return;
+/* 
+ * @file Tourism Management System.c
+ * @brief A command-line based Tourism Management System for managing user accounts and tour bookings.
+ *
+ * This application enables users to create an account, log in, book a tour package, 
+ * cancel bookings, and change their password. It provides a simple CLI interface
+ * with menus for user interactions.
+ *
+ * Key Functionalities:
+ *  - User Registration with duplicate-checking.
+ *  - User Login with password verification.
+ *  - Tour Booking based on predefined packages.
+ *  - Booking Cancellation with refund calculations.
+ *  - Password Change and Logout operations.
+ *
+ * Target Users:
+ *  - Developers and students working on system-level projects.
+ *
+ * Code Style:
+ *  - Follows general C programming and Doxygen documentation conventions.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/time.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+#include <pthread.h>
+#include <dirent.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/wait.h>
+#include <ftw.h>
+
+/** 
+ * @enum status
+ * @brief Represents the system mode (either in the main menu or after user login).
+ */
+enum status { menu, loggedIn };
+
+/** Global variable to track current system state. */
+enum status currentStatus = menu;
+
+/** Cleared once shutdown begins so the main loop stops taking new requests. */
+int acceptingWork = 1;
+
+/** Set from the SIGINT/SIGTERM handler to ask for a graceful shutdown. */
+volatile sig_atomic_t shutdownRequested = 0;
+
+/** When serveRequests() began draining its connections (monotonicMs()), or 0 if it never did. */
+double drainStarted = 0;
+
+/** 
+ * @struct user
+ * @brief Represents a system user and their booking details.
+ */
+typedef struct user {
+    const char *username;     ///< Unique username for the user (interned, see intern()).
+    char password[100];       ///< Password for authentication.
+    const char *place;        ///< Currently booked tour destination (see internPlace()).
+    float price;              ///< Price per ticket for the booked tour.
+    int numberTicket;         ///< Number of tickets booked.
+    unsigned int version;     ///< Update counter; odd while an update is being applied.
+    unsigned char referenced; ///< Set when the record is used; cleared as the CLOCK hand passes.
+    struct user *next;        ///< Pointer to the next user in a linked list.
+} user;
+
+/**
+ * @struct bookingRequest
+ * @brief Booking to apply to a user record (see applyBooking()).
+ */
+typedef struct bookingRequest {
+    int placeIndex;           ///< Index of the destination in placeList.
+    int tickets;              ///< Number of tickets to book.
+} bookingRequest;
+
+/**
+ * @struct passwordRequest
+ * @brief Password change to apply to a user record (see applyPasswordChange()).
+ */
+typedef struct passwordRequest {
+    const char *current;      ///< Password the user proved knowledge of.
+    const char *replacement;  ///< New password.
+} passwordRequest;
+
+/**
+ * @struct cancellationRequest
+ * @brief Outcome of clearing a booking (see applyCancellation()).
+ */
+typedef struct cancellationRequest {
+    char reply[200];          ///< Reply describing the refund.
+    int placeIndex;           ///< Destination the cancelled booking was for.
+    int tickets;              ///< Tickets cancelled.
+    float refund;             ///< Amount refunded.
+} cancellationRequest;
+
+/** Number of tour packages offered in the catalog. */
+#define PLACE_COUNT 10
+
+/** Bytes a username or destination may take, terminator included (the size of fixed record fields). */
+#define NAME_SIZE 100
+
+/** Destination of a record without a booking; every such record points at this one string. */
+const char noPlace[] = "N/A";
+
+/** Bytes of string storage the intern pool allocates at a time. */
+#define INTERN_CHUNK 65536
+
+/**
+ * Open-addressed table of the interned strings, so each distinct username or
+ * destination is stored once and records compare them by pointer.
+ */
+const char **internTable = NULL;
+
+/** Slots in internTable (a power of two). */
+size_t internCapacity = 0;
+
+/** Strings in internTable. */
+size_t internCount = 0;
+
+/** Arena chunk the next interned string is copied into; strings are never freed. */
+char *internArena = NULL;
+
+/** Bytes left in internArena. */
+size_t internSpace = 0;
+
+/** Serializes the intern pool; replay threads intern concurrently at start-up. */
+pthread_mutex_t internLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Tour destinations, indexed by tour code number minus one. */
+const char *placeList[PLACE_COUNT] = {"Paris, France", "Tokyo, Japan", "Bangkok, Thailand", "Abu Dhabi, UAE",
+                                      "Miami, USA", "Rome, Italy", "Munich, Germany", "Madrid, Spain",
+                                      "Istanbul, Turkey", "Gilgit, Pakistan"};
+
+/** Price per ticket for each destination in placeList. */
+const float priceList[PLACE_COUNT] = {400000.0, 600000.0, 250000.0, 380000.0, 120000.0,
+                                      100000.0, 300000.0, 320000.0, 450000.0, 75000.0};
+
+/** Bytes an idempotency key may take, terminator included; longer keys are refused. */
+#define IDEMPOTENCY_KEY_SIZE 64
+
+/**
+ * @enum sessionStep
+ * @brief The input a suspended conversation is waiting for next.
+ *
+ * Login, booking and password change are multi-prompt conversations. Each one is
+ * driven as a state machine so a caller can suspend it while waiting for input and
+ * resume it later, interleaving any number of conversations on one thread.
+ */
+enum sessionStep {
+    stepLoginUsername,
+    stepLoginPassword,
+    stepBookingCode,
+    stepBookingConfirm,
+    stepBookingTickets,
+    stepPasswordCurrent,
+    stepPasswordNew,
+    stepDone
+};
+
+/**
+ * @struct session
+ * @brief State of one in-progress conversation between suspension points.
+ *
+ * A session only remembers the username it acts for, never a record pointer, so the
+ * user list may change while it is suspended; each step looks the record up again.
+ */
+typedef struct session {
+    enum sessionStep step;    ///< Input the session is waiting for.
+    char username[100];       ///< User the session acts for (set by a successful login).
+    char scratch[100];        ///< Input carried between steps (username or tour code).
+    char requestKey[IDEMPOTENCY_KEY_SIZE]; ///< Client idempotency key for a booking, or empty.
+    user *record;             ///< Authenticated record once a login session succeeds.
+    FILE *out;                ///< Stream receiving prompts and replies.
+} session;
+
+/** Number of slots in the idempotency table; bounds its memory use. */
+#define IDEMPOTENCY_SLOTS 1024
+
+/** Slots examined per lookup, so a lookup costs O(1) however full the table is. */
+#define IDEMPOTENCY_PROBES 8
+
+/** Seconds an idempotency key is remembered after its request completed. */
+#define IDEMPOTENCY_TTL 900
+
+/**
+ * @struct idempotencyEntry
+ * @brief Outcome of a completed mutating request, remembered under its key.
+ *
+ * A client retrying a booking or cancellation with the same key gets the original
+ * reply back instead of running the request (and rewriting the store) again.
+ */
+typedef struct idempotencyEntry {
+    char key[NAME_SIZE + IDEMPOTENCY_KEY_SIZE]; ///< "username/key"; empty for a free slot.
+    time_t expires;           ///< When the entry stops being honoured.
+    char reply[200];          ///< Reply sent when the request first completed.
+} idempotencyEntry;
+
+/** Open-addressed table of recently completed mutating requests. */
+idempotencyEntry idempotencyTable[IDEMPOTENCY_SLOTS];
+
+/** File whose bytes are locked to coordinate processes sharing "users.txt". */
+#define LOCK_FILE "users.lock"
+
+/** Number of per-record lock bytes; usernames hash onto them. */
+#define RECORD_LOCK_SLOTS 65536
+
+/**
+ * @struct storeStamp
+ * @brief Identity of "users.txt" as this process last read or wrote it.
+ *
+ * filing() replaces the store by rename, so a different inode, size or
+ * modification time means another process has written it since.
+ */
+typedef struct storeStamp {
+    dev_t device;
+    ino_t inode;
+    long long size;
+    long long mtimeSec;
+    long long mtimeNsec;
+} storeStamp;
+
+/** Store identity last seen by this process. */
+storeStamp knownStore;
+
+/** Descriptor of LOCK_FILE, opened on first use. */
+int lockFd = -1;
+
+/** Append-only log of record changes, read by other processes to stay current. */
+#define LOG_FILE "users.log"
+
+/** Sequence number of the last log entry this process has written or applied. */
+unsigned long logSeq = 0;
+
+/** Bytes of LOG_FILE this process has already applied. */
+long long logOffset = 0;
+
+/** Inode of LOG_FILE when logOffset was taken; a new inode means a new log. */
+ino_t logInode = 0;
+
+/** inotify descriptor watching the store directory, or -1 if unavailable. */
+int watchFd = -1;
+
+/** Local socket on which the first instance ships its log to follower processes. */
+#define REPLICATION_SOCKET "users.sock"
+
+/** Most followers one instance ships its log to. */
+#define MAX_FOLLOWERS 16
+
+/**
+ * @struct follower
+ * @brief A follower process receiving this instance's log.
+ */
+typedef struct follower {
+    int fd;                   ///< Connected socket, or -1 for a free slot.
+    long long offset;         ///< Bytes of LOG_FILE already shipped to it.
+} follower;
+
+/** Followers attached to this instance; free slots hold -1 until startReplication() runs, or forever if it never does. */
+follower followers[MAX_FOLLOWERS] = { [0 ... MAX_FOLLOWERS - 1] = { -1, 0 } };
+
+/** Listening replication socket, or -1 if this instance does not ship its log. */
+int listenFd = -1;
+
+/** In a follower, the connection to the instance shipping the log (or -1). */
+int leaderFd = -1;
+
+/** Set when the process runs as a read-only follower. */
+int followerMode = 0;
+
+/**
+ * @struct replicationState
+ * @brief What a follower has applied, for the replication lag metric.
+ */
+typedef struct replicationState {
+    unsigned long appliedSeq;     ///< Last log entry applied locally.
+    unsigned long leaderSeq;      ///< Last log entry the leader reported having.
+    long long appliedTime;        ///< When the last applied entry was written on the leader.
+    int snapshotting;             ///< Set while a snapshot from the leader is being received.
+    char pending[4096];           ///< Incomplete line received from the leader.
+    size_t pendingLength;         ///< Bytes held in pending.
+} replicationState;
+
+/** Replication progress of this process when it runs as a follower. */
+replicationState replica;
+
+/** Points each shard occupies on the consistent-hash ring. */
+#define VIRTUAL_NODES 64
+
+/** Most shards a router distributes accounts over. */
+#define MAX_SHARDS 32
+
+/** Most clients a shard engine or router serves at once. */
+#define MAX_CLIENTS 64
+
+/** Longest a shard engine or router keeps answering requests already sent once shutdown begins. */
+#define DRAIN_TIMEOUT_MS 5000
+
+/** Quiet time after which a draining connection is taken to have nothing more in flight. */
+#define DRAIN_IDLE_MS 100
+
+/**
+ * @struct shard
+ * @brief A booking-engine process owning part of the accounts.
+ *
+ * Each shard runs in its own directory "shard-<name>" holding its own store, and
+ * answers requests on the socket "shard-<name>/engine.sock".
+ */
+typedef struct shard {
+    char name[64];            ///< Shard name given on the command line.
+    int fd;                   ///< Connection from the router, or -1.
+} shard;
+
+/**
+ * @struct ringPoint
+ * @brief One virtual node of a shard on the consistent-hash ring.
+ */
+typedef struct ringPoint {
+    unsigned int hash;        ///< Position on the ring.
+    int shard;                ///< Index of the owning shard.
+} ringPoint;
+
+/** Shards known to the router. */
+shard shards[MAX_SHARDS];
+
+/** Number of entries used in shards. */
+int shardCount = 0;
+
+/** Ring positions of every shard, sorted by hash. */
+ringPoint ring[MAX_SHARDS * VIRTUAL_NODES];
+
+/** Number of entries used in ring. */
+int ringSize = 0;
+
+/** Router file listing the attached shards, one name per line, so a restart rebuilds the same ring. */
+#define ROUTER_SHARDS "router.shards"
+
+/** Router file listing old copies of moved accounts still to be dropped, as "shard<TAB>username" lines. */
+#define ROUTER_PENDING "router.pending"
+
+/**
+ * @struct movedAccount
+ * @brief An account being moved to a newly attached shard.
+ */
+typedef struct movedAccount {
+    int source;                   ///< Index of the shard it is moved from.
+    char username[NAME_SIZE];     ///< Its username.
+} movedAccount;
+
+/**
+ * @struct client
+ * @brief A connection sending line requests to a shard engine or router.
+ */
+typedef struct client {
+    int fd;                   ///< Connected socket, or -1 for a free slot.
+    char buffer[4096];        ///< Received bytes not yet forming a full request.
+    size_t length;            ///< Bytes held in buffer.
+} client;
+
+/** Magic bytes identifying a checkpoint file. */
+#define CHECKPOINT_MAGIC "TMSCHK3"
+
+/**
+ * @struct checkpointHeader
+ * @brief Header of the binary checkpoint written on shutdown for fast restart.
+ *
+ * The checkpoint is the state after replaying LOG_FILE up to logOffset; start-up
+ * replays only the events after it. Without a log, it is only trusted while
+ * "users.txt" still has the size and modification time recorded here.
+ */
+typedef struct checkpointHeader {
+    char magic[8];                ///< CHECKPOINT_MAGIC.
+    unsigned int count;           ///< Number of records following the header.
+    unsigned int checksum;        ///< CRC32C of the record bytes.
+    long long sourceSize;         ///< Size of "users.txt" when the checkpoint was taken.
+    long long sourceMtimeSec;     ///< Modification time of "users.txt" (seconds).
+    long long sourceMtimeNsec;    ///< Modification time of "users.txt" (nanoseconds).
+    unsigned long long logInode;  ///< Inode of LOG_FILE the checkpoint was derived from.
+    long long logOffset;          ///< Bytes of LOG_FILE covered by the checkpoint.
+    unsigned long logSeq;         ///< Last event covered by the checkpoint.
+} checkpointHeader;
+
+/** Most threads replaying the event log at start-up. */
+#define REPLAY_THREADS 16
+
+/**
+ * @struct replayEntry
+ * @brief Latest state of one user while the event log is replayed.
+ */
+typedef struct replayEntry {
+    user *record;             ///< Record being rebuilt (NULL for a free slot).
+    unsigned long order;      ///< When the user first appeared, to keep list order.
+    int dropped;              ///< Set once a DROP event removed the user.
+} replayEntry;
+
+/**
+ * @struct replayPartition
+ * @brief The users one replay thread owns, chosen by username hash.
+ *
+ * Each user's events land in exactly one partition, so partitions replay in
+ * parallel without sharing any state and still apply a user's events in order.
+ */
+typedef struct replayPartition {
+    const char *events;       ///< Complete event lines to replay.
+    size_t length;            ///< Bytes of events.
+    int index;                ///< This partition's number.
+    int count;                ///< Number of partitions.
+    unsigned long baseCount;  ///< Records in the checkpoint replay starts from.
+    replayEntry *table;       ///< Open-addressed table of this partition's users.
+    size_t capacity;          ///< Slots in table (a power of two).
+    size_t used;              ///< Occupied slots in table.
+} replayPartition;
+
+/**
+ * @struct checkpointRecord
+ * @brief Fixed-size image of one user, so a checkpoint loads with a single read.
+ */
+typedef struct checkpointRecord {
+    char username[100];
+    char password[100];
+    char place[100];
+    float price;
+    int numberTicket;
+} checkpointRecord;
+
+/**
+ * @enum coldState
+ * @brief State of a slot in the cold store.
+ */
+enum coldState { coldEmpty, coldLive, coldRemoved };
+
+/**
+ * @struct coldSlot
+ * @brief Slot of the on-disk hash table holding records evicted from memory.
+ */
+typedef struct coldSlot {
+    int state;                ///< A coldState; a never-written (zero) slot is empty.
+    checkpointRecord record;  ///< The evicted record.
+} coldSlot;
+
+/** Records packed into one block; removed records are tracked in a 64-bit mask. */
+#define PACK_BLOCK_RECORDS 64
+
+/** Most bytes packRecord() writes: three strings with their length bytes, the place byte, a price and the tickets. */
+#define PACK_RECORD_MAX (3 * NAME_SIZE + 16)
+
+/** Bits in the Bloom filter of a packed block. */
+#define PACK_FILTER_BITS 1024
+
+/** Place code of a record without a booking ("N/A"); codes below it index placeList. */
+#define PACK_NO_PLACE PLACE_COUNT
+
+/** Place code of a destination not in the catalog, stored as a string. */
+#define PACK_OTHER_PLACE (PLACE_COUNT + 1)
+
+/** Flag on a place code: the price differs from the catalog and follows as a float. */
+#define PACK_PRICE_FOLLOWS 0x80
+
+/**
+ * @struct packedBlock
+ * @brief Idle records kept in memory in compressed form.
+ *
+ * Records are sorted by username. Each stores the length of the prefix it shares
+ * with the previous username and only the rest of its own; the destination is a
+ * one-byte code into the catalog, and the price is left out when it is the
+ * catalog's. A record is decoded again whenever it is needed.
+ */
+typedef struct packedBlock {
+    struct packedBlock *next;                                   ///< Next newer block.
+    unsigned long long filter[PACK_FILTER_BITS / 64];           ///< Bloom filter of the usernames.
+    unsigned long long removed;                                 ///< Bit i set once record i left the block.
+    unsigned int count;                                         ///< Records packed.
+    unsigned int size;                                          ///< Bytes of data.
+    unsigned char data[];                                       ///< The encoded records.
+} packedBlock;
+
+/** Slots the cold store starts with (a power of two). */
+#define COLD_INITIAL_SLOTS 1024
+
+/** Cold store slots read with one system call when every record is visited. */
+#define COLD_BATCH 64
+
+/**
+ * @struct userCursor
+ * @brief Position while visiting every record: resident, then packed, then in the cold store.
+ */
+typedef struct userCursor {
+    user *next;                   ///< Next resident record, or NULL once they are done.
+    packedBlock *block;           ///< Packed block being decoded, or NULL once they are done.
+    unsigned int offset;          ///< Byte of the block's data holding the next record.
+    unsigned int index;           ///< Position of that record in the block.
+    char name[100];               ///< Username of the previous record in the block.
+    size_t slot;                  ///< Next cold store slot to examine.
+    coldSlot batch[COLD_BATCH];   ///< Slots read ahead from the cold store.
+    size_t batchStart;            ///< Slot held in batch[0].
+    size_t batchCount;            ///< Slots held in batch.
+} userCursor;
+
+/** Bytes of user records (resident and packed) allowed before the coldest are spilled; 0 for no limit. */
+size_t memoryBudget = 0;
+
+/** Oldest packed block; blocks are spilled to the cold store oldest first. */
+packedBlock *packedOldest = NULL;
+
+/** Newest packed block, where blocks are appended. */
+packedBlock *packedNewest = NULL;
+
+/** Bytes held by packed blocks. */
+size_t packedBytes = 0;
+
+/** Records held in packed blocks. */
+size_t packedUsers = 0;
+
+/** Anonymous file holding the cold store, or -1 until a record is first spilled. */
+int coldFd = -1;
+
+/** Slots in the cold store (a power of two). */
+size_t coldCapacity = 0;
+
+/** Records currently in the cold store. */
+size_t coldUsed = 0;
+
+/** Cold store slots whose record was faulted back in or removed. */
+size_t coldReleased = 0;
+
+/** Resident record the CLOCK hand examines next. */
+user *clockHand = NULL;
+
+/** Directory holding the periodic snapshots used for point-in-time queries. */
+#define HISTORY_DIR "history"
+
+/** Events between two history snapshots. */
+#define SNAPSHOT_INTERVAL 4096
+
+/** Sparse index mapping event times to LOG_FILE offsets. */
+#define TIME_INDEX_FILE "users.idx"
+
+/** Events between two time index entries. */
+#define TIME_INDEX_INTERVAL 64
+
+/**
+ * @struct timeIndexEntry
+ * @brief Position in LOG_FILE reached by a given time.
+ *
+ * Every event before offset was written at or before timestamp. Entries for which
+ * snapshot is set also name the file HISTORY_DIR/<seq>.chk holding the state there.
+ */
+typedef struct timeIndexEntry {
+    long long timestamp;          ///< Time the event ending at offset was written.
+    long long offset;             ///< Bytes of LOG_FILE up to and including event seq.
+    unsigned long long logInode;  ///< Inode of the log the offset refers to.
+    unsigned long seq;            ///< Sequence number of the last event before offset.
+    int snapshot;                 ///< Set if a snapshot of the state at seq was written.
+} timeIndexEntry;
+
+/** Append-only binary stream of audit records. */
+#define AUDIT_FILE "audit.bin"
+
+/** Records one thread's audit ring holds (a power of two). */
+#define AUDIT_RING_SIZE 1024
+
+/** Records the flusher writes with one system call. */
+#define AUDIT_BATCH 256
+
+/** Most threads with their own audit ring. */
+#define AUDIT_RINGS 32
+
+/**
+ * @struct auditRecord
+ * @brief One booking or cancellation, as stored in AUDIT_FILE.
+ */
+typedef struct auditRecord {
+    long long timestamp;      ///< Nanoseconds since the epoch.
+    unsigned int userId;      ///< ringHash() of the username.
+    unsigned int process;     ///< Process that made the change.
+    short tour;               ///< Index of the destination in placeList.
+    short ticketDelta;        ///< Tickets booked, negative when cancelled.
+    float amount;             ///< Amount charged, negative when refunded.
+} auditRecord;
+
+/**
+ * @struct auditRing
+ * @brief Single-producer, single-consumer queue of audit records.
+ *
+ * Only the owning thread advances head and only the flusher advances tail, so
+ * neither side takes a lock.
+ */
+typedef struct auditRing {
+    auditRecord records[AUDIT_RING_SIZE];
+    atomic_uint head;         ///< Records ever queued by the owning thread.
+    atomic_uint tail;         ///< Records ever written out by the flusher.
+} auditRing;
+
+/** Rings of every thread that has audited something. */
+_Atomic(auditRing*) auditRings[AUDIT_RINGS];
+
+/** Number of entries used in auditRings. */
+atomic_int auditRingCount;
+
+/** The calling thread's ring, created on its first audit record. */
+__thread auditRing *threadAudit = NULL;
+
+/** Background thread writing audit rings to AUDIT_FILE. */
+pthread_t auditFlusher;
+
+/** Starts auditFlusher exactly once. */
+pthread_once_t auditStarted = PTHREAD_ONCE_INIT;
+
+/** Set once auditFlusher has started. */
+atomic_int auditRunning;
+
+/** Asks auditFlusher to write what is left and exit. */
+atomic_int auditStopping;
+
+/** Serializes records written straight to AUDIT_FILE when no ring can take them. */
+pthread_mutex_t auditWriteLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Set once the fallback to direct writes has been reported. */
+int auditDirect = 0;
+
+/** Double-entry ledger of every charge and refund. */
+#define LEDGER_FILE "ledger.txt"
+
+/** Ledger account credited with charges and debited with refunds. */
+#define SALES_ACCOUNT "sales"
+
+/**
+ * @struct ledgerAccount
+ * @brief Running balance of one ledger account.
+ */
+typedef struct ledgerAccount {
+    char name[112];           ///< "sales", or "customer:<username>" (empty for a free slot).
+    long long balance;        ///< Debits minus credits, in paise.
+} ledgerAccount;
+
+/**
+ * @struct ledgerDay
+ * @brief Prefix sums of the ledger up to and including one day.
+ */
+typedef struct ledgerDay {
+    int day;                  ///< Local date as YYYYMMDD.
+    long long charges;        ///< Charges posted up to the end of the day, in paise.
+    long long refunds;        ///< Refunds posted up to the end of the day, in paise.
+} ledgerDay;
+
+/** Open-addressed table of account balances. */
+ledgerAccount *ledgerAccounts = NULL;
+
+/** Slots in ledgerAccounts (a power of two). */
+size_t ledgerCapacity = 0;
+
+/** Occupied slots in ledgerAccounts. */
+size_t ledgerUsed = 0;
+
+/** Prefix sums of every day with postings, sorted by day. */
+ledgerDay *ledgerDays = NULL;
+
+/** Entries used in ledgerDays. */
+size_t ledgerDayCount = 0;
+
+/** Entries allocated in ledgerDays. */
+size_t ledgerDayCapacity = 0;
+
+/** Bytes of LEDGER_FILE already posted to the in-memory balances. */
+long long ledgerOffset = 0;
+
+/** Inode of LEDGER_FILE when ledgerOffset was taken. */
+ino_t ledgerInode = 0;
+
+/** Highest transaction number posted from LEDGER_FILE. */
+unsigned long ledgerSeq = 0;
+
+/** Durable queue of refunds waiting to be paid out. */
+#define REFUND_QUEUE "refunds.queue"
+
+/** Directory receiving the bulk refund export files. */
+#define REFUND_DIR "refunds"
+
+/** Highest refund id settled before REFUND_QUEUE was last emptied; none at or below it is queued again. */
+#define REFUND_SETTLED "refunds.settled"
+
+/** Byte of LOCK_FILE guarding REFUND_QUEUE and postings to LEDGER_FILE (past the record lock bytes). */
+#define REFUND_LOCK (1 + RECORD_LOCK_SLOTS)
+
+/** Payment channel refunds are paid through (the one bookings are charged on). */
+#define REFUND_CHANNEL "card"
+
+/** Currency refunds are paid in. */
+#define REFUND_CURRENCY "INR"
+
+/**
+ * @struct refund
+ * @brief A pending refund read from REFUND_QUEUE.
+ *
+ * Queue lines start with a status letter, 'P' (pending) or 'S' (settled), which
+ * the batch processor overwrites in place once the refund has been exported.
+ */
+typedef struct refund {
+    long long offset;         ///< Position of the line's status letter in REFUND_QUEUE.
+    unsigned long id;         ///< Sequence number of the REFUND entry in LOG_FILE.
+    long long requested;      ///< When the refund was logged.
+    char username[100];       ///< Customer refunded.
+    long long amount;         ///< Amount in paise.
+    char channel[16];         ///< Payment channel.
+    char currency[8];         ///< Currency code.
+} refund;
+
+/** Directory the outbox dispatcher delivers notifications to. */
+#define OUTBOX_SPOOL "spool"
+
+/** Position of the outbox dispatcher in LOG_FILE, kept inside OUTBOX_SPOOL. */
+#define OUTBOX_CURSOR "spool/.cursor"
+
+/** Byte of LOCK_FILE held by the one process dispatching notifications. */
+#define OUTBOX_LOCK (2 + RECORD_LOCK_SLOTS)
+
+/** Byte of LOCK_FILE held while "users.txt" is rewritten from the user list. */
+#define STORE_LOCK (3 + RECORD_LOCK_SLOTS)
+
+/** Most notifications delivered in one spool file. */
+#define OUTBOX_BATCH 256
+
+/**
+ * @struct outboxCursor
+ * @brief How far the outbox dispatcher has delivered LOG_FILE.
+ */
+typedef struct outboxCursor {
+    unsigned long long logInode;  ///< Log the offset refers to.
+    long long offset;             ///< Bytes of the log already scanned for notifications.
+} outboxCursor;
+
+/** How far postFromLog() has scanned LOG_FILE, as an outboxCursor; only a hint, as postings are numbered. */
+#define POSTING_CURSOR "postings.cursor"
+
+/** Background thread delivering notifications from the outbox. */
+pthread_t outboxDispatcher;
+
+/** Set once outboxDispatcher has started. */
+int outboxRunning = 0;
+
+/** Asks outboxDispatcher to deliver what is left and exit. */
+atomic_int outboxStopping;
+
+/**
+ * @struct backupPosition
+ * @brief How much of LOG_FILE a backup directory holds ("backup.pos").
+ */
+typedef struct backupPosition {
+    unsigned long long logInode;  ///< Log the backup was taken from.
+    long long baseOffset;         ///< Bytes of the log covered by "base.chk".
+    long long offset;             ///< Bytes of the log covered by base and segments.
+} backupPosition;
+
+/**
+ * @struct backupSegment
+ * @brief A segment file found in a backup directory ("segment-<inode>-<offset>.log").
+ */
+typedef struct backupSegment {
+    char name[256];               ///< File name within the backup directory.
+    unsigned long long logInode;  ///< Log the segment was copied from.
+    long long offset;             ///< Position in that log of the segment's first byte.
+    long long size;               ///< Bytes in the segment.
+    int legacy;                   ///< Named by offset alone, as older backups did; assumed to be of the base's log.
+} backupSegment;
+
+/** Problems each verification thread describes in detail; the rest are only counted. */
+#define VERIFY_DETAILS 8
+
+/**
+ * @struct verifyTask
+ * @brief One thread's share of a file being verified.
+ */
+typedef struct verifyTask {
+    const char *path;         ///< File being verified, for messages.
+    const char *data;         ///< Complete lines to check.
+    size_t length;            ///< Bytes of data.
+    long long base;           ///< Offset of data in the file.
+    int log;                  ///< Set if the lines are log entries rather than "users.txt" records.
+    unsigned long records;    ///< Lines checked.
+    unsigned long problems;   ///< Lines failing a check.
+    unsigned long firstSeq;   ///< Sequence number of the first log entry (0 if none).
+    unsigned long lastSeq;    ///< Sequence number of the last log entry.
+    char details[VERIFY_DETAILS * 160];  ///< Descriptions of the first problems.
+    size_t detailsLength;     ///< Bytes used in details.
+} verifyTask;
+
+/**
+ * @struct importRow
+ * @brief One valid row of a CSV file being imported.
+ */
+typedef struct importRow {
+    char username[NAME_SIZE]; ///< Username of the new account.
+    char password[100];       ///< Its password.
+    int placeIndex;           ///< Destination booked, or -1 for none.
+    int tickets;              ///< Tickets booked.
+    long long offset;         ///< Offset of the row in the file; the first of duplicate rows wins.
+} importRow;
+
+/**
+ * @struct importTask
+ * @brief One thread's share of a CSV file being imported.
+ */
+typedef struct importTask {
+    const char *path;         ///< File being imported, for messages.
+    const char *data;         ///< Lines to parse.
+    size_t length;            ///< Bytes of data.
+    long long base;           ///< Offset of data in the file.
+    importRow *rows;          ///< Valid rows parsed from the share.
+    size_t count;             ///< Rows in rows.
+    size_t capacity;          ///< Rows rows has room for.
+    unsigned long problems;   ///< Rows rejected.
+    char details[VERIFY_DETAILS * 160];  ///< Descriptions of the first rejected rows.
+    size_t detailsLength;     ///< Bytes used in details.
+} importTask;
+
+/** Bytes an export reads from the store, and buffers for its output, per system call. */
+#define EXPORT_BUFFER (1 << 20)
+
+/** Most bytes one exported row can take: both strings escaped as \u00XX throughout, plus the keys and numbers. */
+#define EXPORT_ROW (2 * (6 * NAME_SIZE + 2) + 256)
+
+/** Largest amount, in rupees, an export writes; larger ones (and NaN) are written as this. */
+#define EXPORT_AMOUNT_MAX 1e15
+
+/** Identifies a columnar export, at its start and at its very end. */
+#define COLUMNAR_MAGIC "TMSCOL1"
+
+/** Accounts per row group of a columnar export; each group holds one chunk per column. */
+#define COLUMN_GROUP 16384
+
+/** Distinct destinations one row group's dictionary can hold; a fuller group is closed early. */
+#define COLUMN_DICTIONARY 256
+
+/** Maps a signed integer to an unsigned one that is small when the integer is near zero. */
+#define ZIGZAG(value) (((unsigned long long)(value) << 1) ^ (unsigned long long)((long long)(value) >> 63))
+
+/** Undoes ZIGZAG(). */
+#define UNZIGZAG(value) ((long long)((value) >> 1) ^ -(long long)((value) & 1))
+
+/**
+ * @enum exportFormat
+ * @brief File formats exportUsers() writes.
+ */
+typedef enum exportFormat {
+    exportCsv,      ///< Comma-separated values with a header row.
+    exportJsonl,    ///< One JSON object per line.
+    exportColumnar  ///< Row groups of encoded column chunks (see writeColumnGroup()).
+} exportFormat;
+
+/**
+ * @enum columnEncoding
+ * @brief How a column chunk of a columnar export is encoded.
+ */
+typedef enum columnEncoding {
+    encodingPrefix = 1,     ///< Strings sharing a prefix with the previous one store only the rest.
+    encodingDictionary,     ///< Distinct strings once, then a bit-packed index per row.
+    encodingPacked,         ///< Integers as bit-packed offsets from the smallest.
+    encodingDeltaPacked     ///< Integers as bit-packed offsets from the smallest difference to the previous one.
+} columnEncoding;
+
+/**
+ * @struct columnGroup
+ * @brief The row group a columnar export is filling, and what it has written so far.
+ */
+typedef struct columnGroup {
+    unsigned int rows;                              ///< Accounts in the group.
+    char names[COLUMN_GROUP][NAME_SIZE];            ///< Username column.
+    unsigned char places[COLUMN_GROUP];             ///< Destination column, as dictionary indexes.
+    long long prices[COLUMN_GROUP];                 ///< Ticket price column, in paise.
+    long long tickets[COLUMN_GROUP];                ///< Ticket count column.
+    char dictionary[COLUMN_DICTIONARY][NAME_SIZE];  ///< Destinations of the group; "" for no booking.
+    unsigned int entries;                           ///< Destinations in dictionary.
+    unsigned char *encoded;                         ///< Buffer a group is encoded into.
+    unsigned long long position;                    ///< Bytes of the file written.
+    unsigned long long *offsets;                    ///< Where each finished group starts, for the footer.
+    size_t groups;                                  ///< Finished groups.
+    size_t capacity;                                ///< Offsets offsets has room for.
+} columnGroup;
+
+/**
+ * @struct exportState
+ * @brief An export in progress, as exportLine() sees it.
+ */
+typedef struct exportState {
+    exportFormat kind;        ///< Format being written.
+    int target;               ///< Destination descriptor.
+    char *output;             ///< Buffer rows are formatted into (CSV and JSON Lines).
+    char *out;                ///< End of the rows in output.
+    columnGroup *group;       ///< Row group being filled (columnar).
+    unsigned long rows;       ///< Accounts exported.
+    unsigned long skipped;    ///< Lines that could not be read as accounts.
+} exportState;
+
+/** Anomalies a migration describes line by line; the rest are only counted. */
+#define MIGRATE_DETAILS 50
+
+/** Accounts the self-test's replay check spreads its log entries over. */
+#define SELF_TEST_USERS 2000
+
+/** Log entries the self-test's replay check writes; enough for the replay to run in parallel. */
+#define SELF_TEST_EVENTS 12000
+
+/** Accounts the self-test's columnar check exports; enough for several row groups. */
+#define SELF_TEST_ACCOUNTS 40000
+
+/**
+ * @struct selfCheck
+ * @brief One check run by --self-test.
+ */
+typedef struct selfCheck {
+    const char *name;         ///< What the check covers.
+    int (*run)(void);         ///< Runs the check in the current directory; returns 0 if it passed.
+} selfCheck;
+
+/** Descriptor a running check describes its failure on (its standard streams are silenced). */
+int selfTestReport = -1;
+
+/**
+ * @struct migrationState
+ * @brief A migration of "users.txt" in progress, as migrateLine() sees it.
+ */
+typedef struct migrationState {
+    int dryRun;                   ///< Report only; nothing is written.
+    int target;                   ///< Descriptor of the new store ("users.txt.tmp").
+    char *output;                 ///< Buffer new lines are formatted into.
+    char *out;                    ///< End of the lines in output.
+    unsigned long lines;          ///< Lines read.
+    unsigned long sealed;         ///< Lines already carrying a valid checksum.
+    unsigned long repaired;       ///< Destinations split across the password, put back together.
+    unsigned long anomalies;      ///< Records checkRecord() objects to, kept as they are.
+    unsigned long unreadable;     ///< Lines that are not records at all.
+    unsigned long described;      ///< Anomalies printed so far.
+    user *first;                  ///< Repaired records, to be logged.
+    user *last;                   ///< Last record of first.
+} migrationState;
+
+/** Stack samples the profiler keeps; older ones are overwritten. */
+#define PROFILE_SAMPLES 8192
+
+/** Deepest stack a sample records, in frames. */
+#define PROFILE_DEPTH 48
+
+/** File folded stacks are dumped to. */
+#define PROFILE_FILE "profile.folded"
+
+/** Highest sampling rate accepted, in samples per second; faster rates are clamped to it. */
+#define PROFILE_MAX_HERTZ 10000
+
+/**
+ * @struct profileSample
+ * @brief One stack recorded by the sampling profiler.
+ */
+typedef struct profileSample {
+    atomic_uint sequence;          ///< Odd while the sample is being written.
+    int depth;                     ///< Frames in frames.
+    void *frames[PROFILE_DEPTH];   ///< Return addresses, innermost first.
+} profileSample;
+
+/** Ring of recent samples; NULL while the profiler is off. */
+profileSample *profileRing = NULL;
+
+/** Samples taken so far; the next one goes to profileNext % PROFILE_SAMPLES. */
+atomic_ulong profileNext;
+
+/** Set from the SIGUSR2 handler to ask for a dump of the samples. */
+volatile sig_atomic_t profileDumpRequested = 0;
+
+/** Thread writing dumps on request. */
+pthread_t profileDumper;
+
+/** Keeps a dump on request and the dump at exit from writing PROFILE_FILE together. */
+pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Lookup table of the software CRC32C, filled on first use. */
+unsigned int crc32cTable[256];
+
+/** CRC32C routine picked for this CPU (hardware when SSE4.2 is available). */
+unsigned int (*crc32cUpdate)(unsigned int crc, const unsigned char *data, size_t length) = NULL;
+
+/** Picks crc32cUpdate exactly once, even when replay threads race to use it. */
+pthread_once_t crc32cChosen = PTHREAD_ONCE_INIT;
+
+/** Store lines and log entries rejected because their checksum did not match. */
+atomic_ulong checksumFailures;
+
+/* Function prototypes with Doxygen-style comments: */
+
+/**
+ * @brief Displays the list of available tour packages.
+ *
+ * This function clears the screen and prints the tour menu with pricing details.
+ */
+void showMenu(void);
+
+/**
+ * @brief Prints the tour packages and pricing details.
+ * @param out Stream receiving the catalog.
+ */
+void printCatalog(FILE *out);
+
+/**
+ * @brief Finds the record of a user by username.
+ * @param userptr Pointer to the user linked list.
+ * @param username Username to look for.
+ * @return Pointer to the matching record, or NULL if there is none.
+ */
+user* findUser(user *userptr, const char *username);
+
+/**
+ * @brief Returns the single stored copy of a string, adding it to the pool if needed.
+ *
+ * Interned strings live as long as the process, so equal strings can be compared
+ * by pointer.
+ * @param text String to intern.
+ * @return The interned copy.
+ */
+const char* intern(const char *text);
+
+/**
+ * @brief Looks a string up in the intern pool without adding it.
+ * @param text String to look up.
+ * @return The interned copy, or NULL if the string was never interned.
+ */
+const char* findInterned(const char *text);
+
+/**
+ * @brief Interns a destination, using the catalog's own strings for catalog destinations.
+ *
+ * Catalog destinations and "N/A" need no lock, which keeps parallel replay from
+ * contending on the pool.
+ * @param place Destination name.
+ * @return placeList entry, noPlace, or the interned copy of any other name.
+ */
+const char* internPlace(const char *place);
+
+/**
+ * @brief Finds the slot of a string in internTable (called with internLock held).
+ * @param text String to look for.
+ * @return Index of the slot holding the string or of the empty slot where it belongs.
+ */
+size_t internSlot(const char *text);
+
+/**
+ * @brief Finds a record among those resident in memory, without touching the cold store.
+ * @param userptr Pointer to the user linked list.
+ * @param username Username to look for.
+ * @return Pointer to the matching record, or NULL if it is not resident.
+ */
+user* findResident(user *userptr, const char *username);
+
+/**
+ * @brief Packs the least recently used records, and spills the oldest packed ones, until the rest fit memoryBudget.
+ *
+ * Half the budget holds resident records and half packed blocks. A CLOCK sweep
+ * picks the records to pack: the hand evicts records not used since it last
+ * passed them and clears the mark of the others. The head of the list is never
+ * evicted, so the head pointers held by callers stay valid and faulted-in records
+ * can be linked after it. Blocks beyond their half go to the cold store, oldest first.
+ * @param userptr Pointer to the head of the user linked list.
+ */
+void trimUsers(user *userptr);
+
+/**
+ * @brief Loads a packed or spilled record back into memory.
+ * @param userptr Pointer to the head of the user linked list; the record is linked after it.
+ * @param username User to load, or NULL for any such user (to refill an emptied list).
+ * @return The resident record, or NULL if the user is neither packed nor spilled.
+ */
+user* faultInUser(user *userptr, const char *username);
+
+/**
+ * @brief Packs evicted records into a new block and releases them.
+ * @param victims Records unlinked from the list.
+ * @param count Number of records (at most PACK_BLOCK_RECORDS).
+ */
+void packUsers(user **victims, unsigned int count);
+
+/**
+ * @brief Finds a user among the packed blocks.
+ * @param username User to look for, or NULL for the first packed user.
+ * @param block Receives the block holding the user.
+ * @param record Receives the (interned) username and field values.
+ * @return Position of the record in its block, or -1 if the user is not packed.
+ */
+int findPacked(const char *username, packedBlock **block, user *record);
+
+/**
+ * @brief Marks a packed record as gone, releasing its block once every record is.
+ * @param block Block holding the record.
+ * @param index Position of the record in the block.
+ */
+void releasePacked(packedBlock *block, int index);
+
+/**
+ * @brief Moves the live records of the oldest packed block to the cold store.
+ * @return 0 on success, -1 if the cold store could not be written.
+ */
+int spillOldestBlock(void);
+
+/**
+ * @brief Encodes one record after the previous one in a block.
+ * @param data Destination of the encoding.
+ * @param previous Username of the previous record ("" for the first).
+ * @param record Record to encode.
+ * @return Bytes written.
+ */
+unsigned int packRecord(unsigned char *data, const char *previous, const user *record);
+
+/**
+ * @brief Decodes one record of a block.
+ * @param data Encoded record.
+ * @param name Username of the previous record on entry; this record's on return.
+ * @param record Receives the field values; its username points at name.
+ * @return Bytes consumed.
+ */
+unsigned int unpackRecord(const unsigned char *data, char *name, user *record);
+
+/**
+ * @brief Tells whether a block's Bloom filter admits a username.
+ * @param block Block to test.
+ * @param hash ringHash() of the username.
+ * @return 1 if the user may be in the block, 0 if it certainly is not.
+ */
+int packedMayHold(const packedBlock *block, unsigned int hash);
+
+/**
+ * @brief Writes a record to the cold store.
+ * @param record Record to spill; the caller then releases it.
+ * @return 0 on success, -1 if the cold store could not be written.
+ */
+int spillUser(user *record);
+
+/**
+ * @brief Finds the cold store slot holding a user.
+ * @param username User to look for, or NULL for the first spilled user.
+ * @param slot Receives the slot.
+ * @return Index of the slot, or -1 if the user is not in the cold store.
+ */
+long long findColdSlot(const char *username, coldSlot *slot);
+
+/**
+ * @brief Marks a cold store slot as removed once its record left the cold store.
+ * @param index Index of the slot, or -1 for none.
+ */
+void releaseColdSlot(long long index);
+
+/**
+ * @brief Writes a slot to the first free position of its probe sequence.
+ * @param fd Descriptor of the cold store file.
+ * @param capacity Slots in that file.
+ * @param slot Live slot to write.
+ * @return 1 if a removed slot was reused, 0 if an empty one was, -1 on error.
+ */
+int placeColdSlot(int fd, size_t capacity, const coldSlot *slot);
+
+/**
+ * @brief Rebuilds the cold store with room for more records, dropping removed slots.
+ * @return 0 on success, -1 if no new store could be created.
+ */
+int growColdStore(void);
+
+/**
+ * @brief Applies stored field values to a spilled record, leaving it in the cold store.
+ * @param stored Record read from disk or the log.
+ * @return 1 if the user was in the cold store, 0 otherwise.
+ */
+int updateColdUser(const user *stored);
+
+/**
+ * @brief Starts a visit of every record, resident and spilled.
+ * @param cursor Cursor to initialize.
+ * @param userptr Pointer to the head of the user linked list.
+ */
+void startUsers(userCursor *cursor, user *userptr);
+
+/**
+ * @brief Returns the next record of a visit started with startUsers().
+ * @param cursor Position of the visit.
+ * @param copy Receives the username and field values.
+ * @return 1 if a record was returned, 0 once every record was visited.
+ */
+int nextUser(userCursor *cursor, user *copy);
+
+/**
+ * @brief Parses a size such as "512K", "64M" or "2G".
+ * @param text Number of bytes with an optional K, M or G suffix.
+ * @return The size in bytes.
+ */
+size_t parseSize(const char *text);
+
+/**
+ * @brief Finds a destination in the tour catalog.
+ * @param place Destination name.
+ * @return Index of the destination in placeList, or -1 if it is not offered.
+ */
+int findPlace(const char *place);
+
+/**
+ * @brief Takes a consistent copy of a user record without locking it.
+ *
+ * Retries while an update is in progress or if one completed during the copy.
+ * @param record Record to read.
+ * @param copy Receives the field values.
+ * @return Version of the record the copy was taken at.
+ */
+unsigned int snapshotUser(user *record, user *copy);
+
+/**
+ * @brief Applies new field values if the record is still at the expected version.
+ *
+ * Claims the record by compare-and-swap on its version, so concurrent updates of
+ * one record are serialized without a lock held across the request.
+ * @param record Record to update.
+ * @param expected Version the new values were computed from.
+ * @param proposed New field values (username and link are not changed).
+ * @return 1 if the update was applied, 0 if the record changed in the meantime.
+ */
+int commitUser(user *record, unsigned int expected, const user *proposed);
+
+/**
+ * @brief Updates a record optimistically, retrying when another update wins the race.
+ *
+ * The change is recomputed from a fresh snapshot on every attempt, so its
+ * validation always sees the latest committed state.
+ * @param record Record to update.
+ * @param change Computes the new values in place; returns 0 to abandon the update.
+ * @param context Request details passed to change.
+ * @return 1 if the update was committed, 0 if change abandoned it.
+ */
+int updateUser(user *record, int (*change)(user *copy, void *context), void *context);
+
+/**
+ * @brief Books a tour on a record copy, unless it already holds a booking.
+ * @param copy Record copy to change.
+ * @param context The bookingRequest.
+ * @return 1 to commit, 0 to abandon.
+ */
+int applyBooking(user *copy, void *context);
+
+/**
+ * @brief Clears the booking on a record copy and writes the refund reply.
+ * @param copy Record copy to change.
+ * @param context The cancellationRequest receiving the reply and what was cancelled.
+ * @return 1 to commit, 0 if there is no booking to cancel.
+ */
+int applyCancellation(user *copy, void *context);
+
+/**
+ * @brief Replaces the password on a record copy if the current one still matches.
+ * @param copy Record copy to change.
+ * @param context The passwordRequest.
+ * @return 1 to commit, 0 to abandon.
+ */
+int applyPasswordChange(user *copy, void *context);
+
+/**
+ * @brief Starts a login conversation.
+ * @param s Session to initialize.
+ * @param out Stream receiving prompts and replies.
+ */
+void loginStart(session *s, FILE *out);
+
+/**
+ * @brief Starts a booking conversation for a user.
+ *
+ * Finishes immediately if the user is unknown, already holds a booking, or the
+ * request key belongs to a booking that already completed (its reply is repeated).
+ * @param s Session to initialize.
+ * @param userptr Pointer to the user linked list.
+ * @param username User making the booking.
+ * @param requestKey Optional idempotency key supplied by the client (NULL or empty for none).
+ * @param out Stream receiving prompts and replies.
+ */
+void bookingStart(session *s, user *userptr, const char *username, const char *requestKey, FILE *out);
+
+/**
+ * @brief Starts a password change conversation for a user.
+ * @param s Session to initialize.
+ * @param username User changing their password.
+ * @param out Stream receiving prompts and replies.
+ */
+void changePasswordStart(session *s, const char *username, FILE *out);
+
+/**
+ * @brief Resumes a suspended conversation with the next line of input.
+ *
+ * Runs the session up to its next prompt (or to completion) without blocking.
+ * @param s Session waiting for input.
+ * @param userptr Pointer to the head pointer of the user list; updated in place.
+ * @param input The line of input the session was waiting for.
+ * @return 1 if the session is waiting for more input, 0 once it has finished.
+ */
+int sessionResume(session *s, user **userptr, const char *input);
+
+/**
+ * @brief Drives a session to completion from standard input.
+ * @param s Session to run.
+ * @param userptr Pointer to the head pointer of the user list; updated in place.
+ */
+void runSession(session *s, user **userptr);
+
+/**
+ * @brief Reads the next non-blank line from standard input.
+ * @param buffer Destination for the line, without its newline or leading blanks.
+ * @param size Size of the destination buffer.
+ * @return 1 if a line was read, 0 at end of input.
+ */
+int readLine(char *buffer, int size);
+
+/**
+ * @brief Initializes the user list from persistent storage.
+ *
+ * The state is derived from the event log: the last checkpoint plus every event
+ * after it, replayed in parallel. A store without a log is read from "users.txt"
+ * and its records become the first events of a new log.
+ * @param userptr Pointer to the current user linked list (can be NULL).
+ * @return Pointer to the head of the initialized user list.
+ */
+user* initializeUser(user* userptr);
+
+/**
+ * @brief Rebuilds the user list by replaying LOG_FILE after a starting state.
+ *
+ * Events are partitioned by username over several threads.
+ * @param base Starting state (the checkpoint), or NULL.
+ * @param offset Byte of LOG_FILE the starting state covers.
+ * @param limit Byte of LOG_FILE to stop at, or -1 to replay to the end.
+ * @return Pointer to the head of the rebuilt list.
+ */
+user* replayLog(user *base, long long offset, long long limit);
+
+/**
+ * @brief Replays the events of one partition (thread entry point).
+ * @param argument The replayPartition.
+ * @return NULL.
+ */
+void* replayPartitionEvents(void *argument);
+
+/**
+ * @brief Finds or creates the replay entry of a user in a partition.
+ * @param part Partition owning the user.
+ * @param username User to look up.
+ * @param hash ringHash() of the username.
+ * @param create Whether to add a missing user.
+ * @return The entry, or NULL if missing and create is 0.
+ */
+replayEntry* replaySlot(replayPartition *part, const char *username, unsigned int hash, int create);
+
+/**
+ * @brief Orders replay entries by first appearance (qsort comparator).
+ * @param a First replayEntry pointer.
+ * @param b Second replayEntry pointer.
+ * @return Negative, zero or positive as a comes before, with or after b.
+ */
+int compareReplayOrder(const void *a, const void *b);
+
+/**
+ * @brief Records the users of a store without a log as the log's first events.
+ * @param userptr Pointer to the head of the user linked list.
+ */
+void recordGenesis(user *userptr);
+
+/**
+ * @brief Adds an entry to the time index after the event just appended.
+ *
+ * Called with the store lock held, every TIME_INDEX_INTERVAL events and whenever
+ * a history snapshot is taken.
+ * @param snapshot Whether a snapshot of the state at logSeq was written.
+ */
+void indexLog(int snapshot);
+
+/**
+ * @brief Writes a history snapshot if the last append crossed a SNAPSHOT_INTERVAL boundary.
+ *
+ * Called with the store lock held, once the list reflects every event in the log.
+ * @param userptr Pointer to the head of the user linked list.
+ * @param before logSeq before the events just appended.
+ */
+void snapshotHistory(user *userptr, unsigned long before);
+
+/**
+ * @brief Prints the bookings outstanding at a past moment.
+ *
+ * The state is rebuilt from the last snapshot taken before that moment plus the
+ * events between the two, located through the time index.
+ * @param moment Date and time, "YYYY-MM-DD [HH:MM[:SS]]" in local time.
+ * @return Process exit status.
+ */
+int showAsOf(const char *moment);
+
+/**
+ * @brief Prints every event recorded for a user.
+ * @param username User whose history is printed.
+ * @return Process exit status.
+ */
+int showHistory(const char *username);
+
+/**
+ * @brief Adds a new user to the system.
+ *
+ * Prompts for username and password, checks for duplicates, and updates the user list.
+ * @param userptr Pointer to the head of the current user list.
+ * @return Pointer to the head of the updated user list.
+ */
+user* addUser(user* userptr);
+
+/**
+ * @brief Registers a new account without prompting.
+ *
+ * Used by addUser() and by shard engines serving remote requests.
+ * @param userptr Pointer to the head pointer of the user list; updated in place.
+ * @param username Username of the new account.
+ * @param password Password of the new account.
+ * @param out Stream receiving the reply.
+ * @return 1 if the account was created, 0 if the username is taken.
+ */
+int registerUser(user **userptr, const char *username, const char *password, FILE *out);
+
+/**
+ * @brief Authenticates a user trying to log in.
+ *
+ * Validates user credentials and updates system state on successful login.
+ * @param userptr Pointer to the user linked list.
+ * @return Pointer to the user record on successful login, or NULL otherwise.
+ */
+user* login(user* userptr);
+
+/**
+ * @brief Handles a tour booking for a logged-in user.
+ *
+ * Displays available packages, captures user selection, and stores booking details.
+ * @param userptr Pointer to the head pointer of the user list; updated in place.
+ */
+void booking(user **userptr);
+
+/**
+ * @brief Cancels a booked tour for the logged-in user.
+ *
+ * Searches for the user's booking and resets tour-related fields if found.
+ * @param userptr Pointer to the head pointer of the user list; updated in place.
+ */
+void cancellation(user **userptr);
+
+/**
+ * @brief Cancels the booking of a user, honouring an optional idempotency key.
+ *
+ * A retry carrying the key of a cancellation that already completed repeats the
+ * original reply without touching the store.
+ * @param userptr Pointer to the head pointer of the user list; updated in place.
+ * @param username User whose booking is cancelled.
+ * @param requestKey Optional idempotency key supplied by the client (NULL or empty for none).
+ * @param out Stream receiving the reply.
+ */
+void cancelBooking(user **userptr, const char *username, const char *requestKey, FILE *out);
+
+/**
+ * @brief Builds the "username/key" a request is remembered under.
+ *
+ * Booking and cancellation both go through here, so a key means the same thing
+ * to either. A name or key too long for the table is never cut short.
+ * @param buffer Receives the key; NAME_SIZE + IDEMPOTENCY_KEY_SIZE bytes.
+ * @param username User the request was made for.
+ * @param requestKey Idempotency key of the request (NULL or empty for none).
+ * @return 1 if the request has a key that fits, 0 otherwise.
+ */
+int idempotencyName(char *buffer, const char *username, const char *requestKey);
+
+/**
+ * @brief Looks up the reply remembered for a request key.
+ * @param username User the request was made for.
+ * @param requestKey Idempotency key of the request.
+ * @return The original reply, or NULL if the key is unknown or has expired.
+ */
+const char* idempotencyLookup(const char *username, const char *requestKey);
+
+/**
+ * @brief Remembers the reply of a completed request under its key.
+ *
+ * When every probed slot is live, the entry closest to expiry is evicted.
+ * @param username User the request was made for.
+ * @param requestKey Idempotency key of the request (ignored if NULL or empty).
+ * @param reply Reply sent for the request.
+ */
+void idempotencyStore(const char *username, const char *requestKey, const char *reply);
+
+/**
+ * @brief Queues an audit record for a booking or cancellation.
+ *
+ * Only copies the record into the calling thread's ring; auditFlusher writes it
+ * out with others in one batch. A thread that cannot have a ring, or a record
+ * made once the flusher is stopping, is written straight to AUDIT_FILE instead.
+ * @param username User whose booking changed.
+ * @param tour Index of the destination in placeList.
+ * @param ticketDelta Tickets booked, negative when cancelled.
+ * @param amount Amount charged, negative when refunded.
+ */
+void auditEvent(const char *username, int tour, int ticketDelta, float amount);
+
+/**
+ * @brief Appends one audit record to AUDIT_FILE without going through a ring.
+ *
+ * The first use is reported once; records are never dropped for want of a ring.
+ * @param record Record to write.
+ */
+void writeAuditRecord(const auditRecord *record);
+
+/**
+ * @brief Starts the audit flusher thread (run once through auditStarted).
+ */
+void startAudit(void);
+
+/**
+ * @brief Writes every queued audit record out in batches until asked to stop.
+ * @param argument Unused.
+ * @return NULL.
+ */
+void* flushAudit(void *argument);
+
+/**
+ * @brief Writes the records queued in all rings to AUDIT_FILE.
+ * @param fd Descriptor of AUDIT_FILE.
+ * @return Number of records written.
+ */
+size_t drainAudit(int fd);
+
+/**
+ * @brief Stops the flusher after it has written every queued record.
+ */
+void stopAudit(void);
+
+/**
+ * @brief Posts the CHARGE and REFUND entries of LOG_FILE not yet in the ledger.
+ *
+ * A charge debits the customer's account and credits SALES_ACCOUNT; a refund does
+ * the opposite, and is also queued in REFUND_QUEUE. The entries are logged in the
+ * same write as the booking or cancellation, and each transaction is numbered
+ * after its entry, so a posting lost to a crash is made by the next call and none
+ * is made twice.
+ */
+void postFromLog(void);
+
+/**
+ * @brief Does the work of postFromLog() for a caller already holding REFUND_LOCK.
+ *
+ * A refund is queued, and synced to disk, before its ledger posting is written,
+ * so a crash in between leaves it queued and only the posting is made again.
+ * @return 0 on success, -1 if the queue or the ledger could not be written.
+ */
+int postLogEntries(void);
+
+/**
+ * @brief Reads the highest refund id recorded in REFUND_SETTLED.
+ * @return The id, or 0 if none has been recorded.
+ */
+unsigned long settledRefunds(void);
+
+/**
+ * @brief Posts transactions appended to LEDGER_FILE since the last call.
+ *
+ * Balances and day totals are updated incrementally; only a replaced ledger is
+ * read again from the start.
+ */
+void syncLedger(void);
+
+/**
+ * @brief Applies one ledger line to the balances and day totals.
+ * @param line Transaction as written by postFromLog(); modified in place.
+ */
+void postLedgerLine(char *line);
+
+/**
+ * @brief Finds the slot of a ledger account.
+ * @param name Account name.
+ * @param create Whether to add a missing account.
+ * @return The account, or NULL if missing and create is 0.
+ */
+ledgerAccount* ledgerSlot(const char *name, int create);
+
+/**
+ * @brief Adds a posting to the prefix sums of its day and every later day.
+ * @param day Local date as YYYYMMDD.
+ * @param charges Amount charged, in paise.
+ * @param refunds Amount refunded, in paise.
+ */
+void addLedgerDay(int day, long long charges, long long refunds);
+
+/**
+ * @brief Finds the prefix sums up to the end of a day.
+ * @param day Local date as YYYYMMDD.
+ * @return Index of the last entry of ledgerDays not after day, or -1 if none is.
+ */
+long ledgerDayBefore(int day);
+
+/**
+ * @brief Reports the balance of one account or the totals of a period.
+ * @param argc Number of arguments after "--ledger".
+ * @param argv "balance <username>", or "period <from> <to>" with dates as YYYY-MM-DD.
+ * @return Process exit status.
+ */
+int showLedger(int argc, char **argv);
+
+/**
+ * @brief Pays out every pending refund in bulk.
+ *
+ * Refunds logged but not yet queued are queued first. Pending refunds are grouped
+ * by channel and currency, each group is exported to one file in REFUND_DIR, and
+ * the refunds are then marked settled. The queue is emptied once everything in it
+ * is settled and posted, after its highest id is recorded in REFUND_SETTLED.
+ * Nothing is settled if the logged refunds could not all be queued and posted.
+ * @return Process exit status.
+ */
+int processRefunds(void);
+
+/**
+ * @brief Writes one group of refunds to a bulk export file.
+ * @param batch Refunds of one channel and currency.
+ * @param count Number of refunds.
+ * @param stamp Time the batch run started, used in the file name with the first refund id.
+ * @return 0 on success, -1 if the file could not be written.
+ */
+int exportRefunds(const refund *batch, size_t count, time_t stamp);
+
+/**
+ * @brief Orders refunds by channel, currency and id (qsort comparator).
+ * @param a First refund.
+ * @param b Second refund.
+ * @return Negative, zero or positive as a comes before, with or after b.
+ */
+int compareRefunds(const void *a, const void *b);
+
+/**
+ * @brief Backs the store up into a directory while it stays in use.
+ *
+ * The first run writes a base snapshot of the state at a log position; every
+ * later run only copies the log bytes appended since as a new segment file.
+ * Nothing is locked: the log is append-only, so its complete lines never change.
+ * @param directory Backup directory (created if missing).
+ * @return Process exit status.
+ */
+int runBackup(const char *directory);
+
+/**
+ * @brief Deletes the segment files of a backup directory.
+ *
+ * Segments hold offsets into the log their base was taken from, so they are
+ * removed whenever a new base replaces it.
+ * @param directory Backup directory.
+ * @return 0 on success, -1 if a segment could not be removed.
+ */
+int removeSegments(const char *directory);
+
+/**
+ * @brief Copies a range of LOG_FILE into a new segment file without passing it through user space.
+ * @param fd Descriptor of LOG_FILE.
+ * @param path Segment file to create.
+ * @param from First byte to copy.
+ * @param to Byte to stop at.
+ * @return 0 on success, -1 on failure.
+ */
+int copyLogRange(int fd, const char *path, long long from, long long to);
+
+/**
+ * @brief Copies a byte range between files inside the kernel.
+ *
+ * Uses copy_file_range(), falling back to sendfile() where it is unsupported.
+ * @param in Source descriptor.
+ * @param out Destination descriptor; written at its current position.
+ * @param from First byte of in to copy.
+ * @param to Byte of in to stop at.
+ * @return 0 on success, -1 on failure.
+ */
+int copyRange(int in, int out, long long from, long long to);
+
+/**
+ * @brief Checks the store, its log and its checkpoints without changing them.
+ *
+ * Every record and log entry is checked against the field invariants, checkpoint
+ * checksums are recomputed, and "users.txt" is compared with the state the log
+ * produces. Files are scanned in parallel.
+ * @return Process exit status: 0 if no problem was found.
+ */
+int verifyStore(void);
+
+/**
+ * @brief Checks every line of a store or log file in parallel.
+ * @param path File to check.
+ * @param log Whether the file holds log entries.
+ * @return Number of problems found.
+ */
+unsigned long verifyFile(const char *path, int log);
+
+/**
+ * @brief Checks the lines of one share of a file (thread entry point).
+ * @param argument The verifyTask.
+ * @return NULL.
+ */
+void* verifyLines(void *argument);
+
+/**
+ * @brief Checks the field invariants of one record.
+ * @param record Record to check.
+ * @return Description of the first violated invariant, or NULL if the record is sound.
+ */
+const char* checkRecord(const user *record);
+
+/**
+ * @brief Recomputes the checksum of a checkpoint file and checks its records.
+ * @param path Checkpoint file.
+ * @return Number of problems found.
+ */
+unsigned long verifyCheckpoint(const char *path);
+
+/**
+ * @brief Compares "users.txt" with the state replayed from the log.
+ * @return Number of accounts that differ.
+ */
+unsigned long verifyView(void);
+
+/**
+ * @brief Orders user pointers by username (qsort comparator).
+ * @param a First user pointer.
+ * @param b Second user pointer.
+ * @return Negative, zero or positive as a comes before, with or after b.
+ */
+int compareUsernames(const void *a, const void *b);
+
+/**
+ * @brief Orders strings (qsort comparator over char pointers).
+ * @param a First string pointer.
+ * @param b Second string pointer.
+ * @return Negative, zero or positive as a comes before, with or after b.
+ */
+int compareNames(const void *a, const void *b);
+
+/**
+ * @brief Orders backup segments by log offset, legacy names last (qsort comparator).
+ * @param a First segment.
+ * @param b Second segment.
+ * @return Negative, zero or positive as a comes before, with or after b.
+ */
+int compareSegments(const void *a, const void *b);
+
+/**
+ * @brief Rebuilds the store in the current directory from a backup.
+ *
+ * The backup's segments become the new log, replayed in parallel on top of its
+ * base snapshot; "users.txt" and the restart checkpoint are written from the result.
+ * Only segments of the base's log that continue it without a gap are used.
+ * @param directory Backup directory written by runBackup().
+ * @return Process exit status.
+ */
+int restoreBackup(const char *directory);
+
+/**
+ * @brief Adds the accounts (and bookings) listed in a CSV file in one commit.
+ *
+ * Rows are "username,password[,destination,tickets]"; a destination is a catalog
+ * name or tour code. The file is parsed in parallel, rows are checked against the
+ * catalog and deduplicated in one sorted pass against each other and the store,
+ * and every new account is logged with a single write and filed once.
+ * @param path CSV file to import.
+ * @return Process exit status: 1 if any row was skipped or the import failed.
+ */
+int importUsers(const char *path);
+
+/**
+ * @brief Parses one share of a CSV file (thread entry point).
+ * @param argument The importTask.
+ * @return NULL.
+ */
+void* parseImportLines(void *argument);
+
+/**
+ * @brief Checks the fields of one CSV row and converts them.
+ * @param fields Fields of the row.
+ * @param count Number of fields.
+ * @param row Receives the account.
+ * @return NULL if the row is valid, otherwise what is wrong with it.
+ */
+const char* parseImportRow(char **fields, int count, importRow *row);
+
+/**
+ * @brief Splits a CSV line into fields in place, undoing double-quote quoting.
+ * @param line Line without its newline; modified in place.
+ * @param fields Receives pointers to the fields.
+ * @param max Most fields to return.
+ * @return Number of fields, or max + 1 if the line has more.
+ */
+int splitCsv(char *line, char **fields, int max);
+
+/**
+ * @brief Orders import rows by username, then by position in the file (qsort comparator).
+ * @param a First importRow pointer.
+ * @param b Second importRow pointer.
+ * @return Negative, zero or positive as a comes before, with or after b.
+ */
+int compareImportRows(const void *a, const void *b);
+
+/**
+ * @brief Takes or releases the record locks of every name in an import.
+ *
+ * The locks registerUser() holds while it checks a name are taken in ascending
+ * order, a run of neighbouring slots at a time, before the store lock, so an
+ * interactive registration cannot check a name between the import's check and
+ * its commit.
+ * @param rows Rows of the import.
+ * @param count Number of rows.
+ * @param type F_WRLCK to lock, F_UNLCK to release.
+ */
+void lockImportRecords(importRow **rows, size_t count, short type);
+
+/**
+ * @brief Appends the state of a chain of records to LOG_FILE with a single write.
+ *
+ * The bulk counterpart of appendLog(), with the same locking rules.
+ * @param operation Operation name.
+ * @param first First record of the chain; every record linked after it is logged.
+ * @param charge Whether each booking in the chain is charged, with a CHARGE entry after its record.
+ * @return 0 on success, -1 if the entries could not be written.
+ */
+int appendLogBatch(const char *operation, user *first, int charge);
+
+/**
+ * @brief Formats a log entry, sealed with its checksum.
+ * @param entry Destination of the entry, including its newline.
+ * @param size Size of entry.
+ * @param seq Sequence number of the entry.
+ * @param now Time the entry is written.
+ * @param operation Operation name.
+ * @param record Record whose state is logged.
+ * @return Length of the entry.
+ */
+int formatLogEntry(char *entry, size_t size, unsigned long seq, long long now, const char *operation, user *record);
+
+/**
+ * @brief Formats a ledger transaction as postFromLog() writes it.
+ * @param entry Destination of the transaction, including its newline.
+ * @param size Size of entry.
+ * @param seq Log entry the transaction is posted from.
+ * @param timestamp Time the entry was written.
+ * @param username Customer charged or refunded.
+ * @param amount Amount in paise.
+ * @param refund Whether the amount is refunded rather than charged.
+ * @return Length of the transaction.
+ */
+int formatTransaction(char *entry, size_t size, unsigned long seq, long long timestamp, const char *username,
+                      long long amount, int refund);
+
+/**
+ * @brief Formats the CHARGE or REFUND entry logged with a booking or cancellation, sealed with its checksum.
+ * @param entry Destination of the entry, including its newline.
+ * @param size Size of entry.
+ * @param seq Sequence number of the entry.
+ * @param now Time the entry is written.
+ * @param username Customer charged or refunded.
+ * @param amount Amount charged (positive) or refunded (negative), in rupees.
+ * @return Length of the entry.
+ */
+int formatPostingEntry(char *entry, size_t size, unsigned long seq, long long now, const char *username, float amount);
+
+/**
+ * @brief Streams every account, with its booking, to a CSV or JSON Lines file.
+ *
+ * The export reads the "users.txt" that is current when it starts (it is only
+ * ever replaced, never rewritten, so an open descriptor stays a consistent
+ * snapshot) a megabyte at a time, and writes through a buffer of the same size,
+ * so memory use does not grow with the store.
+ * @param path Destination file, or "-" for standard output.
+ * @param format "csv", "jsonl" or "columnar"; NULL picks JSON Lines for a ".jsonl" or ".json" path,
+ *        columnar for a ".tmscol" path and CSV otherwise.
+ * @return Process exit status: 0 on success, 1 on failure.
+ */
+int exportUsers(const char *path, const char *format);
+
+/**
+ * @brief Rewrites "users.txt" from the legacy unsealed format into sealed lines, in constant memory.
+ *
+ * Every line is parsed as parseUserLine() reads the store, checked against the
+ * catalog, and written back with its checksum. A destination that is not in the
+ * catalog but matches one when case and blanks are ignored and the end of the
+ * password is taken into account (a legacy line such as "bob secret paris,  france
+ * ...") is repaired, and the repair is logged so the log agrees with the store.
+ * Other anomalies are reported and kept. The migration holds the store lock and
+ * changes nothing if any line cannot be read.
+ * @param dryRun Nonzero to only report what the migration would do.
+ * @return Process exit status: 1 if a line cannot be read or the store could not be written.
+ */
+int migrateStore(int dryRun);
+
+/**
+ * @brief Migrates one line of "users.txt" (a streamLines() visitor).
+ * @param line Line without its newline; modified in place.
+ * @param context The migrationState.
+ * @return 0 to go on, -1 if the new store could not be written.
+ */
+int migrateLine(char *line, void *context);
+
+/**
+ * @brief Looks for a catalog destination the end of a legacy record's password and destination spell.
+ * @param record Record whose destination is not in the catalog; its password and destination are
+ *        replaced when a match is found.
+ * @return Catalog index of the destination, or -1 if none matches.
+ */
+int repairPlace(user *record);
+
+/**
+ * @brief Compares two destination names, ignoring case and blanks.
+ * @param a First name.
+ * @param b Second name.
+ * @return Nonzero if they match.
+ */
+int samePlaceName(const char *a, const char *b);
+
+/**
+ * @brief Exports one line of "users.txt" (a streamLines() visitor).
+ * @param line Line without its newline; modified in place.
+ * @param context The exportState.
+ * @return 0 to go on, -1 if the output could not be written.
+ */
+int exportLine(char *line, void *context);
+
+/**
+ * @brief Reads a file a buffer at a time and hands each line to a visitor.
+ *
+ * Memory use is one EXPORT_BUFFER however long the file is. A final line without
+ * a newline is visited too.
+ * @param fd Descriptor to read from its current position.
+ * @param visit Called with each line, newline removed; returning nonzero stops the stream.
+ * @param context Passed to visit.
+ * @return 0 when the whole file was visited, -1 on a read error, or what visit returned to stop.
+ */
+int streamLines(int fd, int (*visit)(char *line, void *context), void *context);
+
+/**
+ * @brief Adds an account to a columnar export, writing out the row group when it is full.
+ * @param group Export being written.
+ * @param fd Destination descriptor.
+ * @param record Account to add.
+ * @return 0 on success, -1 if a full group could not be written.
+ */
+int addColumnRow(columnGroup *group, int fd, const user *record);
+
+/**
+ * @brief Encodes the current row group and writes it out.
+ *
+ * A group is its row count and byte length followed by one chunk per column
+ * (username, destination, price, tickets), each a column number, a
+ * columnEncoding and a byte length ahead of the encoded values.
+ * @param group Export being written.
+ * @param fd Destination descriptor.
+ * @return 0 on success, -1 on failure.
+ */
+int writeColumnGroup(columnGroup *group, int fd);
+
+/**
+ * @brief Writes the last row group and the footer listing where each group starts.
+ * @param group Export being written.
+ * @param fd Destination descriptor.
+ * @return 0 on success, -1 on failure.
+ */
+int finishColumns(columnGroup *group, int fd);
+
+/**
+ * @brief Encodes an integer column, choosing whichever of encodingPacked and encodingDeltaPacked is smaller.
+ * @param out Destination.
+ * @param encoding Receives the columnEncoding chosen.
+ * @param values Column values.
+ * @param count Number of values (at least one).
+ * @return Pointer just past the encoded values.
+ */
+unsigned char* encodeIntegers(unsigned char *out, unsigned char *encoding, const long long *values, unsigned int count);
+
+/**
+ * @brief Packs values into width bits each, least significant bit first.
+ * @param out Destination.
+ * @param values Values to pack; each must fit in width bits.
+ * @param count Number of values.
+ * @param width Bits per value (0 to 64).
+ * @return Pointer just past the packed bits.
+ */
+unsigned char* packBits(unsigned char *out, const unsigned long long *values, unsigned int count, int width);
+
+/**
+ * @brief Writes an unsigned integer as a little-endian base-128 varint.
+ * @param out Destination.
+ * @param value Value to write.
+ * @return Pointer just past the varint.
+ */
+unsigned char* putVarint(unsigned char *out, unsigned long long value);
+
+/**
+ * @brief Reads a columnar export back, an account at a time.
+ *
+ * The footer is checked against the file size, the groups must follow each other
+ * from the start of the file to the footer, and every chunk must be exactly as
+ * long as it says, so a damaged file is refused rather than misread.
+ * @param path Columnar file.
+ * @param visit Called with each account, in file order; returning nonzero stops the decode.
+ * @param context Passed to visit.
+ * @return 0 when every group was decoded, -1 if the file is unreadable or damaged, or what visit returned.
+ */
+int decodeColumns(const char *path, int (*visit)(const user *record, void *context), void *context);
+
+/**
+ * @brief Decodes one row group of a columnar export (the inverse of writeColumnGroup()).
+ * @param in Start of the group.
+ * @param end End of the bytes the group may use.
+ * @param group Receives the rows and dictionary of the group.
+ * @return Pointer just past the group, or NULL if it is damaged.
+ */
+const unsigned char* readColumnGroup(const unsigned char *in, const unsigned char *end, columnGroup *group);
+
+/**
+ * @brief Decodes an integer column written by encodeIntegers().
+ * @param in Start of the encoded values.
+ * @param end End of the chunk.
+ * @param encoding encodingPacked or encodingDeltaPacked.
+ * @param values Receives the values.
+ * @param count Number of values (at least one).
+ * @return Pointer just past the values, or NULL if they are damaged.
+ */
+const unsigned char* decodeIntegers(const unsigned char *in, const unsigned char *end, int encoding,
+                                    long long *values, unsigned int count);
+
+/**
+ * @brief Unpacks values written by packBits().
+ * @param in Start of the packed bits.
+ * @param end End of the bytes they may use.
+ * @param values Receives the values.
+ * @param count Number of values.
+ * @param width Bits per value (0 to 64).
+ * @return Pointer just past the packed bits, or NULL if they run past end.
+ */
+const unsigned char* unpackBits(const unsigned char *in, const unsigned char *end, unsigned long long *values,
+                                unsigned int count, int width);
+
+/**
+ * @brief Reads a varint written by putVarint().
+ * @param in Start of the varint.
+ * @param end End of the bytes it may use.
+ * @param value Receives the value.
+ * @return Pointer just past the varint, or NULL if it runs past end or is too long.
+ */
+const unsigned char* getVarint(const unsigned char *in, const unsigned char *end, unsigned long long *value);
+
+/**
+ * @brief Writes a columnar export out again as CSV or JSON Lines.
+ *
+ * The rows are formatted as exportUsers() formats them, so decoding a columnar
+ * export gives the same bytes as exporting the same store as CSV.
+ * @param path Columnar file.
+ * @param target Descriptor the rows are written to.
+ * @param format "csv" or "jsonl" (NULL for CSV).
+ * @return Process exit status: 0 on success, 1 on failure.
+ */
+int decodeExport(const char *path, int target, const char *format);
+
+/**
+ * @brief Adds one decoded account to the rows being written (a decodeColumns() visitor).
+ * @param record Account decoded.
+ * @param context The exportState being written.
+ * @return 0 to go on, -1 if the rows could not be written.
+ */
+int decodeRow(const user *record, void *context);
+
+/**
+ * @brief Formats one account as an export row.
+ * @param out Destination; needs room for EXPORT_ROW bytes.
+ * @param record Account to format.
+ * @param json Nonzero for a JSON Lines object, zero for a CSV row.
+ * @return Pointer just past the row, including its newline.
+ */
+char* formatExportRow(char *out, const user *record, int json);
+
+/**
+ * @brief Writes an integer in decimal.
+ * @param out Destination.
+ * @param value Value to write.
+ * @return Pointer just past the digits.
+ */
+char* appendInteger(char *out, long long value);
+
+/**
+ * @brief Writes an amount in rupees with two decimals, rounded to the paisa.
+ *
+ * Magnitudes beyond EXPORT_AMOUNT_MAX are clamped, so the row stays within
+ * EXPORT_ROW and the conversion to paise cannot overflow.
+ * @param out Destination.
+ * @param amount Amount to write.
+ * @return Pointer just past the amount.
+ */
+char* appendAmount(char *out, double amount);
+
+/**
+ * @brief Writes a CSV field, quoted if it contains a comma, quote or line break.
+ * @param out Destination.
+ * @param text Field value.
+ * @return Pointer just past the field.
+ */
+char* appendCsvField(char *out, const char *text);
+
+/**
+ * @brief Writes a JSON string literal.
+ * @param out Destination.
+ * @param text String value.
+ * @return Pointer just past the closing quote.
+ */
+char* appendJsonString(char *out, const char *text);
+
+/**
+ * @brief Writes all of a buffer to a descriptor, retrying short writes.
+ * @param fd Destination descriptor.
+ * @param data Bytes to write.
+ * @param length Number of bytes.
+ * @return 0 on success, -1 on failure.
+ */
+int writeAll(int fd, const char *data, size_t length);
+
+/**
+ * @brief Prints the audit trail, optionally for one user only.
+ * @param username User to show, or NULL for everyone.
+ * @return Process exit status.
+ */
+int showAudit(const char *username);
+
+/**
+ * @brief Changes the password for the logged-in user.
+ *
+ * Prompts for the current password, validates it, then allows a new password to be set.
+ * @param userptr Pointer to the head pointer of the user list; updated in place.
+ */
+void changePassword(user **userptr);
+
+/**
+ * @brief Logs out the current user.
+ *
+ * Resets the current user and system state to the default menu state.
+ */
+void logout(void);
+
+/**
+ * @brief Checks and displays current booking details for the logged-in user.
+ *
+ * Calculates the total cost based on price and number of tickets.
+ * @param userptr Pointer to the user linked list.
+ */
+void checkTicket(user* userptr);
+
+/**
+ * @brief Reports the booking of a user.
+ * @param userptr Pointer to the user linked list.
+ * @param username User whose booking is reported.
+ * @param out Stream receiving the report.
+ */
+void reportTicket(user *userptr, const char *username, FILE *out);
+
+/**
+ * @brief Writes the current user list to the file.
+ *
+ * Updates the "users.txt" file with the latest user booking and login details.
+ * @param userptr Pointer to the head of the user linked list.
+ */
+void filing(user* userptr);
+
+/**
+ * @brief Parses one line of "users.txt" into a record.
+ *
+ * Fields are separated by blanks, but passwords and destinations ("Paris, France")
+ * may contain blanks too. The line is therefore read from both ends: the username
+ * is the first word, tickets and price the last two, and the destination is the
+ * longest catalog entry (or "N/A") ending the remainder; the password is what is left.
+ * The username and destination of record point into line, which must outlive them
+ * (intern them to keep them). A trailing checksum (see sealLine()) is verified and removed first; lines
+ * written before checksums were introduced have none and are accepted as they are.
+ * @param line Line to parse; modified in place.
+ * @param record Receives the parsed fields (version and link are not touched).
+ * @return 1 on success, 0 if the line is malformed or fails its checksum.
+ */
+int parseUserLine(char *line, user *record);
+
+/**
+ * @brief Formats a record as a "users.txt" line, sealed with its checksum.
+ * @param buffer Destination of the line, including its newline.
+ * @param size Size of buffer.
+ * @param username Username of the record.
+ * @param copy Field values of the record.
+ * @return Length of the line.
+ */
+int formatRecord(char *buffer, size_t size, const char *username, const user *copy);
+
+/**
+ * @brief Appends the CRC32C of a line to it, as a final " #xxxxxxxx" word, and a newline.
+ * @param line Line without its newline; must have room for 11 more characters.
+ * @param length Length of the line.
+ * @param size Size of the buffer holding line.
+ * @return New length of the line.
+ */
+int sealLine(char *line, int length, size_t size);
+
+/**
+ * @brief Verifies and removes the checksum sealLine() appended to a line.
+ * @param line Line, with or without its newline; modified in place.
+ * @return 1 if the checksum matched, 0 if the line has none, -1 if it does not match.
+ */
+int stripChecksum(char *line);
+
+/**
+ * @brief Computes the CRC32C (Castagnoli) of a buffer.
+ * @param data Bytes to checksum.
+ * @param length Number of bytes.
+ * @return The CRC.
+ */
+unsigned int crc32c(const void *data, size_t length);
+
+/**
+ * @brief Chooses the CRC32C routine for this CPU (run once through crc32cChosen).
+ */
+void chooseCrc32c(void);
+
+/**
+ * @brief Advances a CRC32C one byte at a time using crc32cTable.
+ * @param crc CRC state so far.
+ * @param data Bytes to add.
+ * @param length Number of bytes.
+ * @return The updated CRC state.
+ */
+unsigned int crc32cSoftware(unsigned int crc, const unsigned char *data, size_t length);
+
+#if defined(__x86_64__)
+/**
+ * @brief Advances a CRC32C eight bytes at a time with the SSE4.2 crc32 instruction.
+ * @param crc CRC state so far.
+ * @param data Bytes to add.
+ * @param length Number of bytes.
+ * @return The updated CRC state.
+ */
+__attribute__((target("sse4.2")))
+unsigned int crc32cHardware(unsigned int crc, const unsigned char *data, size_t length);
+#endif
+
+/**
+ * @brief Parses the sequence number, time and operation that start a log entry.
+ *
+ * Hand-rolled rather than sscanf(), as start-up replay and verification run it
+ * on every entry of the log.
+ * @param line Log entry.
+ * @param seq Receives the sequence number.
+ * @param timestamp Receives the time the entry was written.
+ * @param operation Receives the operation name (at least 16 characters).
+ * @param consumed Receives the offset of the rest of the entry.
+ * @return 1 on success, 0 if the entry is malformed.
+ */
+int parseLogHeader(const char *line, unsigned long *seq, long long *timestamp, char *operation, int *consumed);
+
+/**
+ * @brief Tells whether log entries of an operation carry a user record.
+ * @param operation Operation name.
+ * @return 0 for NOTIFY, CHARGE and REFUND entries, 1 otherwise.
+ */
+int carriesRecord(const char *operation);
+
+/**
+ * @brief Parses a price as written by "%f", falling back to strtof() for other forms.
+ * @param text Text to parse.
+ * @param end Receives the first character after the number (text if there is none).
+ * @return The price.
+ */
+float parsePrice(const char *text, char **end);
+
+/**
+ * @brief Brings the user list up to date with changes made by other processes.
+ *
+ * New entries at the end of LOG_FILE are applied one record at a time. Only if
+ * the log cannot be followed (it was replaced, or there is none) is "users.txt"
+ * re-read and merged; otherwise the store may lag the log and would roll back
+ * records already applied from it.
+ * @param userptr Pointer to the head of the user linked list (may be NULL).
+ * @param skip Username whose in-memory record must be kept (NULL for none).
+ * @return Pointer to the head of the updated list.
+ */
+user* refreshUsers(user *userptr, const char *skip);
+
+/**
+ * @brief Logs a change to the user list, then brings "users.txt" up to date.
+ *
+ * Changes made by other processes are applied first, so none of them are
+ * overwritten. Byte 0 of LOCK_FILE is held only while the change is appended to
+ * LOG_FILE; the store is rewritten afterwards by materializeStore().
+ * @param userptr Pointer to the head of the user linked list.
+ * @param changed Username whose in-memory record carries the change being saved (NULL for none).
+ * @param operation Log operation name ("ADD", "BOOK", "CANCEL", "PASSWD"); ignored if changed is NULL.
+ * @param notice Notification for the user, logged in the same write as the change (NULL for none).
+ * @param amount Amount charged (positive) or refunded (negative) by the change, in rupees (0 for none).
+ * @return Pointer to the head of the updated list.
+ */
+user* persistUsers(user *userptr, const char *changed, const char *operation, const char *notice, float amount);
+
+/**
+ * @brief Rewrites "users.txt" from the user list and the log entries after it.
+ *
+ * The store is a view of LOG_FILE, so changes to different users do not queue
+ * behind each other's rewrite: whoever holds STORE_LOCK writes it, and looks
+ * again after releasing the lock for entries appended in the meantime. A caller
+ * that finds the lock held leaves its entries to the holder.
+ * @param userptr Pointer to the head of the user linked list.
+ * @return Pointer to the head of the updated list.
+ */
+user* materializeStore(user *userptr);
+
+/**
+ * @brief Applies log entries written by other processes since the last call.
+ * @param userptr Receives the head of the updated list.
+ * @param skip Username whose in-memory record must be kept (NULL for none).
+ * @return Number of entries applied, or -1 if the log was replaced and must be re-read.
+ */
+int applyLogTail(user **userptr, const char *skip);
+
+/**
+ * @brief Applies one log entry line to the list.
+ * @param line Entry as written by appendLog(), without its newline; modified in place.
+ * @param userptr Receives the head of the updated list.
+ * @param skip Username whose in-memory record must be kept (NULL for none).
+ * @param seq Receives the entry's sequence number.
+ * @param timestamp Receives the time the entry was written.
+ * @return 1 if the entry was applied, 0 if it was skipped or malformed.
+ */
+int applyLogEntry(char *line, user **userptr, const char *skip, unsigned long *seq, long long *timestamp);
+
+/**
+ * @brief Appends the current state of a record to LOG_FILE.
+ *
+ * Must be called with the store lock held, after applyLogTail(), so sequence
+ * numbers stay unique across processes. A notification is written as a NOTIFY
+ * entry, and a charge or refund as a CHARGE or REFUND entry, in the same write,
+ * so they exist exactly when the change does.
+ * @param operation Operation name.
+ * @param record Record whose state is logged.
+ * @param notice Notification for the user (NULL for none).
+ * @param amount Amount charged (positive) or refunded (negative), in rupees (0 for none).
+ */
+void appendLog(const char *operation, user *record, const char *notice, float amount);
+
+/**
+ * @brief Starts the background thread delivering logged notifications.
+ */
+void startOutbox(void);
+
+/**
+ * @brief Stops the dispatcher after it has delivered everything logged so far.
+ */
+void stopOutbox(void);
+
+/**
+ * @brief Delivers notifications while this process holds OUTBOX_LOCK (thread entry point).
+ *
+ * Only one process dispatches at a time; the others keep trying in case it exits.
+ * @param argument Unused.
+ * @return NULL.
+ */
+void* dispatchOutbox(void *argument);
+
+/**
+ * @brief Delivers the next batch of notifications found after the cursor.
+ * @param cursor Dispatcher position; advanced and saved once the batch is on disk.
+ * @return Number of log bytes scanned (0 when caught up).
+ */
+long long deliverOutbox(outboxCursor *cursor);
+
+/**
+ * @brief Positions the log reader at the end of the current LOG_FILE.
+ */
+void openLogTail(void);
+
+/**
+ * @brief Merges a stored record into the list.
+ * @param userptr Pointer to the head of the user linked list (may be NULL).
+ * @param stored Record read from the store or the log.
+ * @return Pointer to the head of the updated list.
+ */
+user* mergeUser(user *userptr, user *stored);
+
+/**
+ * @brief Unlinks and frees the record of a user.
+ * @param userptr Pointer to the head of the user linked list.
+ * @param username User to remove.
+ * @return Pointer to the head of the updated list.
+ */
+user* removeUser(user *userptr, const char *username);
+
+/**
+ * @brief Starts watching the store directory with inotify.
+ */
+void startWatching(void);
+
+/**
+ * @brief Waits for keyboard input, applying store changes as they are announced.
+ * @param userptr Pointer to the head of the user linked list.
+ * @return Pointer to the head of the updated list.
+ */
+user* waitForInput(user *userptr);
+
+/**
+ * @brief Starts listening for followers on REPLICATION_SOCKET.
+ *
+ * Only one instance per directory ships its log; if another is already
+ * listening this one does not.
+ */
+void startReplication(void);
+
+/**
+ * @brief Attaches a follower: sends it a snapshot, then streams the log after it.
+ * @param userptr Pointer to the head of the user linked list.
+ * @return Pointer to the head of the list, brought up to date for the snapshot.
+ */
+user* acceptFollower(user *userptr);
+
+/**
+ * @brief Sends every follower the log entries it has not received yet.
+ */
+void shipLog(void);
+
+/**
+ * @brief Sends a whole buffer to a follower, giving up on a stalled one.
+ * @param fd Follower socket.
+ * @param data Bytes to send.
+ * @param length Number of bytes.
+ * @return 0 on success, -1 if the follower should be dropped.
+ */
+int sendAll(int fd, const char *data, size_t length);
+
+/**
+ * @brief Connects a follower to the instance shipping the log.
+ * @return 0 on success, -1 if no leader is reachable.
+ */
+int connectLeader(void);
+
+/**
+ * @brief Applies whatever the leader has sent since the last call.
+ * @param userptr Pointer to the head of the user linked list.
+ * @return Pointer to the head of the updated list.
+ */
+user* receiveLog(user *userptr);
+
+/**
+ * @brief Prints the replication lag of this follower.
+ * @param out Stream receiving the report.
+ */
+void replicationStatus(FILE *out);
+
+/**
+ * @brief Runs the process as a read-only follower serving login and ticket checks.
+ * @return Process exit status.
+ */
+int runFollower(void);
+
+/**
+ * @brief Installs the SIGINT/SIGTERM handlers requesting a graceful shutdown.
+ */
+void installSignalHandlers(void);
+
+/**
+ * @brief Starts sampling the stacks of every thread on CPU time (SIGPROF).
+ *
+ * Samples go to a ring of the last PROFILE_SAMPLES stacks. SIGUSR2 dumps them to
+ * PROFILE_FILE as folded stacks (one "outer;...;inner count" line per distinct
+ * stack, ready for flamegraph.pl), and so does the end of the process.
+ * @param hertz Samples per second of CPU time, at most PROFILE_MAX_HERTZ; 0 or less
+ *        leaves the profiler off. A rate that is out of range is reported.
+ */
+void startProfiler(int hertz);
+
+/**
+ * @brief Records the interrupted stack into the ring (SIGPROF handler).
+ * @param signum The signal received.
+ */
+void sampleProfile(int signum);
+
+/**
+ * @brief Asks the dump thread for a dump (SIGUSR2 handler).
+ * @param signum The signal received.
+ */
+void requestProfileDump(int signum);
+
+/**
+ * @brief Writes dumps when asked until shutdown (thread entry point).
+ * @param argument Unused.
+ * @return NULL.
+ */
+void* dumpProfileOnRequest(void *argument);
+
+/**
+ * @brief Writes the samples in the ring to PROFILE_FILE as folded stacks.
+ * @return Number of samples written, or -1 if the file could not be written.
+ */
+long dumpProfile(void);
+
+/**
+ * @brief Dumps the samples when the process exits (atexit() handler).
+ */
+void dumpProfileAtExit(void);
+
+/**
+ * @brief Orders addresses (qsort comparator).
+ * @param a First address pointer.
+ * @param b Second address pointer.
+ * @return Negative, zero or positive as a is below, at or above b.
+ */
+int compareAddresses(const void *a, const void *b);
+
+/**
+ * @brief Runs a booking-engine shard serving line requests on its socket.
+ *
+ * Requests are tab-separated lines: ADD, LOGIN, BOOK, CANCEL, CHECK and PASSWD
+ * followed by a username and their arguments, plus DUMP, PUT and DROP used by the
+ * router to move accounts. Every reply ends with a line holding a single ".".
+ * @param name Shard name; the shard works in directory "shard-<name>".
+ * @return Process exit status.
+ */
+int runShard(const char *name);
+
+/**
+ * @brief Executes one request on a shard's store.
+ * @param line Tab-separated request; modified in place.
+ * @param out Stream receiving the reply.
+ * @param context Pointer to the shard's list head.
+ */
+void serveShardRequest(char *line, FILE *out, void *context);
+
+/**
+ * @brief Runs a router distributing accounts over shards by consistent hashing.
+ *
+ * Requests use the shard protocol and are forwarded to the shard owning their
+ * username. ADDSHARD attaches a new shard and moves to it only the accounts it now
+ * owns; SHARDS lists the shards.
+ * @param names Names of the initial shards.
+ * @param count Number of names.
+ * @return Process exit status.
+ */
+int runRouter(char **names, int count);
+
+/**
+ * @brief Executes or forwards one request received by the router.
+ * @param line Tab-separated request; modified in place.
+ * @param out Stream receiving the reply.
+ * @param context Unused.
+ */
+void serveRouterRequest(char *line, FILE *out, void *context);
+
+/**
+ * @brief Serves line requests on a listening socket until shutdown is requested.
+ *
+ * Once shutdown is requested no connection is accepted, but requests already
+ * sent on open connections are still answered until every connection has been
+ * quiet for DRAIN_IDLE_MS, or for at most DRAIN_TIMEOUT_MS.
+ * @param fd Listening socket.
+ * @param handle Executes one request, writing its reply.
+ * @param context Passed to handle.
+ */
+void serveRequests(int fd, void (*handle)(char *line, FILE *out, void *context), void *context);
+
+/**
+ * @brief Reads what a client has sent and answers every complete request in it.
+ *
+ * The connection is closed, and its slot freed, when the client hangs up or a
+ * reply cannot be sent.
+ * @param c Client with data to read.
+ * @param handle Executes one request, writing its reply.
+ * @param context Passed to handle.
+ */
+void serveClient(client *c, void (*handle)(char *line, FILE *out, void *context), void *context);
+
+/**
+ * @brief Creates a listening local socket.
+ * @param path Socket path; a stale socket file is replaced.
+ * @return Listening descriptor, or -1 on failure.
+ */
+int listenLocal(const char *path);
+
+/**
+ * @brief Connects to a local socket.
+ * @param path Socket path.
+ * @return Connected descriptor, or -1 on failure.
+ */
+int connectLocal(const char *path);
+
+/**
+ * @brief Sends a request and copies its reply (without the final ".") to a stream.
+ * @param fd Connection to a shard engine or router.
+ * @param request Request line without its newline.
+ * @param out Stream receiving the reply.
+ * @return 0 on success, -1 if the connection failed.
+ */
+int exchangeRequest(int fd, const char *request, FILE *out);
+
+/**
+ * @brief Splits a request line on tabs.
+ * @param line Line to split; modified in place.
+ * @param fields Receives pointers to the fields.
+ * @param max Capacity of fields.
+ * @return Number of fields found.
+ */
+int splitFields(char *line, char **fields, int max);
+
+/**
+ * @brief Adds a shard's virtual nodes to the consistent-hash ring.
+ * @param index Index of the shard in shards.
+ */
+void addToRing(int index);
+
+/**
+ * @brief Places a key on the consistent-hash ring.
+ *
+ * FNV-1a alone leaves similar short keys ("u1", "u2") close together, so its
+ * result is mixed further to spread them around the ring.
+ * @param key Shard label or username.
+ * @return Position on the ring.
+ */
+unsigned int ringHash(const char *key);
+
+/**
+ * @brief Finds the shard owning a username.
+ * @param username Username to place.
+ * @return Index of the owning shard, or -1 if there are no shards.
+ */
+int ownerOf(const char *username);
+
+/**
+ * @brief Connects the router to a shard, reconnecting if the link was lost.
+ * @param index Index of the shard in shards.
+ * @return Connected descriptor, or -1 if the shard is unreachable.
+ */
+int shardConnection(int index);
+
+/**
+ * @brief Attaches a new shard and moves the accounts it now owns onto it.
+ *
+ * The accounts are copied first. Only when every copy succeeded is the new ring
+ * saved to ROUTER_SHARDS; otherwise the copies are dropped and the shard is not
+ * attached. The originals are dropped last, and drops that fail are recorded in
+ * ROUTER_PENDING to be retried.
+ * @param name Shard name.
+ * @param out Stream receiving the report.
+ */
+void addShard(const char *name, FILE *out);
+
+/**
+ * @brief Sends a PUT or DROP to a shard and checks that it succeeded.
+ * @param index Index of the shard in shards.
+ * @param request Request line without its newline.
+ * @return 0 if the shard carried it out, -1 otherwise.
+ */
+int shardRequest(int index, const char *request);
+
+/**
+ * @brief Rebuilds the consistent-hash ring from shards.
+ */
+void rebuildRing(void);
+
+/**
+ * @brief Saves the names of the attached shards to ROUTER_SHARDS.
+ * @return 0 on success, -1 on failure.
+ */
+int saveShards(void);
+
+/**
+ * @brief Attaches the shards listed in ROUTER_SHARDS.
+ * @return 0 if the file was read, -1 if there is none.
+ */
+int loadShards(void);
+
+/**
+ * @brief Records in ROUTER_PENDING that a moved account's old copy is still to be dropped.
+ * @param shardName Shard holding the old copy.
+ * @param username Account moved.
+ */
+void recordPendingDrop(const char *shardName, const char *username);
+
+/**
+ * @brief Retries the drops recorded in ROUTER_PENDING.
+ * @return Drops still pending, or -1 if the file could not be rewritten.
+ */
+int retryPendingDrops(void);
+
+/**
+ * @brief Sends request lines from standard input to a socket and prints the replies.
+ * @param path Socket of a shard engine or router.
+ * @return Process exit status.
+ */
+int runClient(const char *path);
+
+/**
+ * @brief Locks the byte of LOCK_FILE guarding one user record.
+ *
+ * Held across the read-validate-write of a single record so processes serialize
+ * per record rather than per store. fcntl() locks are per process, so sessions
+ * within one process rely on version stamps instead.
+ * @param username User whose record is locked.
+ */
+void lockRecord(const char *username);
+
+/**
+ * @brief Releases the lock taken by lockRecord().
+ * @param username User whose record is unlocked.
+ */
+void unlockRecord(const char *username);
+
+/**
+ * @brief Opens LOCK_FILE unless it is already open.
+ * @return 0 on success, -1 if the lock file is unusable.
+ */
+int openLockFile(void);
+
+/**
+ * @brief Locks one byte of LOCK_FILE if no other process holds it.
+ * @param offset Byte to lock.
+ * @return 0 if the lock was taken, -1 if it is held elsewhere or unusable.
+ */
+int tryLockByte(long offset);
+
+/**
+ * @brief Locks or unlocks one byte of LOCK_FILE, waiting for conflicting holders.
+ * @param offset Byte to lock (0 guards the store file, others guard records).
+ * @param type F_WRLCK to lock, F_UNLCK to release.
+ * @return 0 on success, -1 if the lock file is unusable.
+ */
+int lockByte(long offset, short type);
+
+/**
+ * @brief Locks or unlocks a run of bytes of LOCK_FILE, waiting for conflicting holders.
+ * @param offset First byte of the run.
+ * @param length Number of bytes.
+ * @param type F_WRLCK to lock, F_UNLCK to release.
+ * @return 0 on success, -1 if the lock file is unusable.
+ */
+int lockBytes(long offset, long length, short type);
+
+/**
+ * @brief Records the identity of the store file that was just read or written.
+ * @param info Status of "users.txt".
+ */
+void stampStore(const struct stat *info);
+
+/**
+ * @brief Checks whether "users.txt" differs from the last version seen.
+ * @return 1 if another process has written it, 0 otherwise.
+ */
+int storeChanged(void);
+
+/**
+ * @brief Copies the stored fields of a record read from disk (see refreshUsers()).
+ * @param copy Record copy to change.
+ * @param context The parsed record.
+ * @return Always 1.
+ */
+int applyStoredRecord(user *copy, void *context);
+
+/**
+ * @brief Exits the application after displaying project developer details.
+ *
+ * Displays project and developer details, pauses, and stops the main loop from
+ * accepting further requests so main() can shut down gracefully.
+ */
+void exitProgram(void);
+
+/**
+ * @brief Shuts the system down gracefully.
+ *
+ * Stops accepting work, flushes and syncs the store, writes the restart checkpoint,
+ * frees the user list and reports how long each phase took. The drain is only
+ * reported when serveRequests() drained connections before the call.
+ * @param userptr Pointer to the head of the user linked list.
+ */
+void shutdownProgram(user *userptr);
+
+/**
+ * @brief Signal handler requesting a graceful shutdown.
+ * @param signum The signal received (SIGINT or SIGTERM).
+ */
+void requestShutdown(int signum);
+
+/**
+ * @brief Forces "users.txt" and its directory entry to stable storage.
+ * @return 0 on success, -1 on failure.
+ */
+int syncStore(void);
+
+/**
+ * @brief Writes a binary checkpoint of the user list.
+ * @param userptr Pointer to the head of the user linked list.
+ * @param path Checkpoint file ("users.chk" for restarts, or a history snapshot).
+ * @return 0 on success, -1 on failure.
+ */
+int writeCheckpoint(user *userptr, const char *path);
+
+/**
+ * @brief Loads the user list from "users.chk" if it is still usable.
+ *
+ * With a log, the checkpoint must have been derived from that log; logOffset and
+ * logSeq are then set to the position it covers. Without one, it must still match
+ * "users.txt".
+ * @param userptr Receives the head of the loaded list.
+ * @param log Status of LOG_FILE, or NULL if there is no log.
+ * @return 1 if the checkpoint was used, 0 otherwise.
+ */
+int loadCheckpoint(user **userptr, const struct stat *log);
+
+/**
+ * @brief Reads the records following a checkpoint header.
+ * @param fp Checkpoint file positioned after its header.
+ * @param header Header already read from fp.
+ * @param userptr Receives the head of the loaded list.
+ * @return 1 on success, 0 if the records are missing or corrupt.
+ */
+int readCheckpointRecords(FILE *fp, const checkpointHeader *header, user **userptr);
+
+/**
+ * @brief Computes the FNV-1a hash of a buffer.
+ * @param data Bytes to hash.
+ * @param length Number of bytes.
+ * @return The 32-bit hash.
+ */
+unsigned int checksum(const void *data, size_t length);
+
+/**
+ * @brief Reads a monotonic clock.
+ * @return Milliseconds since an arbitrary fixed point.
+ */
+double monotonicMs(void);
+
+/**
+ * @brief Closes a session that can no longer receive input.
+ * @param s Session to close.
+ */
+void sessionAbort(session *s);
+
+/**
+ * @brief Displays developer/project information.
+ *
+ * Prints project title and developer names before clearing the screen after a delay.
+ */
+void developers(void);
+
+/**
+ * @brief Introduces a delay in the program execution.
+ *
+ * Uses clock cycles to implement a sleep-like functionality.
+ * @param t The delay time in seconds.
+ */
+void delay(float t);
+
+/**
+ * @brief Runs the built-in checks of the store formats and the tools working on them.
+ *
+ * Each check runs in a child process of its own, in a fresh directory under
+ * TMPDIR (or /tmp), on data it generates, so nothing in the current store is
+ * touched. The directory is removed when every check passed and kept otherwise.
+ * @return Process exit status: 0 if every check passed, 1 otherwise.
+ */
+int runSelfTest(void);
+
+/**
+ * @brief Describes why a check failed on selfTestReport.
+ * @param what What was checked.
+ * @param detail What was found instead.
+ * @return 1, the exit status of a failed check.
+ */
+int checkFailed(const char *what, const char *detail);
+
+/**
+ * @brief Checks CRC32C against its standard check value, both routines against
+ *        each other, and that sealed records and log entries reject a changed byte.
+ * @return 0 if the check passed.
+ */
+int checkChecksums(void);
+
+/**
+ * @brief Checks that replaying a large log in parallel gives the state that
+ *        applying its entries one by one does, and the state that was logged.
+ * @return 0 if the check passed.
+ */
+int checkReplay(void);
+
+/**
+ * @brief Checks bit packing and integer encodings round trip, that a columnar
+ *        export decodes to the bytes of the CSV and JSON Lines exports, and that
+ *        a damaged columnar file is refused.
+ * @return 0 if the check passed.
+ */
+int checkColumnar(void);
+
+/**
+ * @brief Checks that an import keeps quoted fields, skips repeated, existing and
+ *        invalid rows, and that both export formats give back what was imported.
+ * @return 0 if the check passed.
+ */
+int checkImportExport(void);
+
+/**
+ * @brief Checks that a migration seals every line, repairs destinations, leaves
+ *        the store alone on a dry run or an unreadable line, and can run twice.
+ * @return 0 if the check passed.
+ */
+int checkMigration(void);
+
+/**
+ * @brief Writes a whole file, replacing it.
+ * @param path File to write.
+ * @param text Contents.
+ * @return 0 on success, -1 on failure.
+ */
+int writeTextFile(const char *path, const char *text);
+
+/**
+ * @brief Reads a whole file into a NUL-terminated buffer.
+ * @param path File to read.
+ * @param length Receives the number of bytes read (may be NULL).
+ * @return The contents, to be freed by the caller, or NULL if the file cannot be read.
+ */
+char* readTextFile(const char *path, size_t *length);
+
+/**
+ * @brief Tells whether two files hold the same bytes.
+ * @param first One file.
+ * @param second The other.
+ * @return 1 if both can be read and are identical, 0 otherwise.
+ */
+int sameFiles(const char *first, const char *second);
+
+/**
+ * @brief Removes one entry of a scratch directory (an nftw() visitor, run depth first).
+ * @param path Entry to remove.
+ * @param info Unused.
+ * @param flag Unused.
+ * @param walk Unused.
+ * @return 0 to go on.
+ */
+int removeScratch(const char *path, const struct stat *info, int flag, struct FTW *walk);
+
+/** 
+ * @brief Global variable to store the currently logged-in username.
+ */
+char currentUser[100];
+
+int main(int argc, char *argv[]) {
+    /* A memory budget and the sampling profiler apply to whichever mode follows them. */
+    while (argc > 2) {
+        if (!strcmp(argv[1], "--memory"))
+            memoryBudget = parseSize(argv[2]);
+        else if (!strcmp(argv[1], "--profile"))
+            startProfiler(atoi(argv[2]));
+        else
+            break;
+        argc -= 2;
+        argv += 2;
+    }
+    
+    /* A follower serves read-only requests from a replicated copy of the store. */
+    if (argc > 1 && !strcmp(argv[1], "--follow"))
+        return runFollower();
+    if (argc > 2 && !strcmp(argv[1], "--history"))
+        return showHistory(argv[2]);
+    if (argc > 2 && !strcmp(argv[1], "--as-of"))
+        return showAsOf(argv[2]);
+    if (argc > 1 && !strcmp(argv[1], "--audit"))
+        return showAudit(argc > 2 ? argv[2] : NULL);
+    if (argc > 1 && !strcmp(argv[1], "--ledger"))
+        return showLedger(argc - 2, argv + 2);
+    if (argc > 1 && !strcmp(argv[1], "--refunds"))
+        return processRefunds();
+    if (argc > 2 && !strcmp(argv[1], "--backup"))
+        return runBackup(argv[2]);
+    if (argc > 1 && !strcmp(argv[1], "--verify"))
+        return verifyStore();
+    if (argc > 2 && !strcmp(argv[1], "--restore"))
+        return restoreBackup(argv[2]);
+    if (argc > 2 && !strcmp(argv[1], "--import"))
+        return importUsers(argv[2]);
+    if (argc > 2 && !strcmp(argv[1], "--export"))
+        return exportUsers(argv[2], argc > 3 ? argv[3] : NULL);
+    if (argc > 2 && !strcmp(argv[1], "--decode"))
+        return decodeExport(argv[2], STDOUT_FILENO, argc > 3 ? argv[3] : NULL);
+    if (argc > 1 && !strcmp(argv[1], "--self-test"))
+        return runSelfTest();
+    if (argc > 1 && !strcmp(argv[1], "--migrate"))
+        return migrateStore(argc > 2 && !strcmp(argv[2], "--dry-run"));
+    
+    /* Sharded deployment: engines owning part of the accounts, a router, and a test client. */
+    if (argc > 2 && !strcmp(argv[1], "--shard"))
+        return runShard(argv[2]);
+    if (argc > 1 && !strcmp(argv[1], "--router"))
+        return runRouter(argv + 2, argc - 2);
+    if (argc > 2 && !strcmp(argv[1], "--connect"))
+        return runClient(argv[2]);
+    
+    /* Change console color for visibility. */
+    system("COLOR FC");
+    
+    developers();
+
+    unsigned int choice1, choice2;
+    
+    /* Interrupt blocking reads on SIGINT/SIGTERM so the main loop can shut down. */
+    installSignalHandlers();
+    
+    user *userptr = NULL;
+    /* Initialize user list from persistent storage. */
+    userptr = initializeUser(userptr);
+    
+    /* Follow changes other processes make to the store while this one runs. */
+    startWatching();
+    startReplication();
+    startOutbox();
+    
+    /* Post the charges and refunds of bookings a crashed process logged but never posted. */
+    postFromLog();
+    
+    /* Unbuffered input keeps poll() in waitForInput() truthful about pending keystrokes. */
+    setvbuf(stdin, NULL, _IONBF, 0);
+    
+    /* Main loop for menu-driven interface. */
+    while (acceptingWork && !shutdownRequested) {
+        /* Pick up changes other processes made to the shared store. */
+        userptr = refreshUsers(userptr, NULL);
+        
+        if (currentStatus == menu) {
+            system("CLS");
+
+            printf("\nWelcome to Muhammad*Muhammad*Muhammad Travels!\n");
+
+            /* Display main menu options. */
+            printf("\n1. Add User\n2. Login User\n3. Menu\n4. Exit\n");
+            
+            printf("\nEnter your selection: ");
+            fflush(stdout);
+            userptr = waitForInput(userptr);
+            if (shutdownRequested)
+                break;
+            if (scanf("%u", &choice1) != 1) {
+                /* End of input or a shutdown signal ends the session. */
+                if (feof(stdin) || shutdownRequested)
+                    break;
+                scanf("%*[^\n]");
+                choice1 = 0;
+            }
+            
+            switch(choice1) {
+                case 1:
+                    /* Add a new user account. */
+                    userptr = addUser(userptr);
+                    break;
+                case 2:
+                    /* Attempt to log in the user; the list head stays unchanged. */
+                    login(userptr);
+                    break;
+                case 3:
+                    /* Show available tours. */
+                    showMenu();
+                    break;
+                case 4:
+                    /* Display exit information then leave the main loop. */
+                    exitProgram();
+                    break;
+                default:
+                    /* Inform user of invalid entry. */
+                    printf("\nInvalid input! Please select a number from the menu.\n");
+            }
+        }
+        else if (currentStatus == loggedIn) {
+            system("CLS");
+            printf("\nWelcome %s!\n", currentUser);
+                
+            /* Display logged in user menu options. */
+            printf("\n1. Booking \n2. Check Total \n3. Cancel Booking \n4. Change Password \n5. Logout User \n6. Menu \n7. Exit \n");
+            printf("\nEnter your choice: ");
+            fflush(stdout);
+            userptr = waitForInput(userptr);
+            if (shutdownRequested)
+                break;
+            if (scanf("%u", &choice2) != 1) {
+                if (feof(stdin) || shutdownRequested)
+                    break;
+                scanf("%*[^\n]");
+                choice2 = 0;
+            }
+            
+            switch(choice2) {
+                case 1:
+                    /* Process a booking request. */
+                    booking(&userptr);
+                    system("PAUSE");
+                    system("CLS");
+                    break;
+                case 2:
+                    /* Present the total booking cost. */
+                    checkTicket(userptr);
+                    system("PAUSE");
+                    system("CLS");
+                    break;
+                case 3:
+                    /* Process booking cancellation and notify user about refund. */
+                    cancellation(&userptr);
+                    system("PAUSE");
+                    system("CLS");
+                    break;
+                case 4:
+                    /* Allow the user to change password after verifying current credentials. */
+                    changePassword(&userptr);
+                    system("PAUSE");
+                    system("CLS");
+                    break;
+                case 5:
+                    /* Log the user out and revert to main menu state. */
+                    logout();
+                    system("PAUSE");
+                    system("CLS");
+                    break;
+                case 6:
+                    /* Display the list of tour packages again. */
+                    showMenu();
+                    system("CLS");
+                    break;
+                case 7:
+                    /* End the program after a proper exit message. */
+                    exitProgram();
+                    break;
+                default:
+                    /* Invalid selection message for logged-in menu. */
+                    printf("\nInvalid choice! Please try again.\n");
+            }
+        }
+    }
+    
+    shutdownProgram(userptr);
+    return 0;
+}
+
+user* initializeUser(user *userptr) {
+    user *tempptr = NULL, *ptr, temp;
+    struct stat info;
+    char line[512];
+    FILE *fp;
+    
+    /* The state is whatever the events say: checkpoint plus the events after it. */
+    if (userptr == NULL && stat(LOG_FILE, &info) == 0 && info.st_size > 0) {
+        if (!loadCheckpoint(&tempptr, &info))
+            logOffset = 0;
+        tempptr = replayLog(tempptr, logOffset, -1);
+        if (stat("users.txt", &info) == 0)
+            stampStore(&info);
+        if (atomic_load(&checksumFailures) > 0)
+            fprintf(stderr, "Warning: %lu event(s) failed their checksum and were skipped.\n",
+                    atomic_load(&checksumFailures));
+        return tempptr;
+    }
+    
+    /* A store without a log: load it and make its records the first events. */
+    openLogTail();
+    if (userptr == NULL && loadCheckpoint(&tempptr, NULL)) {
+        recordGenesis(tempptr);
+        return tempptr;
+    }
+    
+    fp = fopen("users.txt", "r");
+    if (fp == NULL)
+        return NULL;
+    if (fstat(fileno(fp), &info) == 0)
+        stampStore(&info);
+    
+    /* Read user information from file and build linked list of users */
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (!parseUserLine(line, &temp))
+            continue;
+        
+        ptr = (user*)malloc(sizeof(user));
+        
+        ptr->username = intern(temp.username);
+        strcpy(ptr->password, temp.password);
+        ptr->place = internPlace(temp.place);
+        ptr->price = temp.price;
+        ptr->numberTicket = temp.numberTicket;
+        ptr->version = 0;
+        ptr->referenced = 0;
+        ptr->next = NULL;
+
+        if (userptr == NULL)
+            userptr = tempptr = ptr;
+        else {
+            userptr->next = ptr;
+            userptr = ptr;
+        }
+    }
+    fclose(fp);
+    if (atomic_load(&checksumFailures) > 0)
+        fprintf(stderr, "Warning: %lu record(s) failed their checksum and were skipped.\n",
+                atomic_load(&checksumFailures));
+    recordGenesis(tempptr);
+    return tempptr;
+}
+
+user* replayLog(user *base, long long offset, long long limit) {
+    replayPartition parts[REPLAY_THREADS];
+    pthread_t threads[REPLAY_THREADS];
+    int started[REPLAY_THREADS];
+    replayEntry **merged, *entry;
+    struct stat info;
+    const char *events, *last;
+    unsigned long baseCount = 0, seq;
+    size_t length, total = 0, i, k;
+    user *ptr, *next, *head = NULL;
+    char *mapped;
+    int fd, count, p;
+    
+    fd = open(LOG_FILE, O_RDONLY);
+    if (fd < 0)
+        return base;
+    if (fstat(fd, &info) != 0 || info.st_size <= offset) {
+        logInode = info.st_ino;
+        logOffset = offset;
+        close(fd);
+        return base;
+    }
+    
+    mapped = (char*)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return base;
+    
+    /* Only complete lines are events; a line still being written is left for later. */
+    events = mapped + offset;
+    length = info.st_size - offset;
+    if (limit >= offset && limit < info.st_size)
+        length = limit - offset;
+    while (length > 0 && events[length - 1] != '\n')
+        length--;
+    
+    /* Small logs are not worth the threads. */
+    count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (count > REPLAY_THREADS)
+        count = REPLAY_THREADS;
+    if (count < 1 || length < 65536)
+        count = 1;
+    
+    for (p = 0; p < count; p++) {
+        parts[p].events = events;
+        parts[p].length = length;
+        parts[p].index = p;
+        parts[p].count = count;
+        parts[p].capacity = 1024;
+        parts[p].used = 0;
+        parts[p].table = (replayEntry*)calloc(parts[p].capacity, sizeof(replayEntry));
+    }
+    
+    /* The checkpoint's records seed the partitions owning them. */
+    for (ptr = base; ptr != NULL; ptr = next) {
+        unsigned int hash = ringHash(ptr->username);
+        next = ptr->next;
+        entry = replaySlot(&parts[hash % count], ptr->username, hash, 1);
+        entry->record = ptr;
+        entry->order = baseCount++;
+    }
+    for (p = 0; p < count; p++)
+        parts[p].baseCount = baseCount;
+    
+    /* Partition 0 runs on this thread; a partition whose thread fails to start does too. */
+    for (p = 1; p < count; p++)
+        started[p] = pthread_create(&threads[p], NULL, replayPartitionEvents, &parts[p]) == 0;
+    replayPartitionEvents(&parts[0]);
+    for (p = 1; p < count; p++) {
+        if (started[p])
+            pthread_join(threads[p], NULL);
+        else
+            replayPartitionEvents(&parts[p]);
+    }
+    
+    /* Stitch the partitions back into one list, in order of first appearance. */
+    for (p = 0; p < count; p++)
+        total += parts[p].used;
+    merged = (replayEntry**)malloc((total ? total : 1) * sizeof(replayEntry*));
+    for (p = 0, k = 0; p < count; p++)
+        for (i = 0; i < parts[p].capacity; i++) {
+            entry = &parts[p].table[i];
+            if (entry->record == NULL)
+                continue;
+            if (entry->dropped)
+                free(entry->record);
+            else
+                merged[k++] = entry;
+        }
+    qsort(merged, k, sizeof(replayEntry*), compareReplayOrder);
+    for (i = k; i > 0; i--) {
+        merged[i - 1]->record->next = head;
+        merged[i - 1]->record->version = 0;
+        merged[i - 1]->record->referenced = 0;
+        head = merged[i - 1]->record;
+    }
+    free(merged);
+    for (p = 0; p < count; p++)
+        free(parts[p].table);
+    
+    /* Continue following the log from the last replayed event. */
+    logInode = info.st_ino;
+    logOffset = offset + length;
+    if (length > 0) {
+        last = events + length - 1;
+        while (last > events && last[-1] != '\n')
+            last--;
+        if (sscanf(last, "%lu", &seq) == 1 && seq > logSeq)
+            logSeq = seq;
+    }
+    munmap(mapped, info.st_size);
+    return head;
+}
+
+void* replayPartitionEvents(void *argument) {
+    replayPartition *part = (replayPartition*)argument;
+    const char *line = part->events, *end = part->events + part->length, *next, *name;
+    char buffer[512], username[100], operation[16];
+    unsigned long seq;
+    long long timestamp;
+    unsigned int hash;
+    size_t nameLength;
+    replayEntry *entry;
+    int consumed, fields;
+    user temp;
+    
+    for (; line < end; line = next + 1) {
+        next = (const char*)memchr(line, '\n', end - line);
+        
+        /* The username is the fourth word; only this partition's users are parsed. */
+        name = line;
+        for (fields = 0; fields < 3 && name < next; name++)
+            if (*name == ' ')
+                fields++;
+        nameLength = 0;
+        while (name + nameLength < next && name[nameLength] != ' ')
+            nameLength++;
+        if (fields < 3 || nameLength == 0 || nameLength >= sizeof(username))
+            continue;
+        memcpy(username, name, nameLength);
+        username[nameLength] = '\0';
+        hash = ringHash(username);
+        if ((int)(hash % part->count) != part->index)
+            continue;
+        
+        if (next - line >= (long)sizeof(buffer))
+            continue;
+        memcpy(buffer, line, next - line);
+        buffer[next - line] = '\0';
+        if (stripChecksum(buffer) < 0 || !parseLogHeader(buffer, &seq, &timestamp, operation, &consumed) ||
+            !carriesRecord(operation) || !parseUserLine(buffer + consumed, &temp))
+            continue;
+        
+        /* Events carry the record's state after the change, so the last one wins. */
+        if (!strcmp(operation, "DROP")) {
+            entry = replaySlot(part, temp.username, hash, 0);
+            if (entry != NULL)
+                entry->dropped = 1;
+            continue;
+        }
+        entry = replaySlot(part, temp.username, hash, 1);
+        if (entry->record == NULL || entry->dropped) {
+            if (entry->record == NULL)
+                entry->record = (user*)malloc(sizeof(user));
+            entry->order = part->baseCount + seq;
+            entry->dropped = 0;
+            entry->record->username = intern(temp.username);
+        }
+        strcpy(entry->record->password, temp.password);
+        entry->record->place = internPlace(temp.place);
+        entry->record->price = temp.price;
+        entry->record->numberTicket = temp.numberTicket;
+    }
+    return NULL;
+}
+
+replayEntry* replaySlot(replayPartition *part, const char *username, unsigned int hash, int create) {
+    replayEntry *old, *entry;
+    size_t i, slot, capacity;
+    
+    /* Keep the table at most half full; grow by rehashing into a table twice the size. */
+    if (create && 2 * (part->used + 1) > part->capacity) {
+        old = part->table;
+        capacity = part->capacity;
+        part->capacity *= 2;
+        part->table = (replayEntry*)calloc(part->capacity, sizeof(replayEntry));
+        for (i = 0; i < capacity; i++) {
+            if (old[i].record == NULL)
+                continue;
+            slot = (ringHash(old[i].record->username) / part->count) & (part->capacity - 1);
+            while (part->table[slot].record != NULL)
+                slot = (slot + 1) & (part->capacity - 1);
+            part->table[slot] = old[i];
+        }
+        free(old);
+    }
+    
+    slot = (hash / part->count) & (part->capacity - 1);
+    for (;;) {
+        entry = &part->table[slot];
+        if (entry->record == NULL)
+            break;
+        if (!strcmp(entry->record->username, username))
+            return entry;
+        slot = (slot + 1) & (part->capacity - 1);
+    }
+    if (!create)
+        return NULL;
+    
+    /* The caller fills in the record. */
+    part->used++;
+    return entry;
+}
+
+int compareReplayOrder(const void *a, const void *b) {
+    unsigned long left = (*(replayEntry* const*)a)->order, right = (*(replayEntry* const*)b)->order;
+    return left < right ? -1 : left > right;
+}
+
+void recordGenesis(user *userptr) {
+    unsigned long before = logSeq;
+    user *ptr;
+    
+    if (userptr == NULL)
+        return;
+    
+    lockByte(0, F_WRLCK);
+    for (ptr = userptr; ptr != NULL; ptr = ptr->next)
+        appendLog("IMPORT", ptr, NULL, 0);
+    snapshotHistory(userptr, before);
+    lockByte(0, F_UNLCK);
+}
+
+void indexLog(int snapshot) {
+    timeIndexEntry entry;
+    int fd;
+    
+    memset(&entry, 0, sizeof(entry));
+    entry.timestamp = (long long)time(NULL);
+    entry.offset = logOffset;
+    entry.logInode = logInode;
+    entry.seq = logSeq;
+    entry.snapshot = snapshot;
+    
+    fd = open(TIME_INDEX_FILE, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0)
+        return;
+    if (write(fd, &entry, sizeof(entry)) != (ssize_t)sizeof(entry))
+        printf("\nWarning: time index could not be updated.\n");
+    close(fd);
+}
+
+void snapshotHistory(user *userptr, unsigned long before) {
+    char path[64];
+    
+    if (logSeq / SNAPSHOT_INTERVAL == before / SNAPSHOT_INTERVAL)
+        return;
+    
+    mkdir(HISTORY_DIR, 0755);
+    snprintf(path, sizeof(path), "%s/%lu.chk", HISTORY_DIR, logSeq);
+    if (writeCheckpoint(userptr, path) == 0)
+        indexLog(1);
+}
+
+int showAsOf(const char *moment) {
+    timeIndexEntry *index = NULL;
+    checkpointHeader header;
+    struct stat info, log;
+    struct tm when;
+    time_t target;
+    long long start = 0, scan = 0, limit = -1, timestamp;
+    size_t count = 0, kept = 0, low, high, mid, i;
+    char path[64], line[512], label[32];
+    user *head = NULL, *ptr, *next;
+    unsigned long seq;
+    int fd, found = 0, outstanding = 0;
+    float total = 0;
+    const char *rest;
+    FILE *fp;
+    
+    memset(&when, 0, sizeof(when));
+    rest = strptime(moment, "%Y-%m-%d %H:%M:%S", &when);
+    if (rest == NULL || *rest != '\0') {
+        memset(&when, 0, sizeof(when));
+        rest = strptime(moment, "%Y-%m-%d %H:%M", &when);
+    }
+    if (rest == NULL || *rest != '\0') {
+        memset(&when, 0, sizeof(when));
+        rest = strptime(moment, "%Y-%m-%d", &when);
+    }
+    if (rest == NULL || *rest != '\0') {
+        printf("\nUnrecognized moment \"%s\"; use YYYY-MM-DD [HH:MM[:SS]].\n", moment);
+        return 1;
+    }
+    when.tm_isdst = -1;
+    target = mktime(&when);
+    
+    if (stat(LOG_FILE, &log) != 0) {
+        printf("\nNo history has been recorded yet.\n");
+        return 0;
+    }
+    
+    /* Load the index entries that refer to the current log. */
+    fd = open(TIME_INDEX_FILE, O_RDONLY);
+    if (fd >= 0 && fstat(fd, &info) == 0 && info.st_size >= (off_t)sizeof(timeIndexEntry)) {
+        count = info.st_size / sizeof(timeIndexEntry);
+        index = (timeIndexEntry*)malloc(count * sizeof(timeIndexEntry));
+        if (index == NULL || read(fd, index, count * sizeof(timeIndexEntry)) != (ssize_t)(count * sizeof(timeIndexEntry)))
+            count = 0;
+        for (i = 0; i < count; i++)
+            if (index[i].logInode == (unsigned long long)log.st_ino && index[i].offset <= log.st_size)
+                index[kept++] = index[i];
+    }
+    if (fd >= 0)
+        close(fd);
+    
+    /* Binary search for the first entry after the moment; everything before it is in range. */
+    low = 0;
+    high = kept;
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (index[mid].timestamp <= (long long)target)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low < kept)
+        limit = index[low].offset;
+    if (low > 0)
+        scan = index[low - 1].offset;
+    
+    /* Start from the last snapshot taken before the moment. */
+    for (i = low; i > 0 && !found; i--) {
+        if (!index[i - 1].snapshot)
+            continue;
+        snprintf(path, sizeof(path), "%s/%lu.chk", HISTORY_DIR, index[i - 1].seq);
+        fp = fopen(path, "rb");
+        if (fp == NULL)
+            continue;
+        if (fread(&header, sizeof(header), 1, fp) == 1 &&
+            !memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) &&
+            header.logInode == (unsigned long long)log.st_ino &&
+            readCheckpointRecords(fp, &header, &head)) {
+            start = header.logOffset;
+            found = 1;
+        }
+        fclose(fp);
+    }
+    free(index);
+    if (scan < start)
+        scan = start;
+    
+    /* Only the events between the last index entry and the next one need their times read. */
+    fp = fopen(LOG_FILE, "r");
+    if (fp != NULL) {
+        fseek(fp, scan, SEEK_SET);
+        while ((limit < 0 || scan < limit) && fgets(line, sizeof(line), fp) != NULL) {
+            if (strchr(line, '\n') == NULL ||
+                (sscanf(line, "%lu %lld", &seq, &timestamp) == 2 && timestamp > (long long)target))
+                break;
+            scan += strlen(line);
+        }
+        fclose(fp);
+    }
+    head = replayLog(head, start, scan);
+    
+    strftime(label, sizeof(label), "%Y-%m-%d %H:%M:%S", localtime(&target));
+    printf("\nBookings outstanding as of %s:\n\n", label);
+    for (ptr = head; ptr != NULL; ptr = next) {
+        next = ptr->next;
+        if (ptr->numberTicket > 0) {
+            printf("%-20s %-25s %3d ticket(s)  Rs %.0f\n", ptr->username, ptr->place,
+                   ptr->numberTicket, ptr->price * ptr->numberTicket);
+            total += ptr->price * ptr->numberTicket;
+            outstanding++;
+        }
+        free(ptr);
+    }
+    printf("\n%d booking(s), Rs %.0f in total.\n", outstanding, total);
+    return 0;
+}
+
+int showHistory(const char *username) {
+    char line[512], operation[16], when[32];
+    unsigned long seq;
+    long long timestamp;
+    time_t moment;
+    int consumed, found = 0;
+    user temp;
+    FILE *fp;
+    
+    fp = fopen(LOG_FILE, "r");
+    if (fp == NULL) {
+        printf("\nNo history has been recorded yet.\n");
+        return 0;
+    }
+    
+    printf("\nHistory of %s:\n\n", username);
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (stripChecksum(line) < 0 || !parseLogHeader(line, &seq, &timestamp, operation, &consumed) ||
+            !carriesRecord(operation) || !parseUserLine(line + consumed, &temp) ||
+            strcmp(temp.username, username))
+            continue;
+        
+        moment = (time_t)timestamp;
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&moment));
+        if (temp.numberTicket > 0)
+            printf("%s  #%-6lu %-7s %s, %d ticket(s) at Rs %.0f\n", when, seq, operation,
+                   temp.place, temp.numberTicket, temp.price);
+        else
+            printf("%s  #%-6lu %-7s no booking\n", when, seq, operation);
+        found++;
+    }
+    fclose(fp);
+    
+    if (found == 0)
+        printf("No events recorded.\n");
+    return 0;
+}
+
+int parseLogHeader(const char *line, unsigned long *seq, long long *timestamp, char *operation, int *consumed) {
+    const char *p = line;
+    int length = 0;
+    
+    if (*p < '0' || *p > '9')
+        return 0;
+    for (*seq = 0; *p >= '0' && *p <= '9'; p++)
+        *seq = *seq * 10 + (*p - '0');
+    if (*p++ != ' ' || *p < '0' || *p > '9')
+        return 0;
+    for (*timestamp = 0; *p >= '0' && *p <= '9'; p++)
+        *timestamp = *timestamp * 10 + (*p - '0');
+    if (*p++ != ' ')
+        return 0;
+    while (*p != ' ' && *p != '\0' && *p != '\n' && length < 15)
+        operation[length++] = *p++;
+    operation[length] = '\0';
+    if (length == 0)
+        return 0;
+    while (*p == ' ')
+        p++;
+    *consumed = (int)(p - line);
+    return 1;
+}
+
+int carriesRecord(const char *operation) {
+    return strcmp(operation, "NOTIFY") && strcmp(operation, "CHARGE") && strcmp(operation, "REFUND");
+}
+
+float parsePrice(const char *text, char **end) {
+    static const double scale[] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+    const char *p = text;
+    long long whole = 0, fraction = 0;
+    int digits = 0, places = 0;
+    
+    /* Plain "digits.digits" (what the store and log contain) needs no locale-aware parsing. */
+    for (; *p >= '0' && *p <= '9' && digits < 15; p++, digits++)
+        whole = whole * 10 + (*p - '0');
+    if (*p == '.')
+        for (p++; *p >= '0' && *p <= '9' && places < 9; p++, places++)
+            fraction = fraction * 10 + (*p - '0');
+    if (digits == 0 || (*p >= '0' && *p <= '9') || *p == 'e' || *p == 'E')
+        return strtof(text, end);
+    
+    *end = (char*)p;
+    return (float)(whole + fraction / scale[places]);
+}
+
+int formatRecord(char *buffer, size_t size, const char *username, const user *copy) {
+    int length;
+    
+    length = snprintf(buffer, size - 12, "%s %s %s %f %d", username, copy->password, copy->place,
+                      copy->price, copy->numberTicket);
+    return sealLine(buffer, length, size);
+}
+
+int sealLine(char *line, int length, size_t size) {
+    return length + snprintf(line + length, size - length, " #%08x\n", crc32c(line, length));
+}
+
+int stripChecksum(char *line) {
+    size_t length = strlen(line);
+    unsigned int stored = 0;
+    size_t i;
+    
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+        length--;
+    if (length < 10 || line[length - 9] != '#' || line[length - 10] != ' ')
+        return 0;
+    
+    for (i = length - 8; i < length; i++) {
+        if (!isxdigit((unsigned char)line[i]))
+            return 0;
+        stored = stored * 16 + (isdigit((unsigned char)line[i]) ? line[i] - '0' : (line[i] | 0x20) - 'a' + 10);
+    }
+    if (crc32c(line, length - 10) != stored) {
+        atomic_fetch_add(&checksumFailures, 1);
+        return -1;
+    }
+    line[length - 10] = '\0';
+    return 1;
+}
+
+unsigned int crc32c(const void *data, size_t length) {
+    pthread_once(&crc32cChosen, chooseCrc32c);
+    return ~crc32cUpdate(~0u, (const unsigned char*)data, length);
+}
+
+void chooseCrc32c(void) {
+    unsigned int crc;
+    int i, bit;
+    
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (crc & 1 ? 0x82F63B78u : 0);
+        crc32cTable[i] = crc;
+    }
+    crc32cUpdate = crc32cSoftware;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2"))
+        crc32cUpdate = crc32cHardware;
+#endif
+}
+
+unsigned int crc32cSoftware(unsigned int crc, const unsigned char *data, size_t length) {
+    while (length-- > 0)
+        crc = (crc >> 8) ^ crc32cTable[(crc ^ *data++) & 0xFF];
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+unsigned int crc32cHardware(unsigned int crc, const unsigned char *data, size_t length) {
+    unsigned long long state = crc, word;
+    
+    for (; length >= 8; data += 8, length -= 8) {
+        memcpy(&word, data, 8);
+        state = _mm_crc32_u64(state, word);
+    }
+    crc = (unsigned int)state;
+    while (length-- > 0)
+        crc = _mm_crc32_u8(crc, *data++);
+    return crc;
+}
+#endif
+
+int parseUserLine(char *line, user *record) {
+    char *end, *field, *rest, *number, *place = NULL;
+    size_t length, placeLength = 0, candidate;
+    int i;
+    
+    if (stripChecksum(line) < 0)
+        return 0;
+    
+    /* Strip the line terminator and trailing blanks. */
+    end = line + strlen(line);
+    while (end > line && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' '))
+        *--end = '\0';
+    
+    /* Tickets and price are the last two words. */
+    field = strrchr(line, ' ');
+    if (field == NULL)
+        return 0;
+    record->numberTicket = (int)strtol(field + 1, &number, 10);
+    if (number == field + 1)
+        return 0;
+    *field = '\0';
+    field = strrchr(line, ' ');
+    if (field == NULL)
+        return 0;
+    record->price = parsePrice(field + 1, &number);
+    if (number == field + 1)
+        return 0;
+    *field = '\0';
+    
+    /* The username is the first word. */
+    rest = strchr(line, ' ');
+    if (rest == NULL || rest - line >= NAME_SIZE)
+        return 0;
+    *rest++ = '\0';
+    record->username = line;
+    
+    /* The destination is the longest known name the rest ends with. */
+    length = strlen(rest);
+    for (i = -1; i < PLACE_COUNT; i++) {
+        const char *name = (i < 0) ? "N/A" : placeList[i];
+        candidate = strlen(name);
+        if (candidate > placeLength && candidate < length && rest[length - candidate - 1] == ' ' &&
+            !strcmp(rest + length - candidate, name)) {
+            place = rest + length - candidate;
+            placeLength = candidate;
+        }
+    }
+    
+    /* An unknown destination is kept as its last word. */
+    if (place == NULL) {
+        place = strrchr(rest, ' ');
+        if (place == NULL)
+            return 0;
+        place++;
+    }
+    if (strlen(place) >= NAME_SIZE || place - rest - 1 >= (long)sizeof(record->password))
+        return 0;
+    
+    record->place = place;
+    place[-1] = '\0';
+    strcpy(record->password, rest);
+    return 1;
+}
+
+user* refreshUsers(user *userptr, const char *skip) {
+    user *head = userptr, temp;
+    struct stat info;
+    char line[512];
+    FILE *fp;
+    int followed;
+    
+    /* The log covers every change; the store only needs re-reading if the log could not be followed. */
+    followed = applyLogTail(&head, skip) >= 0 && stat(LOG_FILE, &info) == 0;
+    shipLog();
+    
+    fp = !followed && storeChanged() ? fopen("users.txt", "r") : NULL;
+    if (fp != NULL) {
+        if (fstat(fileno(fp), &info) == 0)
+            stampStore(&info);
+        
+        /* Merge each stored record into the list. */
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            if (!parseUserLine(line, &temp))
+                continue;
+            if (skip != NULL && !strcmp(temp.username, skip))
+                continue;
+            head = mergeUser(head, &temp);
+        }
+        fclose(fp);
+    }
+    
+    /* Records brought in by this or earlier requests may push memory over budget. */
+    trimUsers(head);
+    return head;
+}
+
+user* mergeUser(user *userptr, user *stored) {
+    user *ptr, *tail;
+    
+    ptr = findResident(userptr, stored->username);
+    if (ptr == NULL && packedUsers > 0 && userptr != NULL)
+        ptr = faultInUser(userptr, stored->username);
+    if (ptr != NULL) {
+        updateUser(ptr, applyStoredRecord, stored);
+        return userptr;
+    }
+    
+    /* A spilled record is changed where it lies rather than read back from disk. */
+    if (updateColdUser(stored))
+        return userptr;
+    
+    /* A user registered by another process. */
+    ptr = (user*)malloc(sizeof(user));
+    memcpy(ptr, stored, sizeof(user));
+    ptr->username = intern(stored->username);
+    ptr->place = internPlace(stored->place);
+    ptr->version = 0;
+    ptr->referenced = 0;
+    ptr->next = NULL;
+    
+    if (userptr == NULL)
+        return ptr;
+    for (tail = userptr; tail->next != NULL; tail = tail->next)
+        ;
+    tail->next = ptr;
+    return userptr;
+}
+
+user* removeUser(user *userptr, const char *username) {
+    user *ptr, *previous = NULL, packed;
+    packedBlock *block;
+    coldSlot slot;
+    int index;
+    
+    for (ptr = userptr; ptr != NULL; previous = ptr, ptr = ptr->next) {
+        if (strcmp(ptr->username, username))
+            continue;
+        if (previous == NULL)
+            userptr = ptr->next;
+        else
+            previous->next = ptr->next;
+        if (ptr == clockHand)
+            clockHand = ptr->next;
+        free(ptr);
+        break;
+    }
+    
+    /* A packed or spilled user is forgotten; an emptied list takes such a record as its head. */
+    if (ptr == NULL && (index = findPacked(username, &block, &packed)) >= 0)
+        releasePacked(block, index);
+    else if (ptr == NULL)
+        releaseColdSlot(findColdSlot(username, &slot));
+    if (userptr == NULL && (packedUsers > 0 || coldUsed > 0))
+        userptr = faultInUser(NULL, NULL);
+    return userptr;
+}
+
+user* persistUsers(user *userptr, const char *changed, const char *operation, const char *notice, float amount) {
+    user *record, removed;
+    unsigned long before;
+    
+    lockByte(0, F_WRLCK);
+    userptr = refreshUsers(userptr, changed);
+    before = logSeq;
+    if (changed != NULL) {
+        record = findUser(userptr, changed);
+        if (record != NULL)
+            appendLog(operation, record, notice, amount);
+        else {
+            /* A removed record is logged with empty booking fields. */
+            memset(&removed, 0, sizeof(removed));
+            removed.username = changed;
+            strcpy(removed.password, "-");
+            removed.place = noPlace;
+            appendLog(operation, &removed, notice, amount);
+        }
+    }
+    snapshotHistory(userptr, before);
+    lockByte(0, F_UNLCK);
+    
+    userptr = materializeStore(userptr);
+    shipLog();
+    return userptr;
+}
+
+user* materializeStore(user *userptr) {
+    struct stat info;
+    long long written;
+    
+    /* Whoever holds the lock writes the store, then looks again for entries appended meanwhile. */
+    while (tryLockByte(STORE_LOCK) == 0) {
+        userptr = refreshUsers(userptr, NULL);
+        written = logOffset;
+        filing(userptr);
+        if (stat("users.txt", &info) == 0)
+            stampStore(&info);
+        lockByte(STORE_LOCK, F_UNLCK);
+        
+        if (stat(LOG_FILE, &info) != 0 || info.st_ino != logInode || info.st_size <= written)
+            break;
+    }
+    return userptr;
+}
+
+int applyLogTail(user **userptr, const char *skip) {
+    struct stat info;
+    char *buffer, *line, *end;
+    unsigned long seq;
+    long long timestamp;
+    int applied = 0;
+    long long length;
+    FILE *fp;
+    
+    fp = fopen(LOG_FILE, "r");
+    if (fp == NULL || fstat(fileno(fp), &info) != 0) {
+        if (fp != NULL)
+            fclose(fp);
+        return 0;
+    }
+    
+    /* A replaced or truncated log cannot be followed; start again at its end. */
+    if (info.st_ino != logInode || info.st_size < logOffset) {
+        fclose(fp);
+        openLogTail();
+        return -1;
+    }
+    if (info.st_size == logOffset) {
+        fclose(fp);
+        return 0;
+    }
+    
+    length = info.st_size - logOffset;
+    buffer = (char*)malloc(length + 1);
+    fseek(fp, logOffset, SEEK_SET);
+    length = fread(buffer, 1, length, fp);
+    buffer[length] = '\0';
+    fclose(fp);
+    
+    /* Apply complete lines only; a line still being written is picked up next time. */
+    for (line = buffer; (end = strchr(line, '\n')) != NULL; line = end + 1) {
+        *end = '\0';
+        logOffset += end - line + 1;
+        
+        seq = 0;
+        applied += applyLogEntry(line, userptr, skip, &seq, &timestamp);
+        if (seq > logSeq)
+            logSeq = seq;
+    }
+    free(buffer);
+    return applied;
+}
+
+int applyLogEntry(char *line, user **userptr, const char *skip, unsigned long *seq, long long *timestamp) {
+    char operation[16];
+    int consumed;
+    user temp;
+    
+    if (stripChecksum(line) < 0 || !parseLogHeader(line, seq, timestamp, operation, &consumed) ||
+        !carriesRecord(operation) || !parseUserLine(line + consumed, &temp))
+        return 0;
+    if (skip != NULL && !strcmp(temp.username, skip))
+        return 0;
+    
+    /* Records handed to another shard leave this store. */
+    if (!strcmp(operation, "DROP"))
+        *userptr = removeUser(*userptr, temp.username);
+    else
+        *userptr = mergeUser(*userptr, &temp);
+    return 1;
+}
+
+void appendLog(const char *operation, user *record, const char *notice, float amount) {
+    struct stat info;
+    char entry[1024];
+    unsigned long before = logSeq, entries = 1;
+    long long now = (long long)time(NULL);
+    int fd, length, notified;
+    
+    length = formatLogEntry(entry, sizeof(entry), logSeq + 1, now, operation, record);
+    if (notice != NULL) {
+        notified = snprintf(entry + length, sizeof(entry) - length - 12, "%lu %lld NOTIFY %s %s", logSeq + 2, now,
+                            record->username, notice);
+        length += sealLine(entry + length, notified, sizeof(entry) - length);
+        entries = 2;
+    }
+    if (amount != 0.0f) {
+        length += formatPostingEntry(entry + length, sizeof(entry) - length, logSeq + entries + 1, now,
+                                     record->username, amount);
+        entries++;
+    }
+    
+    fd = open(LOG_FILE, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0)
+        return;
+    
+    /* One write per entry keeps concurrent appends from interleaving. */
+    if (write(fd, entry, length) == length) {
+        logSeq += entries;
+        logOffset += length;
+        
+        /* This process may just have created the log. */
+        if (fstat(fd, &info) == 0 && info.st_ino != logInode) {
+            logInode = info.st_ino;
+            logOffset = info.st_size;
+        }
+        if (logSeq / TIME_INDEX_INTERVAL != before / TIME_INDEX_INTERVAL)
+            indexLog(0);
+    }
+    close(fd);
+}
+
+int formatLogEntry(char *entry, size_t size, unsigned long seq, long long now, const char *operation, user *record) {
+    user copy;
+    int length;
+    
+    snapshotUser(record, &copy);
+    length = snprintf(entry, size - 12, "%lu %lld %s %s %s %s %f %d", seq, now, operation, record->username,
+                      copy.password, copy.place, copy.price, copy.numberTicket);
+    return sealLine(entry, length, size);
+}
+
+int formatPostingEntry(char *entry, size_t size, unsigned long seq, long long now, const char *username, float amount) {
+    int length;
+    
+    length = snprintf(entry, size - 12, "%lu %lld %s %s %lld", seq, now, amount > 0 ? "CHARGE" : "REFUND", username,
+                      (long long)((amount > 0 ? amount : -amount) * 100.0 + 0.5));
+    return sealLine(entry, length, size);
+}
+
+int appendLogBatch(const char *operation, user *first, int charge) {
+    struct stat info;
+    unsigned long before = logSeq, entries = 0;
+    long long now = (long long)time(NULL);
+    size_t length = 0, capacity = 0;
+    char *buffer = NULL;
+    user *ptr;
+    int fd, result = -1;
+    
+    for (ptr = first; ptr != NULL; ptr = ptr->next) {
+        if (capacity - length < 2048) {
+            capacity = capacity ? capacity * 2 : 65536;
+            buffer = (char*)realloc(buffer, capacity);
+        }
+        length += formatLogEntry(buffer + length, 1024, logSeq + ++entries, now, operation, ptr);
+        if (charge && ptr->numberTicket > 0)
+            length += formatPostingEntry(buffer + length, 1024, logSeq + ++entries, now, ptr->username,
+                                         ptr->price * ptr->numberTicket);
+    }
+    if (entries == 0)
+        return 0;
+    
+    fd = open(LOG_FILE, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd >= 0 && write(fd, buffer, length) == (ssize_t)length) {
+        logSeq += entries;
+        logOffset += length;
+        if (fstat(fd, &info) == 0 && info.st_ino != logInode) {
+            logInode = info.st_ino;
+            logOffset = info.st_size;
+        }
+        if (logSeq / TIME_INDEX_INTERVAL != before / TIME_INDEX_INTERVAL)
+            indexLog(0);
+        result = 0;
+    }
+    if (fd >= 0)
+        close(fd);
+    free(buffer);
+    return result;
+}
+
+void startOutbox(void) {
+    /* Open the lock file here so the dispatcher never races this thread to do it. */
+    if (openLockFile() != 0)
+        return;
+    mkdir(OUTBOX_SPOOL, 0755);
+    outboxRunning = pthread_create(&outboxDispatcher, NULL, dispatchOutbox, NULL) == 0;
+}
+
+void stopOutbox(void) {
+    if (!outboxRunning)
+        return;
+    atomic_store(&outboxStopping, 1);
+    pthread_join(outboxDispatcher, NULL);
+    outboxRunning = 0;
+}
+
+void* dispatchOutbox(void *argument) {
+    struct timespec pause = { 0, 100 * 1000000L };
+    outboxCursor cursor;
+    int holding = 0, fd;
+    
+    (void)argument;
+    while (!atomic_load(&outboxStopping)) {
+        /* Only the process holding the lock dispatches; the cursor it left is the truth. */
+        if (!holding && tryLockByte(OUTBOX_LOCK) == 0) {
+            holding = 1;
+            memset(&cursor, 0, sizeof(cursor));
+            fd = open(OUTBOX_CURSOR, O_RDONLY);
+            if (fd >= 0) {
+                if (read(fd, &cursor, sizeof(cursor)) != (ssize_t)sizeof(cursor))
+                    memset(&cursor, 0, sizeof(cursor));
+                close(fd);
+            }
+        }
+        if (!holding || deliverOutbox(&cursor) == 0)
+            nanosleep(&pause, NULL);
+    }
+    
+    /* Deliver what the last requests logged before shutting down. */
+    if (holding)
+        while (deliverOutbox(&cursor) > 0)
+            ;
+    return NULL;
+}
+
+long long deliverOutbox(outboxCursor *cursor) {
+    char *buffer, *line, *end, *notice, spool[128], temporary[136], operation[16];
+    struct stat info;
+    unsigned long seq, first = 0;
+    long long timestamp, scanned = 0, length;
+    int fd, consumed, count = 0, spooled;
+    FILE *out = NULL;
+    
+    fd = open(LOG_FILE, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return 0;
+    }
+    
+    /* A new log starts delivery from its beginning. */
+    if ((unsigned long long)info.st_ino != cursor->logInode || info.st_size < cursor->offset) {
+        cursor->logInode = info.st_ino;
+        cursor->offset = 0;
+    }
+    length = info.st_size - cursor->offset;
+    if (length > 1 << 20)
+        length = 1 << 20;
+    if (length <= 0) {
+        close(fd);
+        return 0;
+    }
+    
+    buffer = (char*)malloc(length + 1);
+    length = pread(fd, buffer, length, cursor->offset);
+    close(fd);
+    if (length <= 0) {
+        free(buffer);
+        return 0;
+    }
+    buffer[length] = '\0';
+    
+    /* Collect one batch of complete NOTIFY entries into a spool file. */
+    for (line = buffer; count < OUTBOX_BATCH && (end = strchr(line, '\n')) != NULL; line = end + 1) {
+        *end = '\0';
+        scanned += end - line + 1;
+        if (stripChecksum(line) < 0 || !parseLogHeader(line, &seq, &timestamp, operation, &consumed) ||
+            strcmp(operation, "NOTIFY"))
+            continue;
+        
+        if (out == NULL) {
+            /* Named after its first entry, so a batch redelivered after a crash replaces itself. */
+            first = seq;
+            snprintf(spool, sizeof(spool), "%s/%lu.txt", OUTBOX_SPOOL, first);
+            snprintf(temporary, sizeof(temporary), "%s.tmp", spool);
+            out = fopen(temporary, "w");
+            if (out == NULL) {
+                free(buffer);
+                return 0;
+            }
+        }
+        notice = line + consumed;
+        fprintf(out, "%lu %lld %s\n", seq, timestamp, notice);
+        count++;
+    }
+    free(buffer);
+    
+    /* The cursor only moves once the batch is durably in the spool. */
+    if (out != NULL) {
+        spooled = fflush(out) == 0 && fsync(fileno(out)) == 0;
+        if (fclose(out) != 0 || !spooled || rename(temporary, spool) != 0) {
+            fprintf(stderr, "Warning: notifications from #%lu could not be spooled.\n", first);
+            return 0;
+        }
+    }
+    if (scanned == 0)
+        return 0;
+    
+    cursor->offset += scanned;
+    fd = open(OUTBOX_CURSOR ".tmp", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write(fd, cursor, sizeof(*cursor)) != (ssize_t)sizeof(*cursor) || fsync(fd) != 0 ||
+        rename(OUTBOX_CURSOR ".tmp", OUTBOX_CURSOR) != 0)
+        fprintf(stderr, "Warning: outbox position could not be saved.\n");
+    if (fd >= 0)
+        close(fd);
+    return scanned;
+}
+
+void openLogTail(void) {
+    struct stat info;
+    char tail[1024], *last;
+    size_t length;
+    FILE *fp;
+    
+    logOffset = 0;
+    logInode = 0;
+    
+    fp = fopen(LOG_FILE, "r");
+    if (fp == NULL)
+        return;
+    if (fstat(fileno(fp), &info) == 0) {
+        logInode = info.st_ino;
+        logOffset = info.st_size;
+        
+        /* Continue numbering after the last complete entry. */
+        fseek(fp, info.st_size > (long long)sizeof(tail) - 1 ? info.st_size - (long long)sizeof(tail) + 1 : 0, SEEK_SET);
+        length = fread(tail, 1, sizeof(tail) - 1, fp);
+        tail[length] = '\0';
+        if (length > 0 && tail[length - 1] == '\n') {
+            tail[length - 1] = '\0';
+            last = strrchr(tail, '\n');
+            sscanf(last != NULL ? last + 1 : tail, "%lu", &logSeq);
+        }
+    }
+    fclose(fp);
+}
+
+void startWatching(void) {
+    watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watchFd < 0)
+        return;
+    
+    /* filing() renames users.txt into place and appendLog() modifies LOG_FILE. */
+    if (inotify_add_watch(watchFd, ".", IN_MODIFY | IN_MOVED_TO | IN_CLOSE_WRITE) < 0) {
+        close(watchFd);
+        watchFd = -1;
+    }
+}
+
+user* waitForInput(user *userptr) {
+    struct pollfd fds[3 + MAX_FOLLOWERS];
+    char events[4096];
+    struct inotify_event *event;
+    ssize_t length, offset;
+    int changed, c, count, i;
+    
+    while (!shutdownRequested) {
+        /* Keyboard, store directory, replication listener, leader link and follower hang-ups. */
+        count = 0;
+        fds[count].fd = STDIN_FILENO;
+        fds[count++].events = POLLIN;
+        fds[count].fd = followerMode ? leaderFd : watchFd;
+        fds[count++].events = POLLIN;
+        fds[count].fd = listenFd;
+        fds[count++].events = POLLIN;
+        for (i = 0; i < MAX_FOLLOWERS; i++) {
+            fds[count].fd = followers[i].fd;
+            fds[count++].events = POLLIN;
+        }
+        
+        /* A follower without a leader retries the connection every second. */
+        if (poll(fds, count, followerMode && leaderFd < 0 ? 1000 : -1) < 0) {
+            /* poll() is never restarted: a profiler tick or shutdown signal lands here, and the loop condition decides. */
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        
+        if (followerMode) {
+            if (leaderFd < 0)
+                connectLeader();
+            else if (fds[1].revents)
+                userptr = receiveLog(userptr);
+        } else if (fds[1].revents & POLLIN) {
+            changed = 0;
+            while ((length = read(watchFd, events, sizeof(events))) > 0) {
+                for (offset = 0; offset < length; offset += sizeof(struct inotify_event) + event->len) {
+                    event = (struct inotify_event*)(events + offset);
+                    if (event->len > 0 && (!strcmp(event->name, LOG_FILE) || !strcmp(event->name, "users.txt")))
+                        changed = 1;
+                }
+            }
+            if (changed)
+                userptr = refreshUsers(userptr, NULL);
+        }
+        
+        if (fds[2].revents & POLLIN)
+            userptr = acceptFollower(userptr);
+        
+        /* Followers never send anything; readable means they went away. */
+        for (i = 0; i < MAX_FOLLOWERS; i++) {
+            if (fds[3 + i].fd >= 0 && fds[3 + i].revents) {
+                close(followers[i].fd);
+                followers[i].fd = -1;
+            }
+        }
+        
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            /* Blank input does not start a command; keep watching until a real one arrives. */
+            c = getchar();
+            if (c == EOF || !isspace(c)) {
+                if (c != EOF)
+                    ungetc(c, stdin);
+                break;
+            }
+        }
+    }
+    
+    if (followerMode)
+        return userptr;
+    
+    /* Changes announced while the command was typed are applied before it runs. */
+    return refreshUsers(userptr, NULL);
+}
+
+void startReplication(void) {
+    struct sockaddr_un address;
+    int fd, i;
+    
+    for (i = 0; i < MAX_FOLLOWERS; i++)
+        followers[i].fd = -1;
+    
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, REPLICATION_SOCKET);
+    
+    /* A socket that still accepts connections belongs to a live instance. */
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return;
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0) {
+        close(fd);
+        return;
+    }
+    close(fd);
+    unlink(REPLICATION_SOCKET);
+    
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0)
+        return;
+    if (bind(listenFd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, MAX_FOLLOWERS) != 0) {
+        close(listenFd);
+        listenFd = -1;
+    }
+}
+
+user* acceptFollower(user *userptr) {
+    struct timeval timeout = { 1, 0 };
+    char line[512];
+    userCursor cursor;
+    user copy;
+    int fd, slot, length;
+    
+    fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0)
+        return userptr;
+    
+    for (slot = 0; slot < MAX_FOLLOWERS && followers[slot].fd >= 0; slot++)
+        ;
+    if (slot == MAX_FOLLOWERS) {
+        close(fd);
+        return userptr;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    
+    /* The snapshot covers the log up to logOffset; streaming resumes from there. */
+    userptr = refreshUsers(userptr, NULL);
+    if (sendAll(fd, "SNAP\n", 5) != 0) {
+        close(fd);
+        return userptr;
+    }
+    startUsers(&cursor, userptr);
+    while (nextUser(&cursor, &copy)) {
+        length = formatRecord(line, sizeof(line), copy.username, &copy);
+        if (sendAll(fd, line, length) != 0) {
+            close(fd);
+            return userptr;
+        }
+    }
+    length = snprintf(line, sizeof(line), "END %lu\n", logSeq);
+    if (sendAll(fd, line, length) != 0) {
+        close(fd);
+        return userptr;
+    }
+    
+    followers[slot].fd = fd;
+    followers[slot].offset = logOffset;
+    shipLog();
+    return userptr;
+}
+
+void shipLog(void) {
+    struct stat info;
+    char buffer[65536], head[64];
+    ssize_t length;
+    int fd, i, sent;
+    
+    fd = open(LOG_FILE, O_RDONLY);
+    if (fd < 0)
+        return;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return;
+    }
+    
+    for (i = 0; i < MAX_FOLLOWERS; i++) {
+        if (followers[i].fd < 0 || followers[i].offset >= info.st_size)
+            continue;
+        
+        /* Ship the raw log bytes, then tell the follower how far the log reaches. */
+        sent = 0;
+        while (followers[i].offset < info.st_size) {
+            length = pread(fd, buffer, sizeof(buffer), followers[i].offset);
+            if (length <= 0 || sendAll(followers[i].fd, buffer, length) != 0) {
+                sent = -1;
+                break;
+            }
+            followers[i].offset += length;
+        }
+        length = snprintf(head, sizeof(head), "HEAD %lu\n", logSeq);
+        if (sent != 0 || sendAll(followers[i].fd, head, length) != 0) {
+            close(followers[i].fd);
+            followers[i].fd = -1;
+        }
+    }
+    close(fd);
+}
+
+int sendAll(int fd, const char *data, size_t length) {
+    ssize_t sent;
+    
+    while (length > 0) {
+        sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return -1;
+        data += sent;
+        length -= sent;
+    }
+    return 0;
+}
+
+int connectLeader(void) {
+    struct sockaddr_un address;
+    
+    leaderFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (leaderFd < 0)
+        return -1;
+    
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, REPLICATION_SOCKET);
+    if (connect(leaderFd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(leaderFd);
+        leaderFd = -1;
+        return -1;
+    }
+    replica.pendingLength = 0;
+    return 0;
+}
+
+user* receiveLog(user *userptr) {
+    char *line, *end;
+    unsigned long seq;
+    long long timestamp;
+    ssize_t length;
+    user temp;
+    
+    length = read(leaderFd, replica.pending + replica.pendingLength,
+                  sizeof(replica.pending) - 1 - replica.pendingLength);
+    if (length < 0 && errno == EINTR)
+        return userptr;
+    if (length <= 0) {
+        /* The leader went away; keep serving what was replicated and reconnect later. */
+        close(leaderFd);
+        leaderFd = -1;
+        return userptr;
+    }
+    replica.pendingLength += length;
+    replica.pending[replica.pendingLength] = '\0';
+    
+    for (line = replica.pending; (end = strchr(line, '\n')) != NULL; line = end + 1) {
+        *end = '\0';
+        
+        if (!strcmp(line, "SNAP"))
+            replica.snapshotting = 1;
+        else if (!strncmp(line, "END ", 4)) {
+            replica.snapshotting = 0;
+            replica.appliedSeq = strtoul(line + 4, NULL, 10);
+            if (replica.appliedSeq > replica.leaderSeq)
+                replica.leaderSeq = replica.appliedSeq;
+        } else if (!strncmp(line, "HEAD ", 5))
+            replica.leaderSeq = strtoul(line + 5, NULL, 10);
+        else if (replica.snapshotting) {
+            if (parseUserLine(line, &temp))
+                userptr = mergeUser(userptr, &temp);
+        } else if (applyLogEntry(line, &userptr, NULL, &seq, &timestamp)) {
+            replica.appliedSeq = seq;
+            replica.appliedTime = timestamp;
+        }
+    }
+    
+    /* Keep a partial line for the next read. */
+    replica.pendingLength = strlen(line);
+    memmove(replica.pending, line, replica.pendingLength);
+    trimUsers(userptr);
+    return userptr;
+}
+
+void replicationStatus(FILE *out) {
+    unsigned long behind;
+    
+    behind = replica.leaderSeq > replica.appliedSeq ? replica.leaderSeq - replica.appliedSeq : 0;
+    fprintf(out, "\nLeader: %s\n", leaderFd >= 0 ? "connected" : "disconnected (serving last replicated state)");
+    fprintf(out, "Applied log entry: %lu of %lu\n", replica.appliedSeq, replica.leaderSeq);
+    fprintf(out, "Replication lag: %lu entr%s", behind, behind == 1 ? "y" : "ies");
+    if (replica.appliedTime > 0)
+        fprintf(out, ", last applied change written %lld s ago", (long long)time(NULL) - replica.appliedTime);
+    fprintf(out, "\n");
+}
+
+int runFollower(void) {
+    user *userptr = NULL, *next;
+    unsigned int choice;
+    
+    followerMode = 1;
+    installSignalHandlers();
+    setvbuf(stdin, NULL, _IONBF, 0);
+    for (choice = 0; choice < MAX_FOLLOWERS; choice++)
+        followers[choice].fd = -1;
+    
+    if (connectLeader() != 0)
+        printf("\nNo instance is shipping its log yet; waiting for one.\n");
+    
+    while (!shutdownRequested) {
+        printf("\nRead-only replica of Muhammad*Muhammad*Muhammad Travels\n");
+        printf("\n1. Login User\n2. Check Total\n3. Replication Status\n4. Exit\n");
+        printf("\nEnter your selection: ");
+        fflush(stdout);
+        userptr = waitForInput(userptr);
+        if (shutdownRequested)
+            break;
+        if (scanf("%u", &choice) != 1) {
+            if (feof(stdin))
+                break;
+            scanf("%*[^\n]");
+            choice = 0;
+        }
+        
+        switch (choice) {
+            case 1:
+                if (login(userptr) == NULL)
+                    currentStatus = menu;
+                break;
+            case 2:
+                if (currentStatus != loggedIn)
+                    printf("\nPlease log in first.\n");
+                else
+                    checkTicket(userptr);
+                break;
+            case 3:
+                replicationStatus(stdout);
+                break;
+            case 4:
+                shutdownRequested = 1;
+                break;
+            default:
+                printf("\nInvalid input! Please select a number from the menu.\n");
+        }
+    }
+    
+    /* A follower owns no files; it only releases its copy. */
+    if (leaderFd >= 0)
+        close(leaderFd);
+    while (userptr != NULL) {
+        next = userptr->next;
+        free(userptr);
+        userptr = next;
+    }
+    return 0;
+}
+
+void installSignalHandlers(void) {
+    struct sigaction action;
+    
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestShutdown;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+}
+
+void startProfiler(int hertz) {
+    struct sigaction action;
+    struct itimerval timer;
+    void *warm[1];
+    
+    if (profileRing != NULL)
+        return;
+    if (hertz <= 0) {
+        fprintf(stderr, "Warning: a profiling rate must be a positive number of samples per second; not profiling.\n");
+        return;
+    }
+    
+    /* A faster rate would need an interval under a microsecond, which setitimer() takes as "off". */
+    if (hertz > PROFILE_MAX_HERTZ) {
+        fprintf(stderr, "Warning: profiling at %d samples per second, the most supported, instead of %d.\n",
+                PROFILE_MAX_HERTZ, hertz);
+        hertz = PROFILE_MAX_HERTZ;
+    }
+    profileRing = (profileSample*)calloc(PROFILE_SAMPLES, sizeof(profileSample));
+    if (profileRing == NULL)
+        return;
+    
+    /* backtrace() loads the unwinder on its first call, which must not happen inside the handler. */
+    backtrace(warm, 1);
+    
+    /* Interrupted system calls resume, so sampling does not change what the program sees. */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = sampleProfile;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+    action.sa_handler = requestProfileDump;
+    sigaction(SIGUSR2, &action, NULL);
+    
+    pthread_create(&profileDumper, NULL, dumpProfileOnRequest, NULL);
+    atexit(dumpProfileAtExit);
+    
+    timer.it_interval.tv_sec = hertz > 1 ? 0 : 1;
+    timer.it_interval.tv_usec = hertz > 1 ? 1000000 / hertz : 0;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+void sampleProfile(int signum) {
+    profileSample *sample;
+    int saved = errno;
+    
+    (void)signum;
+    
+    /* Each sample claims its own slot; a reader skips slots caught mid-write. */
+    sample = &profileRing[atomic_fetch_add(&profileNext, 1) % PROFILE_SAMPLES];
+    atomic_fetch_add(&sample->sequence, 1);
+    sample->depth = backtrace(sample->frames, PROFILE_DEPTH);
+    atomic_fetch_add(&sample->sequence, 1);
+    errno = saved;
+}
+
+void requestProfileDump(int signum) {
+    (void)signum;
+    profileDumpRequested = 1;
+}
+
+void* dumpProfileOnRequest(void *argument) {
+    struct timespec pause = { 0, 200000000 };
+    long written;
+    
+    (void)argument;
+    while (!shutdownRequested) {
+        nanosleep(&pause, NULL);
+        if (!profileDumpRequested)
+            continue;
+        profileDumpRequested = 0;
+        pthread_mutex_lock(&profileLock);
+        written = dumpProfile();
+        pthread_mutex_unlock(&profileLock);
+        if (written < 0)
+            fprintf(stderr, "Warning: %s could not be written.\n", PROFILE_FILE);
+    }
+    return NULL;
+}
+
+long dumpProfile(void) {
+    unsigned long taken = atomic_load(&profileNext), count, i;
+    char **stacks, **names, *stack, temporary[64];
+    void **addresses, *frames[PROFILE_DEPTH];
+    size_t unique = 0, length, used, low, high, middle;
+    unsigned int before;
+    int depth, f, run;
+    Dl_info info;
+    FILE *fp;
+    
+    count = taken < PROFILE_SAMPLES ? taken : PROFILE_SAMPLES;
+    stacks = (char**)calloc(count ? count : 1, sizeof(char*));
+    addresses = (void**)malloc((count ? count : 1) * PROFILE_DEPTH * sizeof(void*));
+    
+    /* Copy the samples out first; a slot rewritten meanwhile is dropped. The first two
+       frames are the handler and the signal trampoline. */
+    for (i = 0; i < count; i++) {
+        before = atomic_load(&profileRing[i].sequence);
+        depth = profileRing[i].depth;
+        if (before % 2 != 0 || depth <= 2)
+            continue;
+        memcpy(frames, profileRing[i].frames, depth * sizeof(void*));
+        if (atomic_load(&profileRing[i].sequence) != before)
+            continue;
+        stacks[i] = (char*)malloc(depth * sizeof(void*) + sizeof(int));
+        memcpy(stacks[i], &depth, sizeof(int));
+        memcpy(stacks[i] + sizeof(int), frames, depth * sizeof(void*));
+        for (f = 2; f < depth; f++)
+            addresses[unique++] = frames[f];
+    }
+    
+    /* Each distinct address is resolved once: its function, or module and offset for addr2line. */
+    qsort(addresses, unique, sizeof(void*), compareAddresses);
+    for (i = 0, used = 0; i < unique; i++)
+        if (used == 0 || addresses[used - 1] != addresses[i])
+            addresses[used++] = addresses[i];
+    unique = used;
+    names = (char**)malloc((unique ? unique : 1) * sizeof(char*));
+    for (i = 0; i < unique; i++) {
+        if (!dladdr(addresses[i], &info))
+            info.dli_fname = NULL;
+        if (info.dli_fname != NULL && info.dli_sname != NULL)
+            names[i] = strdup(info.dli_sname);
+        else if (info.dli_fname != NULL && info.dli_fbase != NULL) {
+            snprintf(temporary, sizeof(temporary), "%s+0x%lx",
+                     strrchr(info.dli_fname, '/') ? strrchr(info.dli_fname, '/') + 1 : info.dli_fname,
+                     (unsigned long)((char*)addresses[i] - (char*)info.dli_fbase - 1));
+            names[i] = strdup(temporary);
+        } else {
+            snprintf(temporary, sizeof(temporary), "%p", addresses[i]);
+            names[i] = strdup(temporary);
+        }
+    }
+    
+    /* Fold each stack outermost first, then count identical stacks after sorting. */
+    for (i = 0; i < count; i++) {
+        if (stacks[i] == NULL)
+            continue;
+        memcpy(&depth, stacks[i], sizeof(int));
+        memcpy(frames, stacks[i] + sizeof(int), depth * sizeof(void*));
+        free(stacks[i]);
+        for (f = depth - 1, length = 0; f >= 2; f--) {
+            for (low = 0, high = unique; low < high;) {
+                middle = (low + high) / 2;
+                if ((char*)addresses[middle] < (char*)frames[f])
+                    low = middle + 1;
+                else
+                    high = middle;
+            }
+            frames[f] = names[low];
+            length += strlen(names[low]) + 1;
+        }
+        stack = (char*)malloc(length + 1);
+        for (f = depth - 1, used = 0; f >= 2; f--)
+            used += sprintf(stack + used, "%s%s", used ? ";" : "", (char*)frames[f]);
+        stacks[i] = stack;
+    }
+    for (i = 0, used = 0; i < count; i++)
+        if (stacks[i] != NULL)
+            stacks[used++] = stacks[i];
+    qsort(stacks, used, sizeof(char*), compareNames);
+    
+    fp = fopen(PROFILE_FILE ".tmp", "w");
+    for (i = 0; i < used; i += run) {
+        for (run = 1; i + run < used && !strcmp(stacks[i], stacks[i + run]); run++)
+            ;
+        if (fp != NULL)
+            fprintf(fp, "%s %d\n", stacks[i], run);
+    }
+    
+    for (i = 0; i < used; i++)
+        free(stacks[i]);
+    for (i = 0; i < unique; i++)
+        free(names[i]);
+    free(stacks);
+    free(names);
+    free(addresses);
+    if (fp == NULL || fclose(fp) != 0 || rename(PROFILE_FILE ".tmp", PROFILE_FILE) != 0)
+        return -1;
+    return (long)used;
+}
+
+void dumpProfileAtExit(void) {
+    struct itimerval off;
+    
+    /* No samples may land while the ring is read for the last time. */
+    memset(&off, 0, sizeof(off));
+    setitimer(ITIMER_PROF, &off, NULL);
+    pthread_mutex_lock(&profileLock);
+    dumpProfile();
+    pthread_mutex_unlock(&profileLock);
+}
+
+int compareAddresses(const void *a, const void *b) {
+    const char *left = *(char* const*)a, *right = *(char* const*)b;
+    
+    return left < right ? -1 : left > right;
+}
+
+int runShard(const char *name) {
+    char directory[128];
+    user *userptr;
+    int fd;
+    
+    /* Each shard keeps its own store, log and locks in its own directory. */
+    snprintf(directory, sizeof(directory), "shard-%s", name);
+    mkdir(directory, 0755);
+    if (chdir(directory) != 0) {
+        fprintf(stderr, "Cannot enter %s\n", directory);
+        return 1;
+    }
+    
+    installSignalHandlers();
+    userptr = initializeUser(NULL);
+    startOutbox();
+    postFromLog();
+    
+    fd = listenLocal("engine.sock");
+    if (fd < 0) {
+        fprintf(stderr, "Cannot listen on %s/engine.sock\n", directory);
+        return 1;
+    }
+    printf("Shard %s serving on %s/engine.sock\n", name, directory);
+    fflush(stdout);
+    
+    serveRequests(fd, serveShardRequest, &userptr);
+    
+    close(fd);
+    unlink("engine.sock");
+    shutdownProgram(userptr);
+    return 0;
+}
+
+void serveShardRequest(char *line, FILE *out, void *context) {
+    user **userptr = (user**)context;
+    char *fields[6], record[512], *key = NULL;
+    userCursor cursor;
+    int count;
+    session s;
+    user temp, copy;
+    
+    /* Apply changes made behind the engine's back, as the interactive menu does. */
+    *userptr = refreshUsers(*userptr, NULL);
+    
+    count = splitFields(line, fields, 6);
+    if (count == 0)
+        return;
+    
+    if (!strcmp(fields[0], "DUMP")) {
+        startUsers(&cursor, *userptr);
+        while (nextUser(&cursor, &copy))
+            fwrite(record, 1, formatRecord(record, sizeof(record), copy.username, &copy), out);
+        return;
+    }
+    if (count < 2 || (strcmp(fields[0], "PUT") && strlen(fields[1]) >= NAME_SIZE)) {
+        fprintf(out, "\nInvalid request!\n");
+        return;
+    }
+    
+    /* A key that does not fit is refused here rather than shortened into someone else's. */
+    if (!strcmp(fields[0], "BOOK") && count > 4)
+        key = fields[4];
+    else if (!strcmp(fields[0], "CANCEL") && count > 2)
+        key = fields[2];
+    if (key != NULL && strlen(key) >= IDEMPOTENCY_KEY_SIZE) {
+        fprintf(out, "\nRequest key too long; at most %d characters are accepted.\n", IDEMPOTENCY_KEY_SIZE - 1);
+        return;
+    }
+    
+    if (!strcmp(fields[0], "ADD") && count == 3)
+        registerUser(userptr, fields[1], fields[2], out);
+    else if (!strcmp(fields[0], "LOGIN") && count == 3) {
+        /* Drive the same conversations the menu uses, feeding every answer at once. */
+        loginStart(&s, out);
+        sessionResume(&s, userptr, fields[1]);
+        sessionResume(&s, userptr, fields[2]);
+    } else if (!strcmp(fields[0], "BOOK") && count >= 4) {
+        bookingStart(&s, *userptr, fields[1], count > 4 ? fields[4] : NULL, out);
+        if (s.step == stepBookingCode && sessionResume(&s, userptr, fields[2]) && sessionResume(&s, userptr, "1"))
+            sessionResume(&s, userptr, fields[3]);
+    } else if (!strcmp(fields[0], "CANCEL"))
+        cancelBooking(userptr, fields[1], count > 2 ? fields[2] : NULL, out);
+    else if (!strcmp(fields[0], "CHECK"))
+        reportTicket(*userptr, fields[1], out);
+    else if (!strcmp(fields[0], "PASSWD") && count == 4) {
+        changePasswordStart(&s, fields[1], out);
+        if (sessionResume(&s, userptr, fields[2]))
+            sessionResume(&s, userptr, fields[3]);
+    } else if (!strcmp(fields[0], "PUT")) {
+        /* A record handed over by another shard. */
+        snprintf(record, sizeof(record), "%s", fields[1]);
+        if (!parseUserLine(record, &temp)) {
+            fprintf(out, "\nInvalid record!\n");
+            return;
+        }
+        lockRecord(temp.username);
+        *userptr = mergeUser(refreshUsers(*userptr, NULL), &temp);
+        *userptr = persistUsers(*userptr, temp.username, "PUT", NULL, 0);
+        unlockRecord(temp.username);
+    } else if (!strcmp(fields[0], "DROP")) {
+        lockRecord(fields[1]);
+        *userptr = removeUser(refreshUsers(*userptr, NULL), fields[1]);
+        *userptr = persistUsers(*userptr, fields[1], "DROP", NULL, 0);
+        unlockRecord(fields[1]);
+    } else
+        fprintf(out, "\nInvalid request!\n");
+}
+
+int runRouter(char **names, int count) {
+    int fd, i, j;
+    
+    installSignalHandlers();
+    
+    /* The saved ring, with any shards attached since, wins over the names the router was first started with. */
+    if (loadShards() == 0) {
+        for (i = 0; i < count; i++) {
+            for (j = 0; j < shardCount && strcmp(shards[j].name, names[i]) != 0; j++)
+                ;
+            if (j == shardCount)
+                fprintf(stderr, "Shard %s is not in %s; attach it with ADDSHARD\n", names[i], ROUTER_SHARDS);
+        }
+    } else {
+        for (i = 0; i < count && shardCount < MAX_SHARDS; i++) {
+            if (strlen(names[i]) >= sizeof(shards[0].name)) {
+                fprintf(stderr, "Shard name %s is too long\n", names[i]);
+                return 1;
+            }
+            snprintf(shards[shardCount].name, sizeof(shards[shardCount].name), "%s", names[i]);
+            shards[shardCount].fd = -1;
+            addToRing(shardCount++);
+        }
+        if (saveShards() != 0)
+            fprintf(stderr, "Warning: %s could not be written\n", ROUTER_SHARDS);
+    }
+    if (retryPendingDrops() > 0)
+        fprintf(stderr, "Warning: some moved accounts still have old copies; see %s\n", ROUTER_PENDING);
+    
+    fd = listenLocal("router.sock");
+    if (fd < 0) {
+        fprintf(stderr, "Cannot listen on router.sock\n");
+        return 1;
+    }
+    printf("Router serving on router.sock for %d shard(s)\n", shardCount);
+    fflush(stdout);
+    
+    serveRequests(fd, serveRouterRequest, NULL);
+    
+    close(fd);
+    unlink("router.sock");
+    for (i = 0; i < shardCount; i++)
+        if (shards[i].fd >= 0)
+            close(shards[i].fd);
+    return 0;
+}
+
+void serveRouterRequest(char *line, FILE *out, void *context) {
+    char request[4096], *fields[6];
+    int count, owner, fd, i;
+    
+    (void)context;
+    snprintf(request, sizeof(request), "%s", line);
+    count = splitFields(line, fields, 6);
+    if (count == 0)
+        return;
+    
+    if (!strcmp(fields[0], "SHARDS")) {
+        for (i = 0; i < shardCount; i++)
+            fprintf(out, "%s %s\n", shards[i].name, shardConnection(i) >= 0 ? "up" : "down");
+        return;
+    }
+    if (!strcmp(fields[0], "ADDSHARD") && count == 2) {
+        addShard(fields[1], out);
+        return;
+    }
+    if (count < 2 || !strcmp(fields[0], "DUMP") || !strcmp(fields[0], "PUT") || !strcmp(fields[0], "DROP")) {
+        fprintf(out, "\nInvalid request!\n");
+        return;
+    }
+    
+    /* Everything else concerns one account and goes to the shard owning it. */
+    owner = ownerOf(fields[1]);
+    fd = owner < 0 ? -1 : shardConnection(owner);
+    if (fd < 0 || exchangeRequest(fd, request, out) != 0) {
+        if (owner >= 0 && shards[owner].fd >= 0) {
+            close(shards[owner].fd);
+            shards[owner].fd = -1;
+        }
+        fprintf(out, "\nService unavailable; please try again later.\n");
+    }
+}
+
+void serveRequests(int fd, void (*handle)(char *line, FILE *out, void *context), void *context) {
+    struct pollfd fds[1 + MAX_CLIENTS];
+    client clients[MAX_CLIENTS];
+    double deadline;
+    int i, slot, ready, open;
+    
+    for (i = 0; i < MAX_CLIENTS; i++)
+        clients[i].fd = -1;
+    
+    while (!shutdownRequested) {
+        fds[0].fd = fd;
+        fds[0].events = POLLIN;
+        for (i = 0; i < MAX_CLIENTS; i++) {
+            fds[1 + i].fd = clients[i].fd;
+            fds[1 + i].events = POLLIN;
+        }
+        if (poll(fds, 1 + MAX_CLIENTS, -1) < 0)
+            continue;
+        
+        if (fds[0].revents & POLLIN) {
+            for (slot = 0; slot < MAX_CLIENTS && clients[slot].fd >= 0; slot++)
+                ;
+            i = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+            if (i >= 0 && slot == MAX_CLIENTS)
+                close(i);
+            else if (i >= 0) {
+                clients[slot].fd = i;
+                clients[slot].length = 0;
+            }
+        }
+        
+        for (i = 0; i < MAX_CLIENTS; i++)
+            if (clients[i].fd >= 0 && fds[1 + i].revents)
+                serveClient(&clients[i], handle, context);
+    }
+    
+    /* Drain: stop accepting, but answer what open connections have already sent. */
+    drainStarted = monotonicMs();
+    deadline = drainStarted + DRAIN_TIMEOUT_MS;
+    for (;;) {
+        for (i = 0, open = 0; i < MAX_CLIENTS; i++) {
+            fds[i].fd = clients[i].fd;
+            fds[i].events = POLLIN;
+            open += clients[i].fd >= 0;
+        }
+        if (open == 0 || monotonicMs() >= deadline)
+            break;
+        ready = poll(fds, MAX_CLIENTS, DRAIN_IDLE_MS);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready <= 0)
+            break;
+        for (i = 0; i < MAX_CLIENTS; i++)
+            if (clients[i].fd >= 0 && fds[i].revents)
+                serveClient(&clients[i], handle, context);
+    }
+    
+    for (i = 0; i < MAX_CLIENTS; i++)
+        if (clients[i].fd >= 0)
+            close(clients[i].fd);
+}
+
+void serveClient(client *c, void (*handle)(char *line, FILE *out, void *context), void *context) {
+    char *reply, *line, *end;
+    size_t replyLength;
+    ssize_t length;
+    FILE *out;
+    
+    length = read(c->fd, c->buffer + c->length, sizeof(c->buffer) - 1 - c->length);
+    if (length < 0 && errno == EINTR)
+        return;
+    if (length <= 0) {
+        close(c->fd);
+        c->fd = -1;
+        return;
+    }
+    c->length += length;
+    c->buffer[c->length] = '\0';
+    
+    /* Answer every complete request; each reply ends with a "." line. */
+    for (line = c->buffer; (end = strchr(line, '\n')) != NULL; line = end + 1) {
+        *end = '\0';
+        if (end > line && end[-1] == '\r')
+            end[-1] = '\0';
+        
+        reply = NULL;
+        out = open_memstream(&reply, &replyLength);
+        if (out == NULL)
+            continue;
+        handle(line, out, context);
+        fputs(".\n", out);
+        fclose(out);
+        
+        if (sendAll(c->fd, reply, replyLength) != 0) {
+            close(c->fd);
+            c->fd = -1;
+        }
+        free(reply);
+        if (c->fd < 0)
+            return;
+    }
+    
+    c->length = strlen(line);
+    memmove(c->buffer, line, c->length);
+}
+
+int listenLocal(const char *path) {
+    struct sockaddr_un address;
+    int fd;
+    
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+    
+    unlink(path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, MAX_CLIENTS) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int connectLocal(const char *path) {
+    struct sockaddr_un address;
+    int fd;
+    
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+    
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int exchangeRequest(int fd, const char *request, FILE *out) {
+    char buffer[4096];
+    size_t held = 0;
+    ssize_t length;
+    
+    if (sendAll(fd, request, strlen(request)) != 0 || sendAll(fd, "\n", 1) != 0)
+        return -1;
+    
+    /* Copy the reply through, holding back just enough to spot the final ".\n" line. */
+    for (;;) {
+        length = read(fd, buffer + held, sizeof(buffer) - held);
+        if (length < 0 && errno == EINTR)
+            continue;
+        if (length <= 0)
+            return -1;
+        held += length;
+        
+        if ((held == 2 || (held > 2 && buffer[held - 3] == '\n')) && !memcmp(buffer + held - 2, ".\n", 2)) {
+            fwrite(buffer, 1, held - 2, out);
+            return 0;
+        }
+        if (held > 3) {
+            fwrite(buffer, 1, held - 3, out);
+            memmove(buffer, buffer + held - 3, 3);
+            held = 3;
+        }
+    }
+}
+
+int splitFields(char *line, char **fields, int max) {
+    int count = 0;
+    
+    if (*line == '\0')
+        return 0;
+    while (count < max) {
+        fields[count++] = line;
+        line = strchr(line, '\t');
+        if (line == NULL)
+            break;
+        *line++ = '\0';
+    }
+    return count;
+}
+
+void addToRing(int index) {
+    char label[96];
+    ringPoint point;
+    int i, j;
+    
+    for (i = 0; i < VIRTUAL_NODES; i++) {
+        snprintf(label, sizeof(label), "%s#%d", shards[index].name, i);
+        point.hash = ringHash(label);
+        point.shard = index;
+        
+        /* Insertion keeps the ring sorted; it only changes when a shard is added. */
+        for (j = ringSize; j > 0 && ring[j - 1].hash > point.hash; j--)
+            ring[j] = ring[j - 1];
+        ring[j] = point;
+        ringSize++;
+    }
+}
+
+unsigned int ringHash(const char *key) {
+    unsigned int hash = checksum(key, strlen(key));
+    
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+int ownerOf(const char *username) {
+    unsigned int hash;
+    int low = 0, high = ringSize;
+    
+    if (ringSize == 0)
+        return -1;
+    
+    /* The first virtual node at or after the key's position owns it. */
+    hash = ringHash(username);
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (ring[middle].hash < hash)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return ring[low == ringSize ? 0 : low].shard;
+}
+
+int shardConnection(int index) {
+    char path[sizeof(shards[0].name) + sizeof("shard-/engine.sock")];
+    int length;
+    
+    if (shards[index].fd < 0) {
+        length = snprintf(path, sizeof(path), "shard-%.*s/engine.sock", (int)sizeof(shards[0].name) - 1,
+                          shards[index].name);
+        if (length < 0 || length >= (int)sizeof(path))
+            return -1;
+        shards[index].fd = connectLocal(path);
+    }
+    return shards[index].fd;
+}
+
+void addShard(const char *name, FILE *out) {
+    char *dump, *line, *end, request[700], username[NAME_SIZE];
+    movedAccount *moves = NULL;
+    size_t dumpLength, count = 0, capacity = 0, m;
+    unsigned long pending = 0;
+    FILE *records;
+    int index, i, failed = 0;
+    
+    retryPendingDrops();
+    for (i = 0; i < shardCount; i++) {
+        if (!strcmp(shards[i].name, name)) {
+            fprintf(out, "\nShard %s is already attached.\n", name);
+            return;
+        }
+    }
+    if (shardCount == MAX_SHARDS) {
+        fprintf(out, "\nNo room for another shard.\n");
+        return;
+    }
+    if (strlen(name) >= sizeof(shards[0].name)) {
+        fprintf(out, "\nShard name %s is too long.\n", name);
+        return;
+    }
+    
+    index = shardCount;
+    snprintf(shards[index].name, sizeof(shards[index].name), "%s", name);
+    shards[index].fd = -1;
+    if (shardConnection(index) < 0) {
+        fprintf(out, "\nShard %s is not running.\n", name);
+        return;
+    }
+    shardCount++;
+    addToRing(index);
+    
+    /* First copy every account the new shard now owns; until the ring is saved, nothing has moved. */
+    for (i = 0; i < index && !failed; i++) {
+        dump = NULL;
+        records = shardConnection(i) < 0 ? NULL : open_memstream(&dump, &dumpLength);
+        if (records == NULL || exchangeRequest(shards[i].fd, "DUMP", records) != 0) {
+            if (records != NULL)
+                fclose(records);
+            free(dump);
+            failed = 1;
+            break;
+        }
+        fclose(records);
+        
+        for (line = dump; (end = strchr(line, '\n')) != NULL; line = end + 1) {
+            *end = '\0';
+            if (sscanf(line, "%99s", username) != 1 || ownerOf(username) != index)
+                continue;
+            snprintf(request, sizeof(request), "PUT\t%s", line);
+            if (shardRequest(index, request) != 0) {
+                failed = 1;
+                break;
+            }
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                moves = (movedAccount*)realloc(moves, capacity * sizeof(movedAccount));
+            }
+            moves[count].source = i;
+            strcpy(moves[count++].username, username);
+        }
+        free(dump);
+    }
+    
+    /* The saved ring is the commit point: a failure before it takes the copies back. */
+    if (failed || saveShards() != 0) {
+        for (m = 0; m < count; m++) {
+            snprintf(request, sizeof(request), "DROP\t%s", moves[m].username);
+            shardRequest(index, request);
+        }
+        if (shards[index].fd >= 0)
+            close(shards[index].fd);
+        shardCount--;
+        rebuildRing();
+        free(moves);
+        fprintf(out, "\nShard %s not attached: %s; no account moved.\n", name,
+                failed ? "a shard could not be read or written" : "the ring could not be saved");
+        return;
+    }
+    
+    /* Then drop the originals; a drop that fails is retried later, and no request reaches the stale copy meanwhile. */
+    for (m = 0; m < count; m++) {
+        snprintf(request, sizeof(request), "DROP\t%s", moves[m].username);
+        if (shardRequest(moves[m].source, request) != 0) {
+            recordPendingDrop(shards[moves[m].source].name, moves[m].username);
+            pending++;
+        }
+    }
+    free(moves);
+    fprintf(out, "\nShard %s attached; %zu account(s) moved to it.\n", name, count);
+    if (pending > 0)
+        fprintf(out, "%lu old cop(ies) could not be dropped yet; they will be retried.\n", pending);
+}
+
+int shardRequest(int index, const char *request) {
+    char *reply = NULL;
+    size_t replyLength = 0;
+    FILE *stream;
+    int result = -1;
+    
+    if (shardConnection(index) < 0)
+        return -1;
+    stream = open_memstream(&reply, &replyLength);
+    if (stream == NULL)
+        return -1;
+    if (exchangeRequest(shards[index].fd, request, stream) != 0) {
+        close(shards[index].fd);
+        shards[index].fd = -1;
+    } else
+        result = 0;
+    fclose(stream);
+    
+    /* PUT and DROP reply nothing when they succeed. */
+    if (result == 0 && replyLength > 0)
+        result = -1;
+    free(reply);
+    return result;
+}
+
+void rebuildRing(void) {
+    int i;
+    
+    ringSize = 0;
+    for (i = 0; i < shardCount; i++)
+        addToRing(i);
+}
+
+int saveShards(void) {
+    FILE *fp;
+    int i, failed;
+    
+    fp = fopen(ROUTER_SHARDS ".tmp", "w");
+    if (fp == NULL)
+        return -1;
+    for (i = 0; i < shardCount; i++)
+        fprintf(fp, "%s\n", shards[i].name);
+    failed = fflush(fp) != 0 || fsync(fileno(fp)) != 0;
+    if (fclose(fp) != 0 || failed || rename(ROUTER_SHARDS ".tmp", ROUTER_SHARDS) != 0)
+        return -1;
+    return 0;
+}
+
+int loadShards(void) {
+    char line[128];
+    FILE *fp;
+    
+    fp = fopen(ROUTER_SHARDS, "r");
+    if (fp == NULL)
+        return -1;
+    while (shardCount < MAX_SHARDS && fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || strlen(line) >= sizeof(shards[0].name))
+            continue;
+        snprintf(shards[shardCount].name, sizeof(shards[shardCount].name), "%s", line);
+        shards[shardCount].fd = -1;
+        addToRing(shardCount++);
+    }
+    fclose(fp);
+    return 0;
+}
+
+void recordPendingDrop(const char *shardName, const char *username) {
+    char line[200];
+    int fd, length;
+    
+    length = snprintf(line, sizeof(line), "%s\t%s\n", shardName, username);
+    fd = open(ROUTER_PENDING, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0 || write(fd, line, length) != length || fsync(fd) != 0)
+        fprintf(stderr, "Warning: %s on shard %s must be dropped by hand.\n", username, shardName);
+    if (fd >= 0)
+        close(fd);
+}
+
+int retryPendingDrops(void) {
+    char line[200], request[160], *tab;
+    int index, left = 0;
+    FILE *fp, *rest;
+    
+    fp = fopen(ROUTER_PENDING, "r");
+    if (fp == NULL)
+        return 0;
+    rest = fopen(ROUTER_PENDING ".tmp", "w");
+    if (rest == NULL) {
+        fclose(fp);
+        return -1;
+    }
+    
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        tab = strchr(line, '\t');
+        if (tab == NULL)
+            continue;
+        *tab = '\0';
+        for (index = 0; index < shardCount && strcmp(shards[index].name, line) != 0; index++)
+            ;
+        
+        /* A copy on the shard that owns the account again is the live one, not a leftover. */
+        if (index == shardCount || ownerOf(tab + 1) == index)
+            continue;
+        snprintf(request, sizeof(request), "DROP\t%s", tab + 1);
+        if (shardRequest(index, request) != 0) {
+            fprintf(rest, "%s\t%s\n", line, tab + 1);
+            left++;
+        }
+    }
+    fclose(fp);
+    if (fclose(rest) != 0 || rename(ROUTER_PENDING ".tmp", ROUTER_PENDING) != 0)
+        return -1;
+    if (left == 0)
+        unlink(ROUTER_PENDING);
+    return left;
+}
+
+int runClient(const char *path) {
+    char line[4096];
+    int fd;
+    
+    fd = connectLocal(path);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot connect to %s\n", path);
+        return 1;
+    }
+    
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (exchangeRequest(fd, line, stdout) != 0)
+            break;
+        fflush(stdout);
+    }
+    close(fd);
+    return 0;
+}
+
+void lockRecord(const char *username) {
+    lockByte(1 + checksum(username, strlen(username)) % RECORD_LOCK_SLOTS, F_WRLCK);
+}
+
+void unlockRecord(const char *username) {
+    lockByte(1 + checksum(username, strlen(username)) % RECORD_LOCK_SLOTS, F_UNLCK);
+}
+
+int openLockFile(void) {
+    if (lockFd < 0)
+        lockFd = open(LOCK_FILE, O_RDWR | O_CREAT, 0644);
+    return lockFd < 0 ? -1 : 0;
+}
+
+int tryLockByte(long offset) {
+    struct flock region;
+    
+    if (openLockFile() != 0)
+        return -1;
+    
+    memset(&region, 0, sizeof(region));
+    region.l_type = F_WRLCK;
+    region.l_whence = SEEK_SET;
+    region.l_start = offset;
+    region.l_len = 1;
+    return fcntl(lockFd, F_SETLK, &region) == 0 ? 0 : -1;
+}
+
+int lockByte(long offset, short type) {
+    return lockBytes(offset, 1, type);
+}
+
+int lockBytes(long offset, long length, short type) {
+    struct flock region;
+    
+    if (openLockFile() != 0)
+        return -1;
+    
+    memset(&region, 0, sizeof(region));
+    region.l_type = type;
+    region.l_whence = SEEK_SET;
+    region.l_start = offset;
+    region.l_len = length;
+    
+    /* Wait for the holder; a signal only interrupts the wait, not the request. */
+    while (fcntl(lockFd, F_SETLKW, &region) != 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return 0;
+}
+
+void stampStore(const struct stat *info) {
+    knownStore.device = info->st_dev;
+    knownStore.inode = info->st_ino;
+    knownStore.size = info->st_size;
+    knownStore.mtimeSec = info->st_mtim.tv_sec;
+    knownStore.mtimeNsec = info->st_mtim.tv_nsec;
+}
+
+int storeChanged(void) {
+    struct stat info;
+    
+    if (stat("users.txt", &info) != 0)
+        return 0;
+    
+    return knownStore.device != info.st_dev || knownStore.inode != info.st_ino ||
+           knownStore.size != info.st_size || knownStore.mtimeSec != info.st_mtim.tv_sec ||
+           knownStore.mtimeNsec != info.st_mtim.tv_nsec;
+}
+
+int applyStoredRecord(user *copy, void *context) {
+    user *stored = (user*)context;
+    
+    memcpy(copy->password, stored->password, sizeof(copy->password));
+    copy->place = internPlace(stored->place);
+    copy->price = stored->price;
+    copy->numberTicket = stored->numberTicket;
+    return 1;
+}
+
+void filing(user *userptr) {
+    FILE *fp;
+    fp = fopen("users.txt.tmp", "w");
+    if (fp == NULL)
+        return;
+    
+    userCursor cursor;
+    user copy;
+    char line[512];
+    
+    /* Write each user's data into the file to persist state, each line sealed with its checksum. */
+    startUsers(&cursor, userptr);
+    while (nextUser(&cursor, &copy))
+        fwrite(line, 1, formatRecord(line, sizeof(line), copy.username, &copy), fp);
+    
+    /* Replace the store atomically so a reader never sees a half-written file. */
+    if (fclose(fp) == 0)
+        rename("users.txt.tmp", "users.txt");
+}
+
+int syncStore(void) {
+    int fd, result = 0;
+    
+    fd = open("users.txt", O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fsync(fd) != 0)
+        result = -1;
+    close(fd);
+    
+    /* The rename in filing() is only durable once the directory is synced too. */
+    fd = open(".", O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fsync(fd) != 0)
+        result = -1;
+    close(fd);
+    return result;
+}
+
+int writeCheckpoint(user *userptr, const char *path) {
+    checkpointHeader header;
+    checkpointRecord *records;
+    struct stat source;
+    userCursor cursor;
+    user *ptr, copy;
+    unsigned int count = packedUsers + coldUsed, i = 0;
+    char temporary[128];
+    FILE *fp;
+    int result = -1;
+    
+    if (stat("users.txt", &source) != 0)
+        return -1;
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+    
+    for (ptr = userptr; ptr != NULL; ptr = ptr->next)
+        count++;
+    
+    records = (checkpointRecord*)calloc(count ? count : 1, sizeof(checkpointRecord));
+    if (records == NULL)
+        return -1;
+    
+    startUsers(&cursor, userptr);
+    for (; i < count && nextUser(&cursor, &copy); i++) {
+        strcpy(records[i].username, copy.username);
+        strcpy(records[i].password, copy.password);
+        strcpy(records[i].place, copy.place);
+        records[i].price = copy.price;
+        records[i].numberTicket = copy.numberTicket;
+    }
+    
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, CHECKPOINT_MAGIC);
+    header.count = count;
+    header.checksum = crc32c(records, count * sizeof(checkpointRecord));
+    header.sourceSize = source.st_size;
+    header.sourceMtimeSec = source.st_mtim.tv_sec;
+    header.sourceMtimeNsec = source.st_mtim.tv_nsec;
+    header.logInode = logInode;
+    header.logOffset = logOffset;
+    header.logSeq = logSeq;
+    
+    fp = fopen(temporary, "wb");
+    if (fp != NULL) {
+        if (fwrite(&header, sizeof(header), 1, fp) == 1 &&
+            fwrite(records, sizeof(checkpointRecord), count, fp) == count &&
+            fflush(fp) == 0 && fsync(fileno(fp)) == 0)
+            result = 0;
+        if (fclose(fp) != 0)
+            result = -1;
+        if (result == 0 && rename(temporary, path) != 0)
+            result = -1;
+    }
+    free(records);
+    return result;
+}
+
+int loadCheckpoint(user **userptr, const struct stat *log) {
+    checkpointHeader header;
+    struct stat source;
+    user *head = NULL;
+    int usable;
+    FILE *fp;
+    
+    if (log == NULL && stat("users.txt", &source) != 0)
+        return 0;
+    
+    fp = fopen("users.chk", "rb");
+    if (fp == NULL)
+        return 0;
+    
+    /* Only trust a checkpoint of this very log, or of exactly the current store. */
+    usable = fread(&header, sizeof(header), 1, fp) == 1 &&
+             !memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    if (usable && log != NULL)
+        usable = header.logInode == (unsigned long long)log->st_ino && header.logOffset <= log->st_size;
+    else if (usable)
+        usable = header.sourceSize == source.st_size &&
+                 header.sourceMtimeSec == source.st_mtim.tv_sec &&
+                 header.sourceMtimeNsec == source.st_mtim.tv_nsec;
+    if (usable)
+        usable = readCheckpointRecords(fp, &header, &head);
+    fclose(fp);
+    if (!usable)
+        return 0;
+    
+    if (log != NULL) {
+        logOffset = header.logOffset;
+        logSeq = header.logSeq;
+    } else
+        stampStore(&source);
+    *userptr = head;
+    return 1;
+}
+
+int readCheckpointRecords(FILE *fp, const checkpointHeader *header, user **userptr) {
+    checkpointRecord *records;
+    user *head = NULL, *tail = NULL, *ptr;
+    unsigned int i;
+    
+    records = (checkpointRecord*)malloc((header->count ? header->count : 1) * sizeof(checkpointRecord));
+    if (records == NULL ||
+        fread(records, sizeof(checkpointRecord), header->count, fp) != header->count ||
+        crc32c(records, header->count * sizeof(checkpointRecord)) != header->checksum) {
+        free(records);
+        return 0;
+    }
+    
+    for (i = 0; i < header->count; i++) {
+        ptr = (user*)malloc(sizeof(user));
+        ptr->username = intern(records[i].username);
+        memcpy(ptr->password, records[i].password, sizeof(ptr->password));
+        ptr->place = internPlace(records[i].place);
+        ptr->price = records[i].price;
+        ptr->numberTicket = records[i].numberTicket;
+        ptr->version = 0;
+        ptr->referenced = 0;
+        ptr->next = NULL;
+        
+        if (head == NULL)
+            head = tail = ptr;
+        else {
+            tail->next = ptr;
+            tail = ptr;
+        }
+    }
+    free(records);
+    
+    *userptr = head;
+    return 1;
+}
+
+unsigned int checksum(const void *data, size_t length) {
+    const unsigned char *bytes = (const unsigned char*)data;
+    unsigned int hash = 2166136261u;
+    size_t i;
+    
+    for (i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void showMenu(void) {
+    system("CLS");
+    printCatalog(stdout);
+    system("PAUSE");
+}
+
+void printCatalog(FILE *out) {
+    /* Display available tour packages and pricing details */
+    fprintf(out, "\nMENU\n\n");
+    fprintf(out, "1. Paris, France    - Rs 400000\n");
+    fprintf(out, "2. Tokyo, Japan     - Rs 600000\n");
+    fprintf(out, "3. Bangkok, Thailand- Rs 250000\n");
+    fprintf(out, "4. Abu Dhabi, UAE   - Rs 380000\n");
+    fprintf(out, "5. Miami, USA       - Rs 120000\n");
+    fprintf(out, "6. Rome, Italy      - Rs 100000\n");
+    fprintf(out, "7. Munich, Germany  - Rs 300000\n");
+    fprintf(out, "8. Madrid, Spain    - Rs 320000\n");
+    fprintf(out, "9. Istanbul, Turkey - Rs 450000\n");
+    fprintf(out, "10. Gilgit, Pakistan- Rs 75000\n");
+}
+
+int findPlace(const char *place) {
+    int i;
+    
+    for (i = 0; i < PLACE_COUNT; i++)
+        if (!strcmp(placeList[i], place))
+            return i;
+    return -1;
+}
+
+unsigned int snapshotUser(user *record, user *copy) {
+    unsigned int before, after;
+    
+    for (;;) {
+        before = __atomic_load_n(&record->version, __ATOMIC_ACQUIRE);
+        if (before & 1)
+            continue;
+        
+        memcpy(copy->password, record->password, sizeof(copy->password));
+        copy->place = record->place;
+        copy->price = record->price;
+        copy->numberTicket = record->numberTicket;
+        
+        /* Only accept the copy if no update started while it was taken. */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&record->version, __ATOMIC_RELAXED);
+        if (before == after)
+            return before;
+    }
+}
+
+int commitUser(user *record, unsigned int expected, const user *proposed) {
+    unsigned int claimed = expected;
+    
+    /* An odd version marks the record as being written. */
+    if (!__atomic_compare_exchange_n(&record->version, &claimed, expected + 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return 0;
+    
+    memcpy(record->password, proposed->password, sizeof(record->password));
+    record->place = proposed->place;
+    record->price = proposed->price;
+    record->numberTicket = proposed->numberTicket;
+    
+    __atomic_store_n(&record->version, expected + 2, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int updateUser(user *record, int (*change)(user *copy, void *context), void *context) {
+    user copy;
+    unsigned int version;
+    
+    for (;;) {
+        version = snapshotUser(record, &copy);
+        if (!change(&copy, context))
+            return 0;
+        if (commitUser(record, version, &copy))
+            return 1;
+    }
+}
+
+int applyBooking(user *copy, void *context) {
+    bookingRequest *request = (bookingRequest*)context;
+    
+    /* Prevent multiple bookings for same user without cancellation */
+    if (copy->price != 0.0)
+        return 0;
+    
+    copy->place = placeList[request->placeIndex];
+    copy->price = priceList[request->placeIndex];
+    copy->numberTicket = request->tickets;
+    return 1;
+}
+
+int applyCancellation(user *copy, void *context) {
+    cancellationRequest *request = (cancellationRequest*)context;
+    
+    /* Check whether a valid tour is booked by comparing destination names */
+    request->placeIndex = findPlace(copy->place);
+    if (request->placeIndex < 0)
+        return 0;
+    
+    request->tickets = copy->numberTicket;
+    request->refund = copy->price * copy->numberTicket;
+    snprintf(request->reply, sizeof(request->reply), "\nYour booking for %s (%d ticket(s)) has been cancelled. A refund of Rs %.0f will be processed.\n", 
+             copy->place, copy->numberTicket, request->refund);
+    copy->place = noPlace;
+    copy->price = 0.0;
+    copy->numberTicket = 0;
+    return 1;
+}
+
+int applyPasswordChange(user *copy, void *context) {
+    passwordRequest *request = (passwordRequest*)context;
+    
+    if (strcmp(copy->password, request->current))
+        return 0;
+    
+    snprintf(copy->password, sizeof(copy->password), "%s", request->replacement);
+    return 1;
+}
+
+user* findUser(user *userptr, const char *username) {
+    user *ptr;
+    
+    ptr = findResident(userptr, username);
+    if (ptr == NULL && (packedUsers > 0 || coldUsed > 0))
+        ptr = faultInUser(userptr, username);
+    if (ptr != NULL)
+        ptr->referenced = 1;
+    return ptr;
+}
+
+user* findResident(user *userptr, const char *username) {
+    const char *handle;
+    
+    /* A name never interned belongs to no record; otherwise compare handles, not strings. */
+    handle = findInterned(username);
+    if (handle == NULL)
+        return NULL;
+    while (userptr != NULL) {
+        if (userptr->username == handle)
+            return userptr;
+        userptr = userptr->next;
+    }
+    return NULL;
+}
+
+const char* intern(const char *text) {
+    const char **table;
+    size_t capacity, length, slot, i;
+    
+    pthread_mutex_lock(&internLock);
+    
+    /* Keep the table at most half full so probe sequences stay short. */
+    if ((internCount + 1) * 2 > internCapacity) {
+        table = internTable;
+        capacity = internCapacity;
+        internCapacity = capacity ? capacity * 2 : 1024;
+        internTable = (const char**)calloc(internCapacity, sizeof(const char*));
+        for (i = 0; i < capacity; i++)
+            if (table[i] != NULL)
+                internTable[internSlot(table[i])] = table[i];
+        free(table);
+    }
+    
+    slot = internSlot(text);
+    if (internTable[slot] == NULL) {
+        length = strlen(text) + 1;
+        if (length > internSpace) {
+            internSpace = length > INTERN_CHUNK ? length : INTERN_CHUNK;
+            internArena = (char*)malloc(internSpace);
+        }
+        memcpy(internArena, text, length);
+        internTable[slot] = internArena;
+        internArena += length;
+        internSpace -= length;
+        internCount++;
+    }
+    text = internTable[slot];
+    
+    pthread_mutex_unlock(&internLock);
+    return text;
+}
+
+const char* findInterned(const char *text) {
+    const char *found = NULL;
+    
+    pthread_mutex_lock(&internLock);
+    if (internCapacity > 0)
+        found = internTable[internSlot(text)];
+    pthread_mutex_unlock(&internLock);
+    return found;
+}
+
+const char* internPlace(const char *place) {
+    int index;
+    
+    index = findPlace(place);
+    if (index >= 0)
+        return placeList[index];
+    if (!strcmp(place, noPlace))
+        return noPlace;
+    return intern(place);
+}
+
+size_t internSlot(const char *text) {
+    size_t slot = ringHash(text) & (internCapacity - 1);
+    
+    while (internTable[slot] != NULL && strcmp(internTable[slot], text))
+        slot = (slot + 1) & (internCapacity - 1);
+    return slot;
+}
+
+void trimUsers(user *userptr) {
+    user *ptr, *previous, *handPrevious = NULL, *victims[PACK_BLOCK_RECORDS];
+    size_t resident = 0, limit;
+    unsigned int count = 0;
+    
+    if (memoryBudget == 0 || userptr == NULL)
+        return;
+    limit = memoryBudget / 2 / sizeof(user);
+    if (limit < 1)
+        limit = 1;
+    
+    /* Count the resident records, noting the one before the hand to unlink from. */
+    for (previous = NULL, ptr = userptr; ptr != NULL; previous = ptr, ptr = ptr->next) {
+        if (ptr == clockHand)
+            handPrevious = previous;
+        resident++;
+    }
+    
+    if (resident > limit) {
+        if (handPrevious == NULL)
+            handPrevious = userptr;
+        
+        /* Sweep from the hand, wrapping past the end; every step clears a mark or evicts. */
+        previous = handPrevious;
+        ptr = previous->next;
+        while (resident > limit) {
+            if (ptr == NULL) {
+                previous = userptr;
+                ptr = userptr->next;
+            } else if (ptr->referenced) {
+                ptr->referenced = 0;
+                previous = ptr;
+                ptr = ptr->next;
+            } else {
+                previous->next = ptr->next;
+                victims[count++] = ptr;
+                ptr = previous->next;
+                resident--;
+                if (count == PACK_BLOCK_RECORDS) {
+                    packUsers(victims, count);
+                    count = 0;
+                }
+            }
+        }
+        if (count > 0)
+            packUsers(victims, count);
+        clockHand = ptr;
+    }
+    
+    /* Keep a block in memory rather than lose it if the disk is in trouble. */
+    while (packedBytes > memoryBudget / 2 && packedOldest != NULL)
+        if (spillOldestBlock() != 0)
+            break;
+}
+
+user* faultInUser(user *userptr, const char *username) {
+    packedBlock *block;
+    coldSlot slot;
+    long long index = -1;
+    int position;
+    user *ptr;
+    
+    if (userptr == NULL && username != NULL)
+        return NULL;
+    
+    ptr = (user*)malloc(sizeof(user));
+    position = findPacked(username, &block, ptr);
+    if (position >= 0)
+        releasePacked(block, position);
+    else {
+        index = findColdSlot(username, &slot);
+        if (index < 0) {
+            free(ptr);
+            return NULL;
+        }
+        ptr->username = intern(slot.record.username);
+        memcpy(ptr->password, slot.record.password, sizeof(ptr->password));
+        ptr->place = internPlace(slot.record.place);
+        ptr->price = slot.record.price;
+        ptr->numberTicket = slot.record.numberTicket;
+        releaseColdSlot(index);
+    }
+    ptr->version = 0;
+    ptr->referenced = 0;
+    
+    /* Linking after the head leaves the head, which callers hold, unchanged. */
+    if (userptr == NULL)
+        ptr->next = NULL;
+    else {
+        ptr->next = userptr->next;
+        userptr->next = ptr;
+    }
+    return ptr;
+}
+
+void packUsers(user **victims, unsigned int count) {
+    unsigned char data[PACK_BLOCK_RECORDS * PACK_RECORD_MAX];
+    const char *previous = "";
+    packedBlock *block;
+    unsigned int size = 0, packed, hash, i;
+    user copy;
+    
+    /* Sorted names share long prefixes with their neighbours. */
+    qsort(victims, count, sizeof(user*), compareUsernames);
+    for (packed = 0; packed < count && size + PACK_RECORD_MAX <= sizeof(data); packed++) {
+        snapshotUser(victims[packed], &copy);
+        copy.username = victims[packed]->username;
+        size += packRecord(data + size, previous, &copy);
+        previous = victims[packed]->username;
+    }
+    
+    block = (packedBlock*)calloc(1, sizeof(packedBlock) + size);
+    memcpy(block->data, data, size);
+    block->count = packed;
+    block->size = size;
+    for (i = 0; i < packed; i++) {
+        hash = ringHash(victims[i]->username);
+        block->filter[(hash % PACK_FILTER_BITS) / 64] |= 1ull << (hash % 64);
+        block->filter[((hash >> 16) % PACK_FILTER_BITS) / 64] |= 1ull << ((hash >> 16) % 64);
+        free(victims[i]);
+    }
+    
+    if (packedNewest == NULL)
+        packedOldest = block;
+    else
+        packedNewest->next = block;
+    packedNewest = block;
+    packedBytes += sizeof(packedBlock) + size;
+    packedUsers += packed;
+    
+    /* Records that did not fit go to a block of their own. */
+    if (packed < count)
+        packUsers(victims + packed, count - packed);
+}
+
+int findPacked(const char *username, packedBlock **block, user *record) {
+    unsigned int hash = username != NULL ? ringHash(username) : 0, offset, i;
+    char name[100];
+    packedBlock *ptr;
+    
+    for (ptr = packedOldest; ptr != NULL; ptr = ptr->next) {
+        if (username != NULL && !packedMayHold(ptr, hash))
+            continue;
+        name[0] = '\0';
+        for (i = 0, offset = 0; i < ptr->count; i++) {
+            offset += unpackRecord(ptr->data + offset, name, record);
+            if (ptr->removed & (1ull << i))
+                continue;
+            if (username == NULL || !strcmp(name, username)) {
+                record->username = intern(name);
+                *block = ptr;
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+void releasePacked(packedBlock *block, int index) {
+    packedBlock *ptr, *previous = NULL;
+    
+    block->removed |= 1ull << index;
+    packedUsers--;
+    if (block->removed != (block->count == 64 ? ~0ull : (1ull << block->count) - 1))
+        return;
+    
+    /* Every record left the block. */
+    for (ptr = packedOldest; ptr != NULL && ptr != block; ptr = ptr->next)
+        previous = ptr;
+    if (previous == NULL)
+        packedOldest = block->next;
+    else
+        previous->next = block->next;
+    if (packedNewest == block)
+        packedNewest = previous;
+    packedBytes -= sizeof(packedBlock) + block->size;
+    free(block);
+}
+
+int spillOldestBlock(void) {
+    packedBlock *block = packedOldest;
+    unsigned int offset, i;
+    char name[100];
+    user record;
+    
+    name[0] = '\0';
+    for (i = 0, offset = 0; i < block->count; i++) {
+        offset += unpackRecord(block->data + offset, name, &record);
+        if (block->removed & (1ull << i))
+            continue;
+        record.version = 0;
+        if (spillUser(&record) != 0)
+            return -1;
+        
+        /* Releasing the last record frees the block. */
+        releasePacked(block, i);
+        if (packedOldest != block)
+            break;
+    }
+    return 0;
+}
+
+unsigned int packRecord(unsigned char *data, const char *previous, const user *record) {
+    unsigned int shared = 0, length = 0, suffix;
+    int place;
+    
+    while (previous[shared] != '\0' && previous[shared] == record->username[shared])
+        shared++;
+    suffix = strlen(record->username) - shared;
+    data[length++] = shared;
+    data[length++] = suffix;
+    memcpy(data + length, record->username + shared, suffix);
+    length += suffix;
+    
+    data[length] = strlen(record->password);
+    memcpy(data + length + 1, record->password, data[length]);
+    length += 1 + data[length];
+    
+    /* Destinations come from a catalog of ten; one byte names any of them. */
+    place = findPlace(record->place);
+    if (place < 0)
+        place = strcmp(record->place, "N/A") ? PACK_OTHER_PLACE : PACK_NO_PLACE;
+    if (record->price != (place < PLACE_COUNT ? priceList[place] : 0.0f))
+        place |= PACK_PRICE_FOLLOWS;
+    data[length++] = place;
+    if ((place & ~PACK_PRICE_FOLLOWS) == PACK_OTHER_PLACE) {
+        data[length] = strlen(record->place);
+        memcpy(data + length + 1, record->place, data[length]);
+        length += 1 + data[length];
+    }
+    if (place & PACK_PRICE_FOLLOWS) {
+        memcpy(data + length, &record->price, sizeof(record->price));
+        length += sizeof(record->price);
+    }
+    
+    /* Ticket counts are small; seven bits per byte, high bit set while more follow. */
+    suffix = (unsigned int)record->numberTicket;
+    while (suffix >= 0x80) {
+        data[length++] = (suffix & 0x7F) | 0x80;
+        suffix >>= 7;
+    }
+    data[length++] = suffix;
+    return length;
+}
+
+unsigned int unpackRecord(const unsigned char *data, char *name, user *record) {
+    unsigned int length = 0, shared, suffix, tickets = 0, shift = 0;
+    char other[NAME_SIZE];
+    int place;
+    
+    shared = data[length++];
+    suffix = data[length++];
+    memcpy(name + shared, data + length, suffix);
+    name[shared + suffix] = '\0';
+    length += suffix;
+    record->username = name;
+    
+    memcpy(record->password, data + length + 1, data[length]);
+    record->password[data[length]] = '\0';
+    length += 1 + data[length];
+    
+    place = data[length++];
+    if ((place & ~PACK_PRICE_FOLLOWS) == PACK_OTHER_PLACE) {
+        memcpy(other, data + length + 1, data[length]);
+        other[data[length]] = '\0';
+        record->place = intern(other);
+        length += 1 + data[length];
+    } else
+        record->place = (place & ~PACK_PRICE_FOLLOWS) < PLACE_COUNT ? placeList[place & ~PACK_PRICE_FOLLOWS] : noPlace;
+    
+    if (place & PACK_PRICE_FOLLOWS) {
+        memcpy(&record->price, data + length, sizeof(record->price));
+        length += sizeof(record->price);
+    } else
+        record->price = (place & ~PACK_PRICE_FOLLOWS) < PLACE_COUNT ? priceList[place & ~PACK_PRICE_FOLLOWS] : 0.0f;
+    
+    do {
+        tickets |= (unsigned int)(data[length] & 0x7F) << shift;
+        shift += 7;
+    } while (data[length++] & 0x80);
+    record->numberTicket = (int)tickets;
+    return length;
+}
+
+int packedMayHold(const packedBlock *block, unsigned int hash) {
+    return (block->filter[(hash % PACK_FILTER_BITS) / 64] >> (hash % 64) & 1) &&
+           (block->filter[((hash >> 16) % PACK_FILTER_BITS) / 64] >> ((hash >> 16) % 64) & 1);
+}
+
+int spillUser(user *record) {
+    coldSlot slot;
+    user copy;
+    int placed;
+    
+    if ((coldUsed + coldReleased + 1) * 4 > coldCapacity * 3 && growColdStore() != 0)
+        return -1;
+    
+    memset(&slot, 0, sizeof(slot));
+    snapshotUser(record, &copy);
+    slot.state = coldLive;
+    strcpy(slot.record.username, record->username);
+    strcpy(slot.record.password, copy.password);
+    strcpy(slot.record.place, copy.place);
+    slot.record.price = copy.price;
+    slot.record.numberTicket = copy.numberTicket;
+    
+    placed = placeColdSlot(coldFd, coldCapacity, &slot);
+    if (placed < 0)
+        return -1;
+    if (placed)
+        coldReleased--;
+    coldUsed++;
+    return 0;
+}
+
+long long findColdSlot(const char *username, coldSlot *slot) {
+    size_t index, probes;
+    
+    if (coldUsed == 0)
+        return -1;
+    
+    index = username != NULL ? ringHash(username) & (coldCapacity - 1) : 0;
+    for (probes = 0; probes < coldCapacity; probes++) {
+        if (pread(coldFd, slot, sizeof(*slot), (off_t)(index * sizeof(*slot))) != (ssize_t)sizeof(*slot))
+            return -1;
+        if (slot->state == coldEmpty && username != NULL)
+            return -1;
+        if (slot->state == coldLive && (username == NULL || !strcmp(slot->record.username, username)))
+            return (long long)index;
+        index = (index + 1) & (coldCapacity - 1);
+    }
+    return -1;
+}
+
+void releaseColdSlot(long long index) {
+    int state = coldRemoved;
+    
+    if (index < 0)
+        return;
+    if (pwrite(coldFd, &state, sizeof(state), (off_t)(index * sizeof(coldSlot))) != (ssize_t)sizeof(state))
+        return;
+    coldUsed--;
+    coldReleased++;
+}
+
+int placeColdSlot(int fd, size_t capacity, const coldSlot *slot) {
+    size_t index, probes;
+    int state;
+    
+    index = ringHash(slot->record.username) & (capacity - 1);
+    for (probes = 0; probes < capacity; probes++) {
+        if (pread(fd, &state, sizeof(state), (off_t)(index * sizeof(*slot))) != (ssize_t)sizeof(state))
+            return -1;
+        if (state != coldLive) {
+            if (pwrite(fd, slot, sizeof(*slot), (off_t)(index * sizeof(*slot))) != (ssize_t)sizeof(*slot))
+                return -1;
+            return state == coldRemoved;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+    return -1;
+}
+
+int growColdStore(void) {
+    coldSlot batch[COLD_BATCH];
+    size_t capacity, slot, i;
+    ssize_t length;
+    int fd;
+    
+    /* Double only when live records need it; otherwise just sweep out removed slots. */
+    capacity = coldCapacity ? coldCapacity : COLD_INITIAL_SLOTS;
+    while ((coldUsed + 1) * 2 > capacity)
+        capacity *= 2;
+    
+    /* Spilled records are only a cache of memory, so the store needs no name and dies with the process. */
+    fd = open(".", O_TMPFILE | O_RDWR, 0600);
+    if (fd < 0)
+        return -1;
+    if (ftruncate(fd, (off_t)(capacity * sizeof(coldSlot))) != 0) {
+        close(fd);
+        return -1;
+    }
+    
+    for (slot = 0; slot < coldCapacity; slot += length / sizeof(coldSlot)) {
+        length = pread(coldFd, batch, sizeof(batch), (off_t)(slot * sizeof(coldSlot)));
+        if (length < (ssize_t)sizeof(coldSlot)) {
+            close(fd);
+            return -1;
+        }
+        for (i = 0; i < length / sizeof(coldSlot); i++) {
+            if (batch[i].state == coldLive && placeColdSlot(fd, capacity, &batch[i]) < 0) {
+                close(fd);
+                return -1;
+            }
+        }
+    }
+    
+    if (coldFd >= 0)
+        close(coldFd);
+    coldFd = fd;
+    coldCapacity = capacity;
+    coldReleased = 0;
+    return 0;
+}
+
+int updateColdUser(const user *stored) {
+    coldSlot slot;
+    long long index;
+    
+    index = findColdSlot(stored->username, &slot);
+    if (index < 0)
+        return 0;
+    
+    memcpy(slot.record.password, stored->password, sizeof(slot.record.password));
+    snprintf(slot.record.place, sizeof(slot.record.place), "%s", stored->place);
+    slot.record.price = stored->price;
+    slot.record.numberTicket = stored->numberTicket;
+    if (pwrite(coldFd, &slot, sizeof(slot), (off_t)(index * sizeof(slot))) != (ssize_t)sizeof(slot))
+        fprintf(stderr, "Warning: spilled record of %s could not be updated.\n", stored->username);
+    return 1;
+}
+
+void startUsers(userCursor *cursor, user *userptr) {
+    cursor->next = userptr;
+    cursor->block = packedOldest;
+    cursor->offset = 0;
+    cursor->index = 0;
+    cursor->name[0] = '\0';
+    cursor->slot = 0;
+    cursor->batchStart = 0;
+    cursor->batchCount = 0;
+}
+
+int nextUser(userCursor *cursor, user *copy) {
+    coldSlot *slot;
+    ssize_t length;
+    
+    if (cursor->next != NULL) {
+        snapshotUser(cursor->next, copy);
+        copy->username = cursor->next->username;
+        cursor->next = cursor->next->next;
+        return 1;
+    }
+    
+    while (cursor->block != NULL) {
+        if (cursor->index == cursor->block->count) {
+            cursor->block = cursor->block->next;
+            cursor->offset = cursor->index = 0;
+            cursor->name[0] = '\0';
+            continue;
+        }
+        cursor->offset += unpackRecord(cursor->block->data + cursor->offset, cursor->name, copy);
+        if (!(cursor->block->removed & (1ull << cursor->index++)))
+            return 1;
+    }
+    
+    for (; cursor->slot < coldCapacity; cursor->slot++) {
+        if (cursor->slot >= cursor->batchStart + cursor->batchCount) {
+            length = pread(coldFd, cursor->batch, sizeof(cursor->batch), (off_t)(cursor->slot * sizeof(coldSlot)));
+            if (length < (ssize_t)sizeof(coldSlot))
+                return 0;
+            cursor->batchStart = cursor->slot;
+            cursor->batchCount = length / sizeof(coldSlot);
+        }
+        slot = &cursor->batch[cursor->slot - cursor->batchStart];
+        if (slot->state != coldLive)
+            continue;
+        
+        copy->username = slot->record.username;
+        memcpy(copy->password, slot->record.password, sizeof(copy->password));
+        copy->place = slot->record.place;
+        copy->price = slot->record.price;
+        copy->numberTicket = slot->record.numberTicket;
+        cursor->slot++;
+        return 1;
+    }
+    return 0;
+}
+
+size_t parseSize(const char *text) {
+    char *end;
+    size_t size;
+    
+    size = strtoull(text, &end, 10);
+    switch (toupper((unsigned char)*end)) {
+        case 'G':
+            size *= 1024;
+            /* fall through */
+        case 'M':
+            size *= 1024;
+            /* fall through */
+        case 'K':
+            size *= 1024;
+            break;
+    }
+    return size;
+}
+
+void checkTicket(user *userptr) {
+    reportTicket(userptr, currentUser, stdout);
+}
+
+void reportTicket(user *userptr, const char *username, FILE *out) {
+    char account[112];
+    ledgerAccount *found;
+    user copy;
+    
+    /* Traverse the linked list to locate details for the user */
+    userptr = findUser(userptr, username);
+    if (userptr == NULL) {
+        fprintf(out, "\nNo ticket booked!\n");
+        return;
+    }
+    snapshotUser(userptr, &copy);
+    
+    /* If no booking exists, inform the user */
+    if (!strcmp(copy.place, "\0") || copy.price == 0.0 || copy.numberTicket == 0) {
+        fprintf(out, "\nNo ticket booked!\n");
+        return;
+    }
+    
+    float total = copy.price * copy.numberTicket;
+    
+    fprintf(out, "\n%d ticket(s) booked for a total of Rs %.0f for destination %s.\n", 
+            copy.numberTicket, total, copy.place);
+    
+    /* Everything charged less everything refunded, straight from the running balance. */
+    snprintf(account, sizeof(account), "customer:%s", username);
+    syncLedger();
+    found = ledgerSlot(account, 0);
+    if (found != NULL)
+        fprintf(out, "Net amount charged to your account so far: Rs %.0f.\n", found->balance / 100.0);
+}
+
+user* addUser(user* userptr) {
+    user *tempptr = userptr;
+    char username[100], password[100];
+    
+    fflush(stdin);
+    printf("\nEnter new username: ");
+    scanf("%99s", username);
+    
+    /* Check for existing username to prevent duplicates */
+    if (findUser(userptr, username) != NULL) {
+        printf("\nError: Username already exists!\n");
+        delay(2.0);
+        return tempptr;
+    }
+    
+    fflush(stdin);
+    printf("\nEnter new password: ");
+    scanf(" %99[^\n]", password);
+    
+    if (registerUser(&tempptr, username, password, stdout))
+        system("PAUSE");
+    
+    return tempptr;
+}
+
+int registerUser(user **userptr, const char *username, const char *password, FILE *out) {
+    user *tempptr, *newptr;
+    
+    /* Another process may have registered the same name in the meantime. */
+    lockRecord(username);
+    tempptr = *userptr = refreshUsers(*userptr, NULL);
+    if (findUser(tempptr, username) != NULL) {
+        unlockRecord(username);
+        fprintf(out, "\nError: Username already exists!\n");
+        return 0;
+    }
+    
+    newptr = (user*)malloc(sizeof(user));
+    newptr->username = intern(username);
+    snprintf(newptr->password, sizeof(newptr->password), "%s", password);
+    newptr->next = NULL;
+    newptr->place = noPlace;   // No tour booked initially.
+    newptr->price = 0.0;
+    newptr->numberTicket = 0;
+    newptr->version = 0;
+    newptr->referenced = 1;
+    
+    if (tempptr == NULL)
+        tempptr = newptr;
+    else {
+        while (tempptr->next != NULL)
+            tempptr = tempptr->next;
+        tempptr->next = newptr;
+        tempptr = *userptr;
+    }
+    *userptr = persistUsers(tempptr, username, "ADD", NULL, 0);
+    unlockRecord(username);
+    
+    fprintf(out, "\nUser account created successfully!\n");
+    return 1;
+}
+
+user* login(user* userptr) {
+    session s;
+    
+    loginStart(&s, stdout);
+    runSession(&s, &userptr);
+    
+    if (s.record == NULL) {
+        delay(2.0);
+        return NULL;
+    }
+    
+    currentStatus = loggedIn;
+    strcpy(currentUser, s.username);
+    system("PAUSE");
+    return s.record;
+}
+
+void booking(user **userptr) {
+    session s;
+    
+    bookingStart(&s, *userptr, currentUser, NULL, stdout);
+    runSession(&s, userptr);
+}
+
+void cancellation(user **userptr) {
+    cancelBooking(userptr, currentUser, NULL, stdout);
+}
+
+void cancelBooking(user **userptr, const char *username, const char *requestKey, FILE *out) {
+    user *record;
+    const char *previous;
+    cancellationRequest cancelled;
+    char notice[200];
+    
+    /* A retried cancellation gets its original reply; nothing is refunded twice. */
+    previous = idempotencyLookup(username, requestKey);
+    if (previous != NULL) {
+        fputs(previous, out);
+        return;
+    }
+    
+    /* Hold this user's record lock and start from the latest stored state. */
+    lockRecord(username);
+    *userptr = refreshUsers(*userptr, NULL);
+    
+    /* Locate the current user in the linked list */
+    record = findUser(*userptr, username);
+    if (record == NULL) {
+        unlockRecord(username);
+        fprintf(out, "\nUser not found in the system!\n");
+        return;
+    }
+    
+    /* If a valid booking exists, reset tour details and inform user about the refund. */
+    if (!updateUser(record, applyCancellation, &cancelled)) {
+        unlockRecord(username);
+        fprintf(out, "\nNo tour has been booked to cancel!\n");
+        return;
+    }
+    
+    snprintf(notice, sizeof(notice), "Your booking for %s has been cancelled; Rs %.0f will be refunded.",
+             placeList[cancelled.placeIndex], cancelled.refund);
+    *userptr = persistUsers(*userptr, username, "CANCEL", notice, -cancelled.refund);
+    unlockRecord(username);
+    auditEvent(username, cancelled.placeIndex, -cancelled.tickets, -cancelled.refund);
+    postFromLog();
+    idempotencyStore(username, requestKey, cancelled.reply);
+    fputs(cancelled.reply, out);
+}
+
+void changePassword(user **userptr) {
+    session s;
+    
+    changePasswordStart(&s, currentUser, stdout);
+    runSession(&s, userptr);
+}
+
+void loginStart(session *s, FILE *out) {
+    memset(s, 0, sizeof(*s));
+    s->out = out;
+    s->step = stepLoginUsername;
+    fprintf(out, "\nEnter Username: ");
+}
+
+void bookingStart(session *s, user *userptr, const char *username, const char *requestKey, FILE *out) {
+    const char *previous;
+    user copy;
+    
+    memset(s, 0, sizeof(*s));
+    s->out = out;
+    s->step = stepDone;
+    strcpy(s->username, username);
+    if (requestKey != NULL && strlen(requestKey) < sizeof(s->requestKey))
+        strcpy(s->requestKey, requestKey);
+    
+    /* A retried booking gets its original reply instead of booking again. */
+    previous = idempotencyLookup(username, requestKey);
+    if (previous != NULL) {
+        fputs(previous, out);
+        return;
+    }
+    
+    /* Locate the logged-in user in the linked list */
+    userptr = findUser(userptr, username);
+    if (userptr == NULL)
+        return;
+    
+    /* Prevent multiple bookings for same user without cancellation */
+    snapshotUser(userptr, &copy);
+    if (copy.price != 0.0) {
+        fprintf(out, "\nYou already have an active booking. Please cancel your previous ticket before booking a new one!\n");
+        return;
+    }
+    
+    printCatalog(out);
+    fprintf(out, "\nEnter the tour code number: ");
+    s->step = stepBookingCode;
+}
+
+void changePasswordStart(session *s, const char *username, FILE *out) {
+    memset(s, 0, sizeof(*s));
+    s->out = out;
+    strcpy(s->username, username);
+    s->step = stepPasswordCurrent;
+    fprintf(out, "\nEnter your current password to continue: ");
+}
+
+int sessionResume(session *s, user **userptr, const char *input) {
+    user *record, copy;
+    bookingRequest booked;
+    passwordRequest change;
+    char notice[200];
+    int code, tickets;
+    
+    switch (s->step) {
+        case stepLoginUsername:
+            /* Usernames never contain blanks; keep only the first word. */
+            sscanf(input, "%99s", s->scratch);
+            fprintf(s->out, "\nEnter Password: ");
+            s->step = stepLoginPassword;
+            return 1;
+            
+        case stepLoginPassword:
+            s->step = stepDone;
+            record = findUser(*userptr, s->scratch);
+            if (record == NULL) {
+                fprintf(s->out, "\nUser not found! Please register first.\n");
+                return 0;
+            }
+            if (strcmp(record->password, input)) {
+                fprintf(s->out, "\nWrong Password! Access denied.\n");
+                return 0;
+            }
+            strcpy(s->username, s->scratch);
+            s->record = record;
+            fprintf(s->out, "\nLogin successful!\n");
+            return 0;
+            
+        case stepBookingCode:
+            snprintf(s->scratch, sizeof(s->scratch), "%s", input);
+            fprintf(s->out, "\nConfirm booking?\n1. Yes\n2. No\n");
+            fprintf(s->out, "\nEnter your choice: ");
+            s->step = stepBookingConfirm;
+            return 1;
+            
+        case stepBookingConfirm:
+            s->step = stepDone;
+            if (input[0] != '1')
+                return 0;
+            
+            /* Map the code number to the corresponding package in the catalog */
+            code = atoi(s->scratch);
+            if (code < 1 || code > PLACE_COUNT || strspn(s->scratch, "0123456789") != strlen(s->scratch)) {
+                fprintf(s->out, "\nInvalid tour code number entered!\n");
+                return 0;
+            }
+            fprintf(s->out, "\nEnter the number of tickets for booking: ");
+            s->step = stepBookingTickets;
+            return 1;
+            
+        case stepBookingTickets:
+            s->step = stepDone;
+            tickets = atoi(input);
+            
+            /* If number of tickets is not positive, abort booking */
+            if (tickets <= 0)
+                return 0;
+            
+            /* The record may have changed while the session was suspended. */
+            lockRecord(s->username);
+            *userptr = refreshUsers(*userptr, NULL);
+            record = findUser(*userptr, s->username);
+            if (record == NULL) {
+                unlockRecord(s->username);
+                return 0;
+            }
+            
+            booked.placeIndex = atoi(s->scratch) - 1;
+            booked.tickets = tickets;
+            if (!updateUser(record, applyBooking, &booked)) {
+                unlockRecord(s->username);
+                fprintf(s->out, "\nYou already have an active booking. Please cancel your previous ticket before booking a new one!\n");
+                return 0;
+            }
+            
+            snprintf(notice, sizeof(notice), "Your booking of %d ticket(s) to %s is confirmed; Rs %.0f has been charged.",
+                     booked.tickets, placeList[booked.placeIndex], priceList[booked.placeIndex] * booked.tickets);
+            *userptr = persistUsers(*userptr, s->username, "BOOK", notice, priceList[booked.placeIndex] * booked.tickets);
+            unlockRecord(s->username);
+            auditEvent(s->username, booked.placeIndex, booked.tickets, priceList[booked.placeIndex] * booked.tickets);
+            postFromLog();
+            idempotencyStore(s->username, s->requestKey, "\nBooking completed successfully!\n");
+            fprintf(s->out, "\nBooking completed successfully!\n");
+            return 0;
+            
+        case stepPasswordCurrent:
+            s->step = stepDone;
+            record = findUser(*userptr, s->username);
+            if (record == NULL)
+                return 0;
+            
+            /* Verify that the entered current password matches stored password. */
+            snapshotUser(record, &copy);
+            if (strcmp(input, copy.password)) {
+                fprintf(s->out, "\nIncorrect password provided. Password was not changed.\n");
+                return 0;
+            }
+            snprintf(s->scratch, sizeof(s->scratch), "%s", input);
+            fprintf(s->out, "\nEnter your new password: ");
+            s->step = stepPasswordNew;
+            return 1;
+            
+        case stepPasswordNew:
+            s->step = stepDone;
+            lockRecord(s->username);
+            *userptr = refreshUsers(*userptr, NULL);
+            record = findUser(*userptr, s->username);
+            if (record == NULL) {
+                unlockRecord(s->username);
+                return 0;
+            }
+            
+            /* Another session may have changed the password since it was verified. */
+            change.current = s->scratch;
+            change.replacement = input;
+            if (!updateUser(record, applyPasswordChange, &change)) {
+                unlockRecord(s->username);
+                fprintf(s->out, "\nIncorrect password provided. Password was not changed.\n");
+                return 0;
+            }
+            *userptr = persistUsers(*userptr, s->username, "PASSWD", NULL, 0);
+            unlockRecord(s->username);
+            fprintf(s->out, "\nPassword updated successfully!\n");
+            return 0;
+            
+        case stepDone:
+            break;
+    }
+    return 0;
+}
+
+int idempotencyName(char *buffer, const char *username, const char *requestKey) {
+    int length;
+    
+    if (requestKey == NULL || requestKey[0] == '\0' || strlen(requestKey) >= IDEMPOTENCY_KEY_SIZE)
+        return 0;
+    length = snprintf(buffer, NAME_SIZE + IDEMPOTENCY_KEY_SIZE, "%s/%s", username, requestKey);
+    return length > 0 && length < NAME_SIZE + IDEMPOTENCY_KEY_SIZE;
+}
+
+const char* idempotencyLookup(const char *username, const char *requestKey) {
+    char key[NAME_SIZE + IDEMPOTENCY_KEY_SIZE];
+    unsigned int slot, i;
+    idempotencyEntry *entry;
+    time_t now;
+    
+    if (!idempotencyName(key, username, requestKey))
+        return NULL;
+    
+    slot = checksum(key, strlen(key)) % IDEMPOTENCY_SLOTS;
+    now = time(NULL);
+    
+    for (i = 0; i < IDEMPOTENCY_PROBES; i++) {
+        entry = &idempotencyTable[(slot + i) % IDEMPOTENCY_SLOTS];
+        if (entry->expires > now && !strcmp(entry->key, key))
+            return entry->reply;
+    }
+    return NULL;
+}
+
+void idempotencyStore(const char *username, const char *requestKey, const char *reply) {
+    char key[NAME_SIZE + IDEMPOTENCY_KEY_SIZE];
+    unsigned int slot, i;
+    idempotencyEntry *entry, *victim = NULL;
+    time_t now;
+    
+    if (!idempotencyName(key, username, requestKey))
+        return;
+    
+    slot = checksum(key, strlen(key)) % IDEMPOTENCY_SLOTS;
+    now = time(NULL);
+    
+    /* Prefer the key's own slot, then a free or expired one, then the oldest live one. */
+    for (i = 0; i < IDEMPOTENCY_PROBES; i++) {
+        entry = &idempotencyTable[(slot + i) % IDEMPOTENCY_SLOTS];
+        if (!strcmp(entry->key, key)) {
+            victim = entry;
+            break;
+        }
+        if (entry->expires <= now) {
+            if (victim == NULL || victim->expires > now)
+                victim = entry;
+        } else if (victim == NULL || (victim->expires > now && entry->expires < victim->expires))
+            victim = entry;
+    }
+    
+    strcpy(victim->key, key);
+    victim->expires = now + IDEMPOTENCY_TTL;
+    snprintf(victim->reply, sizeof(victim->reply), "%s", reply);
+}
+
+void auditEvent(const char *username, int tour, int ticketDelta, float amount) {
+    struct timespec now;
+    auditRecord record;
+    unsigned int head;
+    int slot;
+    
+    pthread_once(&auditStarted, startAudit);
+    
+    clock_gettime(CLOCK_REALTIME, &now);
+    record.timestamp = (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+    record.userId = ringHash(username);
+    record.process = (unsigned int)getpid();
+    record.tour = (short)tour;
+    record.ticketDelta = (short)ticketDelta;
+    record.amount = amount;
+    
+    /* Without a flusher to empty it, a ring would only lose the record. */
+    if (!auditRunning || atomic_load(&auditStopping)) {
+        writeAuditRecord(&record);
+        return;
+    }
+    
+    /* A thread's first record gives it a ring of its own, while there are rings left. */
+    if (threadAudit == NULL) {
+        slot = atomic_fetch_add(&auditRingCount, 1);
+        if (slot >= AUDIT_RINGS) {
+            writeAuditRecord(&record);
+            return;
+        }
+        threadAudit = (auditRing*)calloc(1, sizeof(auditRing));
+        atomic_store(&auditRings[slot], threadAudit);
+    }
+    
+    /* Wait for the flusher in the unlikely case the ring is full. */
+    head = atomic_load_explicit(&threadAudit->head, memory_order_relaxed);
+    while (head - atomic_load_explicit(&threadAudit->tail, memory_order_acquire) >= AUDIT_RING_SIZE)
+        sched_yield();
+    
+    threadAudit->records[head & (AUDIT_RING_SIZE - 1)] = record;
+    atomic_store_explicit(&threadAudit->head, head + 1, memory_order_release);
+}
+
+void writeAuditRecord(const auditRecord *record) {
+    int fd;
+    
+    pthread_mutex_lock(&auditWriteLock);
+    if (!auditDirect) {
+        auditDirect = 1;
+        fprintf(stderr, "Warning: no audit ring is available; audit records are written directly.\n");
+    }
+    
+    /* One write per record keeps it whole beside the flusher's batches, as in LOG_FILE. */
+    fd = open(AUDIT_FILE, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0 || write(fd, record, sizeof(*record)) != (ssize_t)sizeof(*record))
+        fprintf(stderr, "Warning: an audit record could not be written.\n");
+    if (fd >= 0)
+        close(fd);
+    pthread_mutex_unlock(&auditWriteLock);
+}
+
+void startAudit(void) {
+    auditRunning = pthread_create(&auditFlusher, NULL, flushAudit, NULL) == 0;
+}
+
+void* flushAudit(void *argument) {
+    struct timespec pause = { 0, 50 * 1000000L };
+    int fd;
+    
+    (void)argument;
+    fd = open(AUDIT_FILE, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    for (;;) {
+        if (drainAudit(fd) > 0)
+            continue;
+        if (atomic_load(&auditStopping))
+            break;
+        nanosleep(&pause, NULL);
+    }
+    
+    /* Pick up anything queued while the last drain ran. */
+    drainAudit(fd);
+    if (fd >= 0)
+        close(fd);
+    return NULL;
+}
+
+size_t drainAudit(int fd) {
+    auditRecord batch[AUDIT_BATCH];
+    auditRing *ring;
+    unsigned int head, tail;
+    size_t written = 0, count;
+    int rings, i;
+    
+    rings = atomic_load(&auditRingCount);
+    if (rings > AUDIT_RINGS)
+        rings = AUDIT_RINGS;
+    for (i = 0; i < rings; i++) {
+        /* A ring being registered right now is picked up on the next pass. */
+        ring = atomic_load(&auditRings[i]);
+        if (ring == NULL)
+            continue;
+        
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        while (tail != head) {
+            for (count = 0; count < AUDIT_BATCH && tail != head; count++, tail++)
+                batch[count] = ring->records[tail & (AUDIT_RING_SIZE - 1)];
+            if (fd >= 0 && write(fd, batch, count * sizeof(auditRecord)) != (ssize_t)(count * sizeof(auditRecord)))
+                fprintf(stderr, "Warning: audit records could not be written.\n");
+            atomic_store_explicit(&ring->tail, tail, memory_order_release);
+            written += count;
+        }
+    }
+    return written;
+}
+
+void stopAudit(void) {
+    if (!auditRunning)
+        return;
+    atomic_store(&auditStopping, 1);
+    pthread_join(auditFlusher, NULL);
+    auditRunning = 0;
+}
+
+void postFromLog(void) {
+    /* Postings are made by one process at a time, after every transaction already in the ledger. */
+    lockByte(REFUND_LOCK, F_WRLCK);
+    postLogEntries();
+    lockByte(REFUND_LOCK, F_UNLCK);
+}
+
+int postLogEntries(void) {
+    char *buffer, *line, *end, *ledger = NULL, *refunds = NULL, operation[16], username[100], text[512];
+    struct stat info;
+    outboxCursor cursor;
+    unsigned long seq, settled, *queued = NULL;
+    long long timestamp, amount, length, scanned;
+    size_t ledgerLength, refundLength, capacity = 0, refundCapacity = 0, queuedCount = 0, queuedCapacity = 0, i;
+    int fd, log, consumed, saved = 1;
+    FILE *fp;
+    
+    syncLedger();
+    settled = settledRefunds();
+    
+    /* Refunds queued after the last posting in the ledger were queued by a call that did not finish. */
+    fp = fopen(REFUND_QUEUE, "r");
+    if (fp != NULL) {
+        while (fgets(text, sizeof(text), fp) != NULL) {
+            if (sscanf(text, "%*c %lu", &seq) != 1 || seq <= ledgerSeq)
+                continue;
+            if (queuedCount == queuedCapacity) {
+                queuedCapacity = queuedCapacity ? queuedCapacity * 2 : 16;
+                queued = (unsigned long*)realloc(queued, queuedCapacity * sizeof(unsigned long));
+            }
+            queued[queuedCount++] = seq;
+        }
+        fclose(fp);
+    }
+    
+    memset(&cursor, 0, sizeof(cursor));
+    fd = open(POSTING_CURSOR, O_RDONLY);
+    if (fd >= 0) {
+        if (read(fd, &cursor, sizeof(cursor)) != (ssize_t)sizeof(cursor))
+            memset(&cursor, 0, sizeof(cursor));
+        close(fd);
+    }
+    
+    log = open(LOG_FILE, O_RDONLY);
+    if (log < 0 || fstat(log, &info) != 0) {
+        if (log >= 0)
+            close(log);
+        free(queued);
+        return 0;
+    }
+    
+    /* A new log is scanned from its beginning; numbering keeps old postings from being repeated. */
+    if ((unsigned long long)info.st_ino != cursor.logInode || info.st_size < cursor.offset) {
+        cursor.logInode = info.st_ino;
+        cursor.offset = 0;
+    }
+    
+    buffer = (char*)malloc((1 << 20) + 1);
+    for (;;) {
+        length = info.st_size - cursor.offset;
+        if (length > 1 << 20)
+            length = 1 << 20;
+        if (length <= 0 || (length = pread(log, buffer, length, cursor.offset)) <= 0)
+            break;
+        buffer[length] = '\0';
+        
+        scanned = 0;
+        ledgerLength = refundLength = 0;
+        for (line = buffer; (end = strchr(line, '\n')) != NULL; line = end + 1) {
+            *end = '\0';
+            scanned += end - line + 1;
+            if (stripChecksum(line) < 0 || !parseLogHeader(line, &seq, &timestamp, operation, &consumed) ||
+                seq <= ledgerSeq || (strcmp(operation, "CHARGE") && strcmp(operation, "REFUND")) ||
+                sscanf(line + consumed, "%99s %lld", username, &amount) != 2)
+                continue;
+            
+            if (capacity - ledgerLength < 320) {
+                capacity = capacity ? capacity * 2 : 4096;
+                ledger = (char*)realloc(ledger, capacity);
+            }
+            ledgerLength += formatTransaction(ledger + ledgerLength, 320, seq, timestamp, username, amount,
+                                              !strcmp(operation, "REFUND"));
+            if (strcmp(operation, "REFUND"))
+                continue;
+            
+            /* Settled refunds may be gone from the queue; the mark keeps them from being paid again. */
+            for (i = 0; i < queuedCount && queued[i] != seq; i++)
+                ;
+            if (i < queuedCount || seq <= settled)
+                continue;
+            if (refundCapacity - refundLength < 256) {
+                refundCapacity = refundCapacity ? refundCapacity * 2 : 4096;
+                refunds = (char*)realloc(refunds, refundCapacity);
+            }
+            refundLength += snprintf(refunds + refundLength, 256, "P %lu %lld %s %lld %s %s\n", seq, timestamp,
+                                     username, amount, REFUND_CHANNEL, REFUND_CURRENCY);
+        }
+        if (scanned == 0)
+            break;
+        
+        if (refundLength > 0) {
+            fd = open(REFUND_QUEUE, O_WRONLY | O_APPEND | O_CREAT, 0644);
+            saved = fd >= 0 && write(fd, refunds, refundLength) == (ssize_t)refundLength && fdatasync(fd) == 0;
+            if (fd >= 0)
+                close(fd);
+            if (!saved) {
+                fprintf(stderr, "Warning: refunds could not be queued; they are retried on the next call.\n");
+                break;
+            }
+        }
+        
+        /* The cursor only moves once the postings are durably in the ledger. */
+        if (ledgerLength > 0) {
+            fd = open(LEDGER_FILE, O_WRONLY | O_APPEND | O_CREAT, 0644);
+            saved = fd >= 0 && write(fd, ledger, ledgerLength) == (ssize_t)ledgerLength && fdatasync(fd) == 0;
+            if (fd >= 0)
+                close(fd);
+            if (!saved) {
+                fprintf(stderr, "Warning: ledger postings could not be written; they are retried on the next call.\n");
+                break;
+            }
+            syncLedger();
+        }
+        cursor.offset += scanned;
+    }
+    free(buffer);
+    free(ledger);
+    free(refunds);
+    free(queued);
+    close(log);
+    
+    fd = open(POSTING_CURSOR ".tmp", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        if (write(fd, &cursor, sizeof(cursor)) == (ssize_t)sizeof(cursor))
+            rename(POSTING_CURSOR ".tmp", POSTING_CURSOR);
+        close(fd);
+    }
+    return saved ? 0 : -1;
+}
+
+unsigned long settledRefunds(void) {
+    unsigned long settled = 0;
+    FILE *fp;
+    
+    fp = fopen(REFUND_SETTLED, "r");
+    if (fp == NULL)
+        return 0;
+    if (fscanf(fp, "%lu", &settled) != 1)
+        settled = 0;
+    fclose(fp);
+    return settled;
+}
+
+int formatTransaction(char *entry, size_t size, unsigned long seq, long long timestamp, const char *username,
+                      long long amount, int refund) {
+    char customer[112];
+    
+    snprintf(customer, sizeof(customer), "customer:%s", username);
+    return snprintf(entry, size, "%lu %lld %s %s %lld\n", seq, timestamp,
+                    refund ? SALES_ACCOUNT : customer, refund ? customer : SALES_ACCOUNT, amount);
+}
+
+void syncLedger(void) {
+    struct stat info;
+    char *buffer, *line, *end;
+    long long length;
+    FILE *fp;
+    
+    fp = fopen(LEDGER_FILE, "r");
+    if (fp == NULL || fstat(fileno(fp), &info) != 0) {
+        if (fp != NULL)
+            fclose(fp);
+        return;
+    }
+    
+    /* A replaced or truncated ledger is posted again from the start. */
+    if (info.st_ino != ledgerInode || info.st_size < ledgerOffset) {
+        free(ledgerAccounts);
+        free(ledgerDays);
+        ledgerAccounts = NULL;
+        ledgerDays = NULL;
+        ledgerCapacity = ledgerUsed = 0;
+        ledgerDayCount = ledgerDayCapacity = 0;
+        ledgerOffset = 0;
+        ledgerSeq = 0;
+        ledgerInode = info.st_ino;
+    }
+    if (info.st_size == ledgerOffset) {
+        fclose(fp);
+        return;
+    }
+    
+    length = info.st_size - ledgerOffset;
+    buffer = (char*)malloc(length + 1);
+    fseek(fp, ledgerOffset, SEEK_SET);
+    length = fread(buffer, 1, length, fp);
+    buffer[length] = '\0';
+    fclose(fp);
+    
+    /* Post complete lines only; a line still being written is picked up next time. */
+    for (line = buffer; (end = strchr(line, '\n')) != NULL; line = end + 1) {
+        *end = '\0';
+        ledgerOffset += end - line + 1;
+        postLedgerLine(line);
+    }
+    free(buffer);
+}
+
+void postLedgerLine(char *line) {
+    char debit[112], credit[112];
+    unsigned long transaction;
+    long long timestamp, amount;
+    ledgerAccount *account;
+    struct tm date;
+    time_t moment;
+    
+    if (sscanf(line, "%lu %lld %111s %111s %lld", &transaction, &timestamp, debit, credit, &amount) != 5)
+        return;
+    if (transaction > ledgerSeq)
+        ledgerSeq = transaction;
+    
+    account = ledgerSlot(debit, 1);
+    account->balance += amount;
+    account = ledgerSlot(credit, 1);
+    account->balance -= amount;
+    
+    moment = (time_t)timestamp;
+    localtime_r(&moment, &date);
+    if (!strcmp(credit, SALES_ACCOUNT))
+        addLedgerDay((date.tm_year + 1900) * 10000 + (date.tm_mon + 1) * 100 + date.tm_mday, amount, 0);
+    else if (!strcmp(debit, SALES_ACCOUNT))
+        addLedgerDay((date.tm_year + 1900) * 10000 + (date.tm_mon + 1) * 100 + date.tm_mday, 0, amount);
+}
+
+ledgerAccount* ledgerSlot(const char *name, int create) {
+    ledgerAccount *old;
+    size_t i, slot, capacity;
+    
+    /* Keep the table at most half full; grow by rehashing into a table twice the size. */
+    if (create && 2 * (ledgerUsed + 1) > ledgerCapacity) {
+        old = ledgerAccounts;
+        capacity = ledgerCapacity;
+        ledgerCapacity = capacity ? capacity * 2 : 256;
+        ledgerAccounts = (ledgerAccount*)calloc(ledgerCapacity, sizeof(ledgerAccount));
+        for (i = 0; i < capacity; i++) {
+            if (old[i].name[0] == '\0')
+                continue;
+            slot = ringHash(old[i].name) & (ledgerCapacity - 1);
+            while (ledgerAccounts[slot].name[0] != '\0')
+                slot = (slot + 1) & (ledgerCapacity - 1);
+            ledgerAccounts[slot] = old[i];
+        }
+        free(old);
+    }
+    if (ledgerCapacity == 0)
+        return NULL;
+    
+    slot = ringHash(name) & (ledgerCapacity - 1);
+    while (ledgerAccounts[slot].name[0] != '\0') {
+        if (!strcmp(ledgerAccounts[slot].name, name))
+            return &ledgerAccounts[slot];
+        slot = (slot + 1) & (ledgerCapacity - 1);
+    }
+    if (!create)
+        return NULL;
+    
+    snprintf(ledgerAccounts[slot].name, sizeof(ledgerAccounts[slot].name), "%s", name);
+    ledgerAccounts[slot].balance = 0;
+    ledgerUsed++;
+    return &ledgerAccounts[slot];
+}
+
+void addLedgerDay(int day, long long charges, long long refunds) {
+    long before = ledgerDayBefore(day);
+    size_t i;
+    
+    /* Postings arrive in time order, so a new day is almost always appended at the end. */
+    if (before < 0 || ledgerDays[before].day != day) {
+        if (ledgerDayCount == ledgerDayCapacity) {
+            ledgerDayCapacity = ledgerDayCapacity ? ledgerDayCapacity * 2 : 64;
+            ledgerDays = (ledgerDay*)realloc(ledgerDays, ledgerDayCapacity * sizeof(ledgerDay));
+        }
+        memmove(&ledgerDays[before + 2], &ledgerDays[before + 1], (ledgerDayCount - before - 1) * sizeof(ledgerDay));
+        ledgerDays[before + 1].day = day;
+        ledgerDays[before + 1].charges = before >= 0 ? ledgerDays[before].charges : 0;
+        ledgerDays[before + 1].refunds = before >= 0 ? ledgerDays[before].refunds : 0;
+        ledgerDayCount++;
+        before++;
+    }
+    
+    for (i = before; i < ledgerDayCount; i++) {
+        ledgerDays[i].charges += charges;
+        ledgerDays[i].refunds += refunds;
+    }
+}
+
+long ledgerDayBefore(int day) {
+    long low = 0, high = (long)ledgerDayCount, mid;
+    
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (ledgerDays[mid].day <= day)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low - 1;
+}
+
+int showLedger(int argc, char **argv) {
+    char account[112];
+    ledgerAccount *found;
+    struct tm date;
+    long first, last;
+    long long charges, refunds;
+    int from, to;
+    
+    postFromLog();
+    
+    if (argc >= 2 && !strcmp(argv[0], "balance")) {
+        if (!strcmp(argv[1], SALES_ACCOUNT))
+            snprintf(account, sizeof(account), "%s", SALES_ACCOUNT);
+        else
+            snprintf(account, sizeof(account), "customer:%s", argv[1]);
+        found = ledgerSlot(account, 0);
+        printf("\nBalance of %s: Rs %.2f\n", account, found != NULL ? found->balance / 100.0 : 0.0);
+        return 0;
+    }
+    
+    if (argc >= 3 && !strcmp(argv[0], "period")) {
+        memset(&date, 0, sizeof(date));
+        if (strptime(argv[1], "%Y-%m-%d", &date) == NULL) {
+            printf("\nUnrecognized date \"%s\"; use YYYY-MM-DD.\n", argv[1]);
+            return 1;
+        }
+        from = (date.tm_year + 1900) * 10000 + (date.tm_mon + 1) * 100 + date.tm_mday;
+        memset(&date, 0, sizeof(date));
+        if (strptime(argv[2], "%Y-%m-%d", &date) == NULL) {
+            printf("\nUnrecognized date \"%s\"; use YYYY-MM-DD.\n", argv[2]);
+            return 1;
+        }
+        to = (date.tm_year + 1900) * 10000 + (date.tm_mon + 1) * 100 + date.tm_mday;
+        
+        /* Two lookups in the prefix sums give the totals of any period. */
+        first = ledgerDayBefore(from - 1);
+        last = ledgerDayBefore(to);
+        charges = last >= 0 ? ledgerDays[last].charges : 0;
+        refunds = last >= 0 ? ledgerDays[last].refunds : 0;
+        if (first >= 0 && last >= first) {
+            charges -= ledgerDays[first].charges;
+            refunds -= ledgerDays[first].refunds;
+        }
+        printf("\n%s to %s: charged Rs %.2f, refunded Rs %.2f, net Rs %.2f\n", argv[1], argv[2],
+               charges / 100.0, refunds / 100.0, (charges - refunds) / 100.0);
+        return 0;
+    }
+    
+    printf("\nUsage: --ledger balance <username|%s> | --ledger period <YYYY-MM-DD> <YYYY-MM-DD>\n", SALES_ACCOUNT);
+    return 1;
+}
+
+int processRefunds(void) {
+    refund *pending = NULL, *next;
+    size_t count = 0, capacity = 0, first, i, k, batches = 0;
+    long long offset = 0, total = 0;
+    unsigned long id, highest = 0;
+    char line[512], status;
+    time_t stamp = time(NULL);
+    int fd, mark, failed = 0;
+    FILE *fp;
+    
+    /* Cancellations wait while the queue is processed, so none is lost when it is emptied. */
+    lockByte(REFUND_LOCK, F_WRLCK);
+    if (postLogEntries() != 0) {
+        lockByte(REFUND_LOCK, F_UNLCK);
+        printf("\nLogged refunds could not all be queued and posted; nothing was settled.\n");
+        return 1;
+    }
+    fd = open(REFUND_QUEUE, O_RDWR);
+    if (fd < 0 || (fp = fdopen(dup(fd), "r")) == NULL) {
+        if (fd >= 0)
+            close(fd);
+        lockByte(REFUND_LOCK, F_UNLCK);
+        printf("\nNo refunds are pending.\n");
+        return 0;
+    }
+    
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            pending = (refund*)realloc(pending, capacity * sizeof(refund));
+        }
+        if (sscanf(line, "%*c %lu", &id) == 1 && id > highest)
+            highest = id;
+        next = &pending[count];
+        if (sscanf(line, "%c %lu %lld %99s %lld %15s %7s", &status, &next->id, &next->requested,
+                   next->username, &next->amount, next->channel, next->currency) == 7 && status == 'P') {
+            next->offset = offset;
+            count++;
+        }
+        offset += strlen(line);
+    }
+    fclose(fp);
+    
+    /* One export file per channel and currency. */
+    qsort(pending, count, sizeof(refund), compareRefunds);
+    mkdir(REFUND_DIR, 0755);
+    for (first = 0; first < count; first = i) {
+        for (i = first + 1; i < count; i++)
+            if (strcmp(pending[i].channel, pending[first].channel) ||
+                strcmp(pending[i].currency, pending[first].currency))
+                break;
+        if (exportRefunds(&pending[first], i - first, stamp) != 0) {
+            failed = 1;
+            continue;
+        }
+        
+        /* Only refunds whose export reached the disk are marked settled. */
+        for (k = first; k < i; k++) {
+            if (pwrite(fd, "S", 1, pending[k].offset) != 1)
+                failed = 1;
+            total += pending[k].amount;
+        }
+        batches++;
+    }
+    
+    /* Everything settled and posted: record how far, then start the queue afresh. */
+    if (fdatasync(fd) != 0)
+        failed = 1;
+    if (!failed && highest <= ledgerSeq && highest > settledRefunds()) {
+        mark = open(REFUND_SETTLED ".tmp", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        snprintf(line, sizeof(line), "%lu\n", highest);
+        if (mark < 0 || write(mark, line, strlen(line)) != (ssize_t)strlen(line) || fsync(mark) != 0 ||
+            rename(REFUND_SETTLED ".tmp", REFUND_SETTLED) != 0)
+            failed = 1;
+        if (mark >= 0)
+            close(mark);
+    }
+    if (!failed && highest <= ledgerSeq && ftruncate(fd, 0) == 0)
+        fdatasync(fd);
+    close(fd);
+    lockByte(REFUND_LOCK, F_UNLCK);
+    free(pending);
+    
+    printf("\nSettled Rs %.2f in %zu batch file(s) in %s/.\n", total / 100.0, batches, REFUND_DIR);
+    if (failed)
+        printf("Some refunds could not be exported; they stay pending for the next run.\n");
+    return failed;
+}
+
+int exportRefunds(const refund *batch, size_t count, time_t stamp) {
+    char path[128], temporary[136], when[32], buffer[65536];
+    struct tm date;
+    time_t moment;
+    size_t i;
+    int result = -1;
+    FILE *fp;
+    
+    localtime_r(&stamp, &date);
+    strftime(when, sizeof(when), "%Y%m%d-%H%M%S", &date);
+    snprintf(path, sizeof(path), "%s/%s-%s-%s-%lu.csv", REFUND_DIR, when, batch[0].channel, batch[0].currency, batch[0].id);
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+    
+    fp = fopen(temporary, "w");
+    if (fp == NULL)
+        return -1;
+    setvbuf(fp, buffer, _IOFBF, sizeof(buffer));
+    
+    /* Refund ids let the payment side drop a batch exported twice after a crash. */
+    fprintf(fp, "refund_id,username,amount,currency,requested_at\n");
+    for (i = 0; i < count; i++) {
+        moment = (time_t)batch[i].requested;
+        localtime_r(&moment, &date);
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &date);
+        fprintf(fp, "%lu,%s,%lld.%02lld,%s,%s\n", batch[i].id, batch[i].username,
+                batch[i].amount / 100, batch[i].amount % 100, batch[i].currency, when);
+    }
+    if (fflush(fp) == 0 && fsync(fileno(fp)) == 0)
+        result = 0;
+    if (fclose(fp) != 0)
+        result = -1;
+    if (result == 0 && rename(temporary, path) != 0)
+        result = -1;
+    return result;
+}
+
+int compareRefunds(const void *a, const void *b) {
+    const refund *left = (const refund*)a, *right = (const refund*)b;
+    int order;
+    
+    order = strcmp(left->channel, right->channel);
+    if (order == 0)
+        order = strcmp(left->currency, right->currency);
+    if (order == 0)
+        order = left->id < right->id ? -1 : left->id > right->id;
+    return order;
+}
+
+int runBackup(const char *directory) {
+    char path[512], temporary[520], tail[4096];
+    backupPosition position;
+    struct stat log;
+    long long end, start;
+    ssize_t length;
+    user *head = NULL, *next;
+    int fd, out;
+    
+    mkdir(directory, 0755);
+    fd = open(LOG_FILE, O_RDONLY);
+    if (fd < 0 || fstat(fd, &log) != 0) {
+        printf("\nNothing to back up: %s does not exist.\n", LOG_FILE);
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+    
+    /* Stop at the end of the last complete line; a line being appended waits for the next run. */
+    end = log.st_size;
+    while (end > 0) {
+        start = end > (long long)sizeof(tail) ? end - (long long)sizeof(tail) : 0;
+        length = pread(fd, tail, end - start, start);
+        if (length <= 0)
+            break;
+        while (length > 0 && tail[length - 1] != '\n')
+            length--;
+        if (length > 0) {
+            end = start + length;
+            break;
+        }
+        end = start;
+    }
+    
+    memset(&position, 0, sizeof(position));
+    snprintf(path, sizeof(path), "%s/backup.pos", directory);
+    out = open(path, O_RDONLY);
+    if (out >= 0) {
+        if (read(out, &position, sizeof(position)) != (ssize_t)sizeof(position))
+            memset(&position, 0, sizeof(position));
+        close(out);
+    }
+    
+    if (position.logInode != (unsigned long long)log.st_ino || position.offset > end) {
+        /* A new log (or a first backup) needs a base snapshot of the state at end. */
+        if (!loadCheckpoint(&head, &log))
+            logOffset = 0;
+        head = replayLog(head, logOffset, end);
+        snprintf(path, sizeof(path), "%s/base.chk", directory);
+        if (writeCheckpoint(head, path) != 0) {
+            printf("\nBackup failed: %s could not be written.\n", path);
+            close(fd);
+            return 1;
+        }
+        if (removeSegments(directory) != 0) {
+            printf("\nBackup failed: segments of the previous base could not be removed.\n");
+            close(fd);
+            return 1;
+        }
+        for (; head != NULL; head = next) {
+            next = head->next;
+            free(head);
+        }
+        position.logInode = log.st_ino;
+        position.baseOffset = position.offset = logOffset;
+        printf("\nBase snapshot written at log position %lld.\n", logOffset);
+    } else if (position.offset < end) {
+        snprintf(path, sizeof(path), "%s/segment-%llu-%012lld.log", directory, position.logInode, position.offset);
+        if (copyLogRange(fd, path, position.offset, end) != 0) {
+            printf("\nBackup failed: %s could not be written.\n", path);
+            close(fd);
+            return 1;
+        }
+        printf("\nSegment of %lld bytes written to %s.\n", end - position.offset, path);
+        position.offset = end;
+    } else
+        printf("\nBackup is already up to date.\n");
+    close(fd);
+    
+    /* Record the new position only once everything it covers is on disk. */
+    snprintf(path, sizeof(path), "%s/backup.pos", directory);
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+    out = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0 || write(out, &position, sizeof(position)) != (ssize_t)sizeof(position) ||
+        fsync(out) != 0 || rename(temporary, path) != 0) {
+        printf("Backup position could not be saved.\n");
+        if (out >= 0)
+            close(out);
+        return 1;
+    }
+    close(out);
+    return 0;
+}
+
+int removeSegments(const char *directory) {
+    char path[512];
+    struct dirent *entry;
+    int result = 0;
+    DIR *backup;
+    
+    backup = opendir(directory);
+    if (backup == NULL)
+        return -1;
+    while ((entry = readdir(backup)) != NULL) {
+        if (strncmp(entry->d_name, "segment-", 8) != 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        if (unlink(path) != 0)
+            result = -1;
+    }
+    closedir(backup);
+    return result;
+}
+
+int copyLogRange(int fd, const char *path, long long from, long long to) {
+    int out, result;
+    
+    out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+        return -1;
+    
+    result = copyRange(fd, out, from, to);
+    if (fsync(out) != 0)
+        result = -1;
+    if (close(out) != 0)
+        result = -1;
+    return result;
+}
+
+int copyRange(int in, int out, long long from, long long to) {
+    loff_t offset = from;
+    off_t sent;
+    ssize_t copied;
+    
+    /* copy_file_range() lets the kernel (or file system) move the bytes; fall back to sendfile(). */
+    while (offset < to) {
+        copied = copy_file_range(in, &offset, out, NULL, to - offset, 0);
+        if (copied > 0 || (copied < 0 && errno == EINTR))
+            continue;
+        break;
+    }
+    sent = offset;
+    while (sent < to) {
+        copied = sendfile(out, in, &sent, to - sent);
+        if (copied > 0 || (copied < 0 && errno == EINTR))
+            continue;
+        return -1;
+    }
+    return 0;
+}
+
+int verifyStore(void) {
+    char path[512];
+    unsigned long problems = 0;
+    struct dirent *entry;
+    DIR *history;
+    
+    problems += verifyFile("users.txt", 0);
+    problems += verifyFile(LOG_FILE, 1);
+    if (access("users.chk", F_OK) == 0)
+        problems += verifyCheckpoint("users.chk");
+    
+    history = opendir(HISTORY_DIR);
+    if (history != NULL) {
+        while ((entry = readdir(history)) != NULL) {
+            if (strstr(entry->d_name, ".chk") == NULL || strstr(entry->d_name, ".tmp") != NULL)
+                continue;
+            snprintf(path, sizeof(path), "%s/%s", HISTORY_DIR, entry->d_name);
+            problems += verifyCheckpoint(path);
+        }
+        closedir(history);
+    }
+    
+    if (access(LOG_FILE, F_OK) == 0)
+        problems += verifyView();
+    
+    printf("\n%s: %lu problem(s) found.\n", problems ? "FAILED" : "OK", problems);
+    return problems ? 1 : 0;
+}
+
+unsigned long verifyFile(const char *path, int log) {
+    verifyTask tasks[REPLAY_THREADS];
+    pthread_t threads[REPLAY_THREADS];
+    int started[REPLAY_THREADS];
+    unsigned long records = 0, problems = 0, lastSeq = 0;
+    const char *data, *cut;
+    size_t length, share, offset = 0;
+    struct stat info;
+    double start, elapsed;
+    char *mapped;
+    int fd, count, t;
+    
+    start = monotonicMs();
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+        if (fd >= 0)
+            close(fd);
+        printf("%s: missing or empty, skipped.\n", path);
+        return 0;
+    }
+    
+    /* Populating the mapping up front faults the pages in far fewer, larger steps. */
+    mapped = (char*)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        printf("%s: cannot be mapped.\n", path);
+        return 1;
+    }
+    
+    /* Split the file into one share per CPU, each ending on a line boundary. */
+    data = mapped;
+    length = info.st_size;
+    count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (count > REPLAY_THREADS)
+        count = REPLAY_THREADS;
+    if (count < 1 || length < 65536)
+        count = 1;
+    share = length / count;
+    for (t = 0; t < count; t++) {
+        memset(&tasks[t], 0, sizeof(tasks[t]));
+        tasks[t].path = path;
+        tasks[t].log = log;
+        tasks[t].data = data + offset;
+        tasks[t].base = offset;
+        if (t == count - 1 || offset + share >= length)
+            tasks[t].length = length - offset;
+        else {
+            cut = (const char*)memchr(data + offset + share, '\n', length - offset - share);
+            tasks[t].length = cut != NULL ? (size_t)(cut + 1 - (data + offset)) : length - offset;
+        }
+        offset += tasks[t].length;
+        if (offset > length)
+            offset = length;
+    }
+    
+    for (t = 1; t < count; t++)
+        started[t] = pthread_create(&threads[t], NULL, verifyLines, &tasks[t]) == 0;
+    verifyLines(&tasks[0]);
+    for (t = 1; t < count; t++) {
+        if (started[t])
+            pthread_join(threads[t], NULL);
+        else
+            verifyLines(&tasks[t]);
+    }
+    elapsed = monotonicMs() - start;
+    
+    for (t = 0; t < count; t++) {
+        records += tasks[t].records;
+        problems += tasks[t].problems;
+        fwrite(tasks[t].details, 1, tasks[t].detailsLength, stdout);
+        
+        /* Sequence numbers must also keep rising across the shares. */
+        if (log && tasks[t].firstSeq != 0) {
+            if (tasks[t].firstSeq <= lastSeq) {
+                printf("%s @%lld: sequence number %lu does not follow %lu\n", path, tasks[t].base,
+                       tasks[t].firstSeq, lastSeq);
+                problems++;
+            }
+            lastSeq = tasks[t].lastSeq;
+        }
+    }
+    if (length > 0 && data[length - 1] != '\n')
+        printf("%s: ends with an incomplete line (a write in progress or a torn write)\n", path);
+    munmap(mapped, info.st_size);
+    
+    printf("%s: %lu %s, %lu problem(s), %.1f MB scanned at %.0f MB/s with %d thread(s).\n", path, records,
+           log ? "entries" : "records", problems, length / 1e6, elapsed > 0 ? length / 1e3 / elapsed : 0.0, count);
+    return problems;
+}
+
+void* verifyLines(void *argument) {
+    verifyTask *task = (verifyTask*)argument;
+    const char *line = task->data, *end = task->data + task->length, *next, *problem;
+    char buffer[512], operation[16];
+    unsigned long seq, previous = 0;
+    long long timestamp;
+    int consumed;
+    user temp;
+    
+    for (; line < end; line = next + 1) {
+        next = (const char*)memchr(line, '\n', end - line);
+        if (next == NULL)
+            break;
+        task->records++;
+        problem = NULL;
+        
+        if (next - line >= (long)sizeof(buffer))
+            problem = "line too long";
+        else {
+            memcpy(buffer, line, next - line);
+            buffer[next - line] = '\0';
+            if (stripChecksum(buffer) < 0)
+                problem = "checksum mismatch";
+            else if (!task->log) {
+                if (!parseUserLine(buffer, &temp))
+                    problem = "malformed record";
+                else
+                    problem = checkRecord(&temp);
+            } else if (!parseLogHeader(buffer, &seq, &timestamp, operation, &consumed))
+                problem = "malformed entry";
+            else {
+                if (task->firstSeq == 0)
+                    task->firstSeq = seq;
+                task->lastSeq = seq;
+                if (seq <= previous)
+                    problem = "sequence number does not increase";
+                else if (carriesRecord(operation) && !parseUserLine(buffer + consumed, &temp))
+                    problem = "malformed entry";
+                else if (carriesRecord(operation) && strcmp(operation, "DROP"))
+                    problem = checkRecord(&temp);
+                previous = seq;
+            }
+        }
+        
+        if (problem == NULL)
+            continue;
+        task->problems++;
+        if (task->problems <= VERIFY_DETAILS)
+            task->detailsLength += snprintf(task->details + task->detailsLength,
+                                            sizeof(task->details) - task->detailsLength, "%s @%lld: %s\n",
+                                            task->path, task->base + (long long)(line - task->data), problem);
+    }
+    return NULL;
+}
+
+const char* checkRecord(const user *record) {
+    int place;
+    
+    if (record->username[0] == '\0' || record->password[0] == '\0')
+        return "empty username or password";
+    if (record->numberTicket < 0)
+        return "negative ticket count";
+    if (!strcmp(record->place, "N/A"))
+        return record->numberTicket == 0 && record->price == 0.0f ? NULL : "tickets or price without a destination";
+    
+    place = findPlace(record->place);
+    if (place < 0)
+        return "unknown destination";
+    if (record->numberTicket == 0)
+        return "booking without tickets";
+    if (record->price != priceList[place])
+        return "price does not match the catalog";
+    return NULL;
+}
+
+unsigned long verifyCheckpoint(const char *path) {
+    checkpointHeader header;
+    user *head = NULL, *next;
+    unsigned long problems = 0, count = 0;
+    const char *problem;
+    FILE *fp;
+    
+    fp = fopen(path, "rb");
+    if (fp == NULL)
+        return 0;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC))) {
+        fclose(fp);
+        printf("%s: not a checkpoint of this version\n", path);
+        return 1;
+    }
+    if (!readCheckpointRecords(fp, &header, &head)) {
+        fclose(fp);
+        printf("%s: checksum mismatch or truncated\n", path);
+        return 1;
+    }
+    fclose(fp);
+    
+    for (; head != NULL; head = next) {
+        next = head->next;
+        problem = checkRecord(head);
+        if (problem != NULL) {
+            if (++problems <= VERIFY_DETAILS)
+                printf("%s: record %lu (%s): %s\n", path, count, head->username, problem);
+        }
+        count++;
+        free(head);
+    }
+    printf("%s: %lu records, checksum valid, %lu problem(s).\n", path, count, problems);
+    return problems;
+}
+
+unsigned long verifyView(void) {
+    user *derived = NULL, *stored = NULL, *ptr, temp, **left, **right;
+    size_t leftCount = 0, rightCount = 0, i = 0, j = 0;
+    unsigned long differences = 0;
+    struct stat log;
+    char line[512];
+    int order;
+    FILE *fp;
+    
+    if (stat(LOG_FILE, &log) != 0)
+        return 0;
+    if (!loadCheckpoint(&derived, &log))
+        logOffset = 0;
+    derived = replayLog(derived, logOffset, -1);
+    
+    fp = fopen("users.txt", "r");
+    if (fp != NULL) {
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            if (!parseUserLine(line, &temp))
+                continue;
+            ptr = (user*)malloc(sizeof(user));
+            *ptr = temp;
+            ptr->username = intern(temp.username);
+            ptr->place = internPlace(temp.place);
+            ptr->next = stored;
+            stored = ptr;
+        }
+        fclose(fp);
+    }
+    
+    /* Sort both sides by username and walk them together. */
+    for (ptr = derived; ptr != NULL; ptr = ptr->next)
+        leftCount++;
+    for (ptr = stored; ptr != NULL; ptr = ptr->next)
+        rightCount++;
+    left = (user**)malloc((leftCount ? leftCount : 1) * sizeof(user*));
+    right = (user**)malloc((rightCount ? rightCount : 1) * sizeof(user*));
+    for (ptr = derived, i = 0; ptr != NULL; ptr = ptr->next)
+        left[i++] = ptr;
+    for (ptr = stored, i = 0; ptr != NULL; ptr = ptr->next)
+        right[i++] = ptr;
+    qsort(left, leftCount, sizeof(user*), compareUsernames);
+    qsort(right, rightCount, sizeof(user*), compareUsernames);
+    
+    for (i = 0, j = 0; i < leftCount || j < rightCount; ) {
+        if (i == leftCount)
+            order = 1;
+        else if (j == rightCount)
+            order = -1;
+        else
+            order = strcmp(left[i]->username, right[j]->username);
+        
+        if (order == 0 && (strcmp(left[i]->password, right[j]->password) || strcmp(left[i]->place, right[j]->place) ||
+                           left[i]->price != right[j]->price || left[i]->numberTicket != right[j]->numberTicket)) {
+            if (++differences <= VERIFY_DETAILS)
+                printf("users.txt: %s differs from the log\n", left[i]->username);
+        } else if (order < 0) {
+            if (++differences <= VERIFY_DETAILS)
+                printf("users.txt: %s is missing\n", left[i]->username);
+        } else if (order > 0) {
+            if (++differences <= VERIFY_DETAILS)
+                printf("users.txt: %s is not in the log\n", right[j]->username);
+        } else if (j > 0 && !strcmp(right[j]->username, right[j - 1]->username)) {
+            if (++differences <= VERIFY_DETAILS)
+                printf("users.txt: %s is stored twice\n", right[j]->username);
+        }
+        if (order <= 0)
+            i++;
+        if (order >= 0)
+            j++;
+    }
+    printf("users.txt: %zu accounts compared with the log, %lu difference(s).\n", leftCount, differences);
+    
+    for (i = 0; i < leftCount; i++)
+        free(left[i]);
+    for (j = 0; j < rightCount; j++)
+        free(right[j]);
+    free(left);
+    free(right);
+    return differences;
+}
+
+int compareUsernames(const void *a, const void *b) {
+    return strcmp((*(user* const*)a)->username, (*(user* const*)b)->username);
+}
+
+int compareNames(const void *a, const void *b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+int compareSegments(const void *a, const void *b) {
+    const backupSegment *left = (const backupSegment*)a, *right = (const backupSegment*)b;
+    
+    if (left->offset != right->offset)
+        return left->offset < right->offset ? -1 : 1;
+    return left->legacy - right->legacy;
+}
+
+int restoreBackup(const char *directory) {
+    char path[512];
+    backupSegment *segments = NULL, *segment;
+    checkpointHeader header;
+    struct dirent *entry;
+    struct stat info;
+    size_t count = 0, capacity = 0, skipped = 0, i;
+    long long expected;
+    user *head = NULL, *next;
+    int fd, in, failed = 0;
+    DIR *backup;
+    FILE *fp;
+    
+    if (access("users.txt", F_OK) == 0 || access(LOG_FILE, F_OK) == 0) {
+        printf("\nRefusing to restore over an existing store; move users.txt and %s away first.\n", LOG_FILE);
+        return 1;
+    }
+    
+    snprintf(path, sizeof(path), "%s/base.chk", directory);
+    fp = fopen(path, "rb");
+    if (fp == NULL || fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) || !readCheckpointRecords(fp, &header, &head)) {
+        if (fp != NULL)
+            fclose(fp);
+        printf("\n%s is missing or damaged.\n", path);
+        return 1;
+    }
+    fclose(fp);
+    
+    /* Segment names carry the log they came from and their offset in it (older backups only the offset). */
+    backup = opendir(directory);
+    while (backup != NULL && (entry = readdir(backup)) != NULL) {
+        if (strncmp(entry->d_name, "segment-", 8) != 0 || strlen(entry->d_name) >= sizeof(segments[0].name))
+            continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            segments = (backupSegment*)realloc(segments, capacity * sizeof(backupSegment));
+        }
+        segment = &segments[count];
+        strcpy(segment->name, entry->d_name);
+        segment->legacy = sscanf(entry->d_name, "segment-%llu-%lld.log", &segment->logInode, &segment->offset) != 2;
+        if (segment->legacy) {
+            segment->logInode = header.logInode;
+            if (sscanf(entry->d_name, "segment-%lld.log", &segment->offset) != 1)
+                continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        if (stat(path, &info) != 0)
+            continue;
+        segment->size = info.st_size;
+        count++;
+    }
+    if (backup != NULL)
+        closedir(backup);
+    qsort(segments, count, sizeof(backupSegment), compareSegments);
+    
+    /* The segments that continue the base, back to back, are the new log. */
+    fd = open(LOG_FILE, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        printf("\n%s could not be created.\n", LOG_FILE);
+        free(segments);
+        return 1;
+    }
+    expected = header.logOffset;
+    for (i = 0; i < count; i++) {
+        if (segments[i].logInode != header.logInode || segments[i].offset != expected) {
+            skipped++;
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", directory, segments[i].name);
+        in = open(path, O_RDONLY);
+        if (in < 0 || copyRange(in, fd, 0, segments[i].size) != 0)
+            failed = 1;
+        if (in >= 0)
+            close(in);
+        expected += segments[i].size;
+    }
+    free(segments);
+    if (skipped > 0)
+        printf("\nSkipped %zu segment(s) that do not continue %s/base.chk.\n", skipped, directory);
+    if (fsync(fd) != 0)
+        failed = 1;
+    close(fd);
+    if (failed) {
+        printf("\nA segment could not be copied; the restore is incomplete.\n");
+        return 1;
+    }
+    
+    /* Replay the restored log on top of the base snapshot, then write the materialized view. */
+    logSeq = header.logSeq;
+    head = replayLog(head, 0, -1);
+    filing(head);
+    syncStore();
+    writeCheckpoint(head, "users.chk");
+    for (count = 0; head != NULL; head = next, count++) {
+        next = head->next;
+        free(head);
+    }
+    printf("\nRestored %zu account(s) up to log entry %lu.\n", count, logSeq);
+    return 0;
+}
+
+int importUsers(const char *path) {
+    importTask tasks[REPLAY_THREADS];
+    pthread_t threads[REPLAY_THREADS];
+    int started[REPLAY_THREADS];
+    importRow **rows;
+    const char **existing, *data, *cut;
+    user *userptr, *first = NULL, *last = NULL, *ptr, copy;
+    userCursor cursor;
+    size_t length, share, offset = 0, total = 0, known = 0, capacity = 1024, fresh = 0, i, k = 0;
+    unsigned long problems = 0, duplicates = 0, booked = 0, before;
+    struct stat info;
+    double start;
+    char *mapped;
+    int fd, count, t, order, failed;
+    
+    start = monotonicMs();
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+        if (fd >= 0)
+            close(fd);
+        printf("\n%s: missing or empty.\n", path);
+        return 1;
+    }
+    mapped = (char*)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        printf("\n%s: cannot be mapped.\n", path);
+        return 1;
+    }
+    
+    /* Parse one share per CPU, each ending on a line boundary, as verifyFile() does. */
+    data = mapped;
+    length = info.st_size;
+    count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (count > REPLAY_THREADS)
+        count = REPLAY_THREADS;
+    if (count < 1 || length < 65536)
+        count = 1;
+    share = length / count;
+    for (t = 0; t < count; t++) {
+        memset(&tasks[t], 0, sizeof(tasks[t]));
+        tasks[t].path = path;
+        tasks[t].data = data + offset;
+        tasks[t].base = offset;
+        if (t == count - 1 || offset + share >= length)
+            tasks[t].length = length - offset;
+        else {
+            cut = (const char*)memchr(data + offset + share, '\n', length - offset - share);
+            tasks[t].length = cut != NULL ? (size_t)(cut + 1 - (data + offset)) : length - offset;
+        }
+        offset += tasks[t].length;
+        if (offset > length)
+            offset = length;
+    }
+    
+    for (t = 1; t < count; t++)
+        started[t] = pthread_create(&threads[t], NULL, parseImportLines, &tasks[t]) == 0;
+    parseImportLines(&tasks[0]);
+    for (t = 1; t < count; t++) {
+        if (started[t])
+            pthread_join(threads[t], NULL);
+        else
+            parseImportLines(&tasks[t]);
+    }
+    munmap(mapped, info.st_size);
+    
+    for (t = 0; t < count; t++) {
+        total += tasks[t].count;
+        problems += tasks[t].problems;
+        fwrite(tasks[t].details, 1, tasks[t].detailsLength, stdout);
+    }
+    
+    /* Sorting brings duplicates together; the earliest row of each name is kept. */
+    rows = (importRow**)malloc((total ? total : 1) * sizeof(importRow*));
+    for (t = 0, i = 0; t < count; t++)
+        for (k = 0; k < tasks[t].count; k++)
+            rows[i++] = &tasks[t].rows[k];
+    qsort(rows, total, sizeof(importRow*), compareImportRows);
+    
+    /* Everything from here on is one commit under the store lock, taken after the record locks as elsewhere. */
+    lockImportRecords(rows, total, F_WRLCK);
+    userptr = initializeUser(NULL);
+    lockByte(0, F_WRLCK);
+    userptr = refreshUsers(userptr, NULL);
+    
+    existing = (const char**)malloc(capacity * sizeof(const char*));
+    startUsers(&cursor, userptr);
+    while (nextUser(&cursor, &copy)) {
+        if (known == capacity) {
+            capacity *= 2;
+            existing = (const char**)realloc(existing, capacity * sizeof(const char*));
+        }
+        existing[known++] = intern(copy.username);
+    }
+    qsort(existing, known, sizeof(const char*), compareNames);
+    
+    /* Walk the sorted rows and the sorted store together. */
+    for (i = 0, k = 0; i < total; i++) {
+        if (i > 0 && !strcmp(rows[i]->username, rows[i - 1]->username)) {
+            if (++duplicates <= VERIFY_DETAILS)
+                printf("%s @%lld: %s is listed more than once\n", path, rows[i]->offset, rows[i]->username);
+            continue;
+        }
+        order = 1;
+        while (k < known && (order = strcmp(existing[k], rows[i]->username)) < 0)
+            k++;
+        if (order == 0) {
+            if (++duplicates <= VERIFY_DETAILS)
+                printf("%s @%lld: %s already has an account\n", path, rows[i]->offset, rows[i]->username);
+            continue;
+        }
+        
+        ptr = (user*)malloc(sizeof(user));
+        ptr->username = intern(rows[i]->username);
+        strcpy(ptr->password, rows[i]->password);
+        ptr->place = rows[i]->placeIndex >= 0 ? placeList[rows[i]->placeIndex] : noPlace;
+        ptr->price = rows[i]->placeIndex >= 0 ? priceList[rows[i]->placeIndex] : 0.0f;
+        ptr->numberTicket = rows[i]->tickets;
+        ptr->version = 0;
+        ptr->referenced = 0;
+        ptr->next = NULL;
+        if (first == NULL)
+            first = ptr;
+        else
+            last->next = ptr;
+        last = ptr;
+        fresh++;
+    }
+    free(existing);
+    
+    /* One log write and one rewrite of the store for the whole file. */
+    before = logSeq;
+    failed = appendLogBatch("IMPORT", first, 1) != 0;
+    if (!failed) {
+        if (userptr == NULL)
+            userptr = first;
+        else {
+            for (ptr = userptr; ptr->next != NULL; ptr = ptr->next)
+                ;
+            ptr->next = first;
+        }
+        lockByte(STORE_LOCK, F_WRLCK);
+        filing(userptr);
+        if (stat("users.txt", &info) == 0)
+            stampStore(&info);
+        lockByte(STORE_LOCK, F_UNLCK);
+        snapshotHistory(userptr, before);
+        if (syncStore() != 0)
+            fprintf(stderr, "Warning: users.txt could not be forced to disk.\n");
+    }
+    lockByte(0, F_UNLCK);
+    lockImportRecords(rows, total, F_UNLCK);
+    
+    /* Imported bookings are charged like any other, from the CHARGE entries logged with them. */
+    if (fresh > 0 && !failed) {
+        for (ptr = first; ptr != NULL; ptr = ptr->next) {
+            if (ptr->numberTicket == 0)
+                continue;
+            auditEvent(ptr->username, findPlace(ptr->place), ptr->numberTicket, ptr->price * ptr->numberTicket);
+            booked++;
+        }
+        postFromLog();
+        stopAudit();
+    }
+    
+    if (failed)
+        printf("\nImport failed: the log could not be written; nothing was imported.\n");
+    else
+        printf("\nImported %zu account(s), %lu with a booking, in %.0f ms; %lu duplicate(s) and %lu invalid row(s) skipped.\n",
+               fresh, booked, monotonicMs() - start, duplicates, problems);
+    
+    if (failed)
+        for (ptr = first; ptr != NULL; ptr = first) {
+            first = ptr->next;
+            free(ptr);
+        }
+    for (ptr = userptr; ptr != NULL; ptr = userptr) {
+        userptr = ptr->next;
+        free(ptr);
+    }
+    for (t = 0; t < count; t++)
+        free(tasks[t].rows);
+    free(rows);
+    return failed || duplicates > 0 || problems > 0;
+}
+
+void* parseImportLines(void *argument) {
+    importTask *task = (importTask*)argument;
+    const char *line = task->data, *end = task->data + task->length, *next, *problem;
+    char buffer[512], *fields[5];
+    importRow row;
+    int count;
+    
+    for (; line < end; line = next + 1) {
+        next = (const char*)memchr(line, '\n', end - line);
+        if (next == NULL)
+            next = end;
+        problem = NULL;
+        
+        if (next - line >= (long)sizeof(buffer))
+            problem = "line too long";
+        else {
+            memcpy(buffer, line, next - line);
+            buffer[next - line] = '\0';
+            if (next > line && buffer[next - line - 1] == '\r')
+                buffer[next - line - 1] = '\0';
+            
+            /* Blank lines and a header row are not accounts. */
+            count = splitCsv(buffer, fields, 5);
+            if (count == 1 && fields[0][0] == '\0')
+                continue;
+            if (task->base == 0 && line == task->data && !strcmp(fields[0], "username"))
+                continue;
+            problem = parseImportRow(fields, count, &row);
+        }
+        
+        if (problem == NULL) {
+            if (task->count == task->capacity) {
+                task->capacity = task->capacity ? task->capacity * 2 : 1024;
+                task->rows = (importRow*)realloc(task->rows, task->capacity * sizeof(importRow));
+            }
+            row.offset = task->base + (long long)(line - task->data);
+            task->rows[task->count++] = row;
+            continue;
+        }
+        task->problems++;
+        if (task->problems <= VERIFY_DETAILS)
+            task->detailsLength += snprintf(task->details + task->detailsLength,
+                                            sizeof(task->details) - task->detailsLength, "%s @%lld: %s\n",
+                                            task->path, task->base + (long long)(line - task->data), problem);
+    }
+    return NULL;
+}
+
+const char* parseImportRow(char **fields, int count, importRow *row) {
+    char *end;
+    long tickets = 0;
+    int i;
+    
+    if (count < 2 || count > 4)
+        return "expected username,password[,destination,tickets]";
+    
+    /* The store separates fields with blanks, so a username cannot contain any. */
+    if (fields[0][0] == '\0' || strlen(fields[0]) >= sizeof(row->username))
+        return "username is empty or too long";
+    for (i = 0; fields[0][i] != '\0'; i++)
+        if (isspace((unsigned char)fields[0][i]))
+            return "username contains blanks";
+    if (fields[1][0] == '\0' || strlen(fields[1]) >= sizeof(row->password))
+        return "password is empty or too long";
+    strcpy(row->username, fields[0]);
+    strcpy(row->password, fields[1]);
+    
+    row->placeIndex = -1;
+    row->tickets = 0;
+    if (count >= 3 && fields[2][0] != '\0') {
+        /* A destination is a catalog name or its tour code. */
+        row->placeIndex = findPlace(fields[2]);
+        if (row->placeIndex < 0) {
+            i = (int)strtol(fields[2], &end, 10);
+            if (*end != '\0' || i < 1 || i > PLACE_COUNT)
+                return "destination is not in the catalog";
+            row->placeIndex = i - 1;
+        }
+    }
+    if (count == 4 && fields[3][0] != '\0') {
+        tickets = strtol(fields[3], &end, 10);
+        if (*end != '\0' || tickets < 0 || tickets > 10000)
+            return "ticket count is not a number of tickets";
+    }
+    if (row->placeIndex >= 0 && tickets == 0)
+        return "booking without tickets";
+    if (row->placeIndex < 0 && tickets != 0)
+        return "tickets without a destination";
+    row->tickets = (int)tickets;
+    return NULL;
+}
+
+int splitCsv(char *line, char **fields, int max) {
+    char *read = line, *write = line;
+    int count = 0;
+    
+    while (count < max) {
+        fields[count++] = write;
+        
+        /* A quoted field may hold commas; a doubled quote stands for one. */
+        if (*read == '"') {
+            for (read++; *read != '\0'; read++) {
+                if (*read == '"' && read[1] != '"') {
+                    read++;
+                    break;
+                }
+                if (*read == '"')
+                    read++;
+                *write++ = *read;
+            }
+        }
+        while (*read != '\0' && *read != ',')
+            *write++ = *read++;
+        if (*read == '\0') {
+            *write = '\0';
+            return count;
+        }
+        read++;
+        *write++ = '\0';
+    }
+    return max + 1;
+}
+
+int compareImportRows(const void *a, const void *b) {
+    const importRow *left = *(importRow* const*)a, *right = *(importRow* const*)b;
+    int order;
+    
+    order = strcmp(left->username, right->username);
+    if (order != 0)
+        return order;
+    return left->offset < right->offset ? -1 : left->offset > right->offset;
+}
+
+void lockImportRecords(importRow **rows, size_t count, short type) {
+    unsigned char *slots;
+    size_t i, run, slot;
+    
+    if (type == F_UNLCK) {
+        lockBytes(1, RECORD_LOCK_SLOTS, F_UNLCK);
+        return;
+    }
+    
+    slots = (unsigned char*)calloc(RECORD_LOCK_SLOTS / 8, 1);
+    for (i = 0; i < count; i++) {
+        slot = checksum(rows[i]->username, strlen(rows[i]->username)) % RECORD_LOCK_SLOTS;
+        slots[slot / 8] |= 1 << (slot % 8);
+    }
+    
+    /* Ascending order keeps two imports, or an import and a single record, from deadlocking. */
+    for (i = 0; i < RECORD_LOCK_SLOTS; i = run) {
+        for (run = i; run < RECORD_LOCK_SLOTS && (slots[run / 8] & (1 << (run % 8))); run++)
+            ;
+        if (run > i)
+            lockBytes(1 + i, run - i, F_WRLCK);
+        else
+            run++;
+    }
+    free(slots);
+}
+
+int exportUsers(const char *path, const char *format) {
+    static const char *names[] = {"CSV", "JSON Lines", "columnar"};
+    exportState state;
+    const char *suffix;
+    double start;
+    int fd, failed = 0;
+    
+    memset(&state, 0, sizeof(state));
+    suffix = strrchr(path, '.');
+    if (format == NULL)
+        format = suffix == NULL ? "csv" : !strcmp(suffix, ".jsonl") || !strcmp(suffix, ".json") ? "jsonl"
+                                        : !strcmp(suffix, ".tmscol") ? "columnar" : "csv";
+    if (!strcmp(format, "jsonl") || !strcmp(format, "json"))
+        state.kind = exportJsonl;
+    else if (!strcmp(format, "columnar"))
+        state.kind = exportColumnar;
+    else if (strcmp(format, "csv") != 0) {
+        printf("\nUnknown export format %s; use csv, jsonl or columnar.\n", format);
+        return 1;
+    }
+    
+    /* Writers replace the store under the store lock; opening it under the lock pins one version. */
+    start = monotonicMs();
+    lockByte(0, F_RDLCK);
+    fd = open("users.txt", O_RDONLY);
+    lockByte(0, F_UNLCK);
+    if (fd < 0) {
+        printf("\nusers.txt: cannot be opened.\n");
+        return 1;
+    }
+    state.target = strcmp(path, "-") ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
+    if (state.target < 0) {
+        close(fd);
+        printf("\n%s: cannot be created.\n", path);
+        return 1;
+    }
+    
+    state.output = (char*)malloc(EXPORT_BUFFER);
+    state.out = state.output;
+    if (state.kind == exportCsv)
+        state.out += sprintf(state.out, "username,destination,tour,price,tickets,amount\n");
+    if (state.kind == exportColumnar) {
+        state.group = (columnGroup*)calloc(1, sizeof(columnGroup));
+        state.group->encoded = (unsigned char*)malloc(COLUMN_GROUP * (NAME_SIZE + 24) + COLUMN_DICTIONARY * (NAME_SIZE + 2) + 256);
+        failed = writeAll(state.target, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC)) != 0;
+        state.group->position = sizeof(COLUMNAR_MAGIC);
+    }
+    
+    if (!failed)
+        failed = streamLines(fd, exportLine, &state) != 0;
+    if (!failed)
+        failed = (state.group != NULL ? finishColumns(state.group, state.target)
+                                      : writeAll(state.target, state.output, state.out - state.output)) != 0;
+    
+    close(fd);
+    if (state.target != STDOUT_FILENO && close(state.target) != 0)
+        failed = 1;
+    free(state.output);
+    if (state.group != NULL) {
+        free(state.group->encoded);
+        free(state.group->offsets);
+        free(state.group);
+    }
+    
+    if (failed) {
+        fprintf(stderr, "\n%s: export failed: %s\n", path, strerror(errno));
+        return 1;
+    }
+    fprintf(stderr, "\nExported %lu account(s) as %s in %.0f ms", state.rows, names[state.kind], monotonicMs() - start);
+    if (state.skipped > 0)
+        fprintf(stderr, "; %lu unreadable line(s) skipped", state.skipped);
+    fprintf(stderr, ".\n");
+    return 0;
+}
+
+int migrateStore(int dryRun) {
+    migrationState state;
+    struct stat info;
+    user *ptr;
+    double start;
+    int fd, failed = 0;
+    
+    memset(&state, 0, sizeof(state));
+    state.dryRun = dryRun;
+    state.target = -1;
+    start = monotonicMs();
+    
+    /* Nothing may change the store while it is rewritten, nor write it from the log. */
+    lockByte(0, dryRun ? F_RDLCK : F_WRLCK);
+    lockByte(STORE_LOCK, dryRun ? F_RDLCK : F_WRLCK);
+    fd = open("users.txt", O_RDONLY);
+    if (fd < 0) {
+        lockByte(STORE_LOCK, F_UNLCK);
+        lockByte(0, F_UNLCK);
+        printf("\nusers.txt: cannot be opened.\n");
+        return 1;
+    }
+    if (!dryRun) {
+        state.target = open("users.txt.tmp", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (state.target < 0) {
+            close(fd);
+            lockByte(STORE_LOCK, F_UNLCK);
+            lockByte(0, F_UNLCK);
+            printf("\nusers.txt.tmp: cannot be created.\n");
+            return 1;
+        }
+        state.output = (char*)malloc(EXPORT_BUFFER);
+        state.out = state.output;
+    }
+    
+    failed = streamLines(fd, migrateLine, &state) != 0;
+    close(fd);
+    if (!dryRun) {
+        if (!failed)
+            failed = writeAll(state.target, state.output, state.out - state.output) != 0 || fsync(state.target) != 0;
+        if (close(state.target) != 0)
+            failed = 1;
+        free(state.output);
+        
+        /* The store is replaced only if every line made it across; repairs are logged first, as changes are. */
+        if (!failed && state.unreadable == 0 && state.first != NULL && stat(LOG_FILE, &info) == 0 && info.st_size > 0) {
+            openLogTail();
+            failed = appendLogBatch("MIGRATE", state.first, 0) != 0;
+        }
+        if (!failed && state.unreadable == 0) {
+            failed = rename("users.txt.tmp", "users.txt") != 0;
+            if (!failed && syncStore() != 0)
+                fprintf(stderr, "Warning: users.txt could not be forced to disk.\n");
+            
+            /* The restart checkpoint describes the store as it was; the next start writes a new one. */
+            if (!failed)
+                unlink("users.chk");
+        } else
+            unlink("users.txt.tmp");
+    }
+    lockByte(STORE_LOCK, F_UNLCK);
+    lockByte(0, F_UNLCK);
+    
+    for (ptr = state.first; ptr != NULL; ptr = state.first) {
+        state.first = ptr->next;
+        free(ptr);
+    }
+    
+    printf("\n%lu line(s) read in %.0f ms, %lu already sealed: %lu destination(s) repaired, "
+           "%lu anomalous record(s) kept as they are, %lu unreadable line(s).\n",
+           state.lines, monotonicMs() - start, state.sealed, state.repaired, state.anomalies, state.unreadable);
+    if (dryRun)
+        printf("Dry run: nothing was written.\n");
+    else if (failed)
+        printf("Migration failed: users.txt could not be rewritten; nothing was changed.\n");
+    else if (state.unreadable > 0)
+        printf("Nothing was changed: fix or remove the unreadable lines first.\n");
+    else
+        printf("users.txt rewritten with every line sealed.\n");
+    return failed || state.unreadable > 0;
+}
+
+int migrateLine(char *line, void *context) {
+    migrationState *state = (migrationState*)context;
+    char original[512], entry[512];
+    user record, *repaired;
+    const char *problem;
+    int sealed;
+    
+    state->lines++;
+    snprintf(original, sizeof(original), "%s", line);
+    sealed = stripChecksum(line);
+    if (sealed < 0 || !parseUserLine(line, &record)) {
+        state->unreadable++;
+        if (state->described++ < MIGRATE_DETAILS)
+            printf("users.txt:%lu: %s: %s\n", state->lines, sealed < 0 ? "checksum mismatch" : "not a record", original);
+        return 0;
+    }
+    state->sealed += sealed;
+    
+    /* A legacy destination split differently from the catalog is put back together. */
+    if (strcmp(record.place, noPlace) != 0 && findPlace(record.place) < 0 && repairPlace(&record) >= 0) {
+        state->repaired++;
+        if (state->described++ < MIGRATE_DETAILS)
+            printf("users.txt:%lu: %s: destination read as \"%s\"\n", state->lines, record.username, record.place);
+        if (!state->dryRun) {
+            repaired = (user*)malloc(sizeof(user));
+            *repaired = record;
+            repaired->username = intern(record.username);
+            repaired->version = 0;
+            repaired->referenced = 0;
+            repaired->next = NULL;
+            if (state->first == NULL)
+                state->first = repaired;
+            else
+                state->last->next = repaired;
+            state->last = repaired;
+        }
+    }
+    
+    /* Anything else wrong is reported, as --verify would, but not guessed at. */
+    problem = checkRecord(&record);
+    if (problem != NULL) {
+        state->anomalies++;
+        if (state->described++ < MIGRATE_DETAILS)
+            printf("users.txt:%lu: %s: %s\n", state->lines, record.username, problem);
+    }
+    
+    if (state->dryRun)
+        return 0;
+    if (state->out - state->output > EXPORT_BUFFER - (long)sizeof(entry)) {
+        if (writeAll(state->target, state->output, state->out - state->output) != 0)
+            return -1;
+        state->out = state->output;
+    }
+    state->out += formatRecord(state->out, sizeof(entry), record.username, &record);
+    return 0;
+}
+
+int repairPlace(user *record) {
+    char rest[256];
+    size_t length;
+    int i, k;
+    
+    /* The destination may have taken words from the password, or the other way round. */
+    snprintf(rest, sizeof(rest), "%s %s", record->password, record->place);
+    for (k = 1; rest[k] != '\0'; k++) {
+        if (rest[k - 1] != ' ' || rest[k] == ' ')
+            continue;
+        for (i = 0; i < PLACE_COUNT; i++) {
+            if (!samePlaceName(rest + k, placeList[i]))
+                continue;
+            length = k - 1;
+            while (length > 0 && rest[length - 1] == ' ')
+                length--;
+            if (length == 0)
+                return -1;
+            rest[length] = '\0';
+            strcpy(record->password, rest);
+            record->place = placeList[i];
+            return i;
+        }
+    }
+    return -1;
+}
+
+int samePlaceName(const char *a, const char *b) {
+    for (;;) {
+        while (*a == ' ')
+            a++;
+        while (*b == ' ')
+            b++;
+        if (*a == '\0' || *b == '\0')
+            return *a == *b;
+        if (tolower((unsigned char)*a++) != tolower((unsigned char)*b++))
+            return 0;
+    }
+}
+
+int exportLine(char *line, void *context) {
+    exportState *state = (exportState*)context;
+    user record;
+    
+    if (!parseUserLine(line, &record)) {
+        state->skipped++;
+        return 0;
+    }
+    state->rows++;
+    if (state->group != NULL)
+        return addColumnRow(state->group, state->target, &record);
+    
+    if (state->out - state->output > EXPORT_BUFFER - EXPORT_ROW) {
+        if (writeAll(state->target, state->output, state->out - state->output) != 0)
+            return -1;
+        state->out = state->output;
+    }
+    state->out = formatExportRow(state->out, &record, state->kind == exportJsonl);
+    return 0;
+}
+
+int streamLines(int fd, int (*visit)(char *line, void *context), void *context) {
+    char *input, *line, *end, *next;
+    size_t pending = 0, length;
+    int skipping = 0, result = 0;
+    ssize_t got;
+    
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    input = (char*)malloc(EXPORT_BUFFER + 1);
+    while (result == 0 && (got = read(fd, input + pending, EXPORT_BUFFER - pending)) != 0) {
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            result = -1;
+            break;
+        }
+        length = pending + got;
+        
+        /* Complete lines are visited; a partial one waits for the next read. */
+        for (line = input, end = input + length; result == 0 && line < end; line = next + 1) {
+            next = (char*)memchr(line, '\n', end - line);
+            if (next == NULL)
+                break;
+            *next = '\0';
+            if (skipping)
+                skipping = 0;
+            else
+                result = visit(line, context);
+        }
+        pending = line < end ? (size_t)(end - line) : 0;
+        memmove(input, line, pending);
+        
+        /* A line longer than the buffer cannot be a record; it is visited empty, and its rest dropped. */
+        if (pending == EXPORT_BUFFER) {
+            if (!skipping) {
+                input[0] = '\0';
+                result = visit(input, context);
+            }
+            skipping = 1;
+            pending = 0;
+        }
+    }
+    if (result == 0 && pending > 0 && !skipping) {
+        input[pending] = '\0';
+        result = visit(input, context);
+    }
+    free(input);
+    return result;
+}
+
+int addColumnRow(columnGroup *group, int fd, const user *record) {
+    const char *place = strcmp(record->place, noPlace) ? record->place : "";
+    unsigned int index;
+    
+    /* Destinations are few; a linear search of the dictionary beats hashing them. */
+    for (index = 0; index < group->entries && strcmp(group->dictionary[index], place) != 0; index++)
+        ;
+    if (index == COLUMN_DICTIONARY) {
+        if (writeColumnGroup(group, fd) != 0)
+            return -1;
+        index = 0;
+    }
+    if (index == group->entries)
+        strcpy(group->dictionary[group->entries++], place);
+    
+    strcpy(group->names[group->rows], record->username);
+    group->places[group->rows] = (unsigned char)index;
+    group->prices[group->rows] = (long long)(record->price * 100.0 + (record->price < 0 ? -0.5 : 0.5));
+    group->tickets[group->rows] = record->numberTicket;
+    if (++group->rows == COLUMN_GROUP)
+        return writeColumnGroup(group, fd);
+    return 0;
+}
+
+int writeColumnGroup(columnGroup *group, int fd) {
+    unsigned char *out = group->encoded + 8, *chunk;
+    unsigned long long indexes[COLUMN_GROUP];
+    unsigned int i, shared, length, chunkLength;
+    int column, width;
+    
+    if (group->rows == 0)
+        return 0;
+    
+    for (column = 0; column < 4; column++) {
+        chunk = out;
+        *out++ = (unsigned char)column;
+        out += 5;
+        if (column == 0) {
+            /* Usernames: shared prefix length, then the rest. */
+            chunk[1] = encodingPrefix;
+            for (i = 0; i < group->rows; i++) {
+                shared = 0;
+                if (i > 0)
+                    while (group->names[i][shared] != '\0' && group->names[i][shared] == group->names[i - 1][shared])
+                        shared++;
+                length = strlen(group->names[i] + shared);
+                out = putVarint(out, shared);
+                out = putVarint(out, length);
+                memcpy(out, group->names[i] + shared, length);
+                out += length;
+            }
+        } else if (column == 1) {
+            /* Destinations: the dictionary, then as few bits per row as its size needs. */
+            chunk[1] = encodingDictionary;
+            out = putVarint(out, group->entries);
+            for (i = 0; i < group->entries; i++) {
+                length = strlen(group->dictionary[i]);
+                out = putVarint(out, length);
+                memcpy(out, group->dictionary[i], length);
+                out += length;
+            }
+            for (width = 0; (1u << width) < group->entries; width++)
+                ;
+            for (i = 0; i < group->rows; i++)
+                indexes[i] = group->places[i];
+            *out++ = (unsigned char)width;
+            out = packBits(out, indexes, group->rows, width);
+        } else
+            out = encodeIntegers(out, &chunk[1], column == 2 ? group->prices : group->tickets, group->rows);
+        chunkLength = (unsigned int)(out - chunk - 6);
+        memcpy(chunk + 2, &chunkLength, 4);
+    }
+    
+    /* The group header: rows, then the bytes of column chunks that follow. */
+    length = (unsigned int)(out - group->encoded - 8);
+    memcpy(group->encoded, &group->rows, 4);
+    memcpy(group->encoded + 4, &length, 4);
+    if (writeAll(fd, (const char*)group->encoded, out - group->encoded) != 0)
+        return -1;
+    
+    if (group->groups == group->capacity) {
+        group->capacity = group->capacity ? group->capacity * 2 : 64;
+        group->offsets = (unsigned long long*)realloc(group->offsets, group->capacity * sizeof(unsigned long long));
+    }
+    group->offsets[group->groups++] = group->position;
+    group->position += out - group->encoded;
+    group->rows = 0;
+    group->entries = 0;
+    return 0;
+}
+
+int finishColumns(columnGroup *group, int fd) {
+    unsigned int count;
+    
+    if (writeColumnGroup(group, fd) != 0)
+        return -1;
+    
+    /* The footer is read from the end: magic, group count, then the group offsets before them. */
+    count = (unsigned int)group->groups;
+    if (group->groups > 0 && writeAll(fd, (const char*)group->offsets, group->groups * sizeof(unsigned long long)) != 0)
+        return -1;
+    if (writeAll(fd, (const char*)&count, sizeof(count)) != 0)
+        return -1;
+    return writeAll(fd, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC));
+}
+
+unsigned char* encodeIntegers(unsigned char *out, unsigned char *encoding, const long long *values, unsigned int count) {
+    unsigned long long packed[COLUMN_GROUP], range, deltaRange;
+    long long smallest = values[0], largest = values[0], delta, smallestDelta = 0, largestDelta = 0;
+    int width = 0, deltaWidth = 0;
+    unsigned int i;
+    
+    for (i = 1; i < count; i++) {
+        if (values[i] < smallest)
+            smallest = values[i];
+        if (values[i] > largest)
+            largest = values[i];
+        delta = values[i] - values[i - 1];
+        if (i == 1 || delta < smallestDelta)
+            smallestDelta = delta;
+        if (i == 1 || delta > largestDelta)
+            largestDelta = delta;
+    }
+    range = (unsigned long long)(largest - smallest);
+    deltaRange = (unsigned long long)(largestDelta - smallestDelta);
+    while (width < 64 && range >> width != 0)
+        width++;
+    while (deltaWidth < 64 && deltaRange >> deltaWidth != 0)
+        deltaWidth++;
+    
+    /* Sorted or slowly changing columns pack tighter as differences. */
+    if ((unsigned long long)deltaWidth * (count - 1) + 64 < (unsigned long long)width * count) {
+        *encoding = encodingDeltaPacked;
+        out = putVarint(out, ZIGZAG(values[0]));
+        out = putVarint(out, ZIGZAG(smallestDelta));
+        for (i = 1; i < count; i++)
+            packed[i - 1] = (unsigned long long)(values[i] - values[i - 1] - smallestDelta);
+        *out++ = (unsigned char)deltaWidth;
+        return packBits(out, packed, count - 1, deltaWidth);
+    }
+    *encoding = encodingPacked;
+    out = putVarint(out, ZIGZAG(smallest));
+    for (i = 0; i < count; i++)
+        packed[i] = (unsigned long long)(values[i] - smallest);
+    *out++ = (unsigned char)width;
+    return packBits(out, packed, count, width);
+}
+
+unsigned char* packBits(unsigned char *out, const unsigned long long *values, unsigned int count, int width) {
+    unsigned long long buffer = 0, value;
+    unsigned int i;
+    int bits = 0, take, left;
+    
+    if (width == 0)
+        return out;
+    for (i = 0; i < count; i++) {
+        /* Values wider than the room left in the 64-bit buffer are split across flushes. */
+        value = values[i];
+        left = width;
+        while (left > 0) {
+            take = left < 64 - bits ? left : 64 - bits;
+            buffer |= (take == 64 ? value : value & ((1ull << take) - 1)) << bits;
+            bits += take;
+            left -= take;
+            value = take == 64 ? 0 : value >> take;
+            if (bits == 64) {
+                memcpy(out, &buffer, 8);
+                out += 8;
+                buffer = 0;
+                bits = 0;
+            }
+        }
+    }
+    for (; bits > 0; bits -= 8) {
+        *out++ = (unsigned char)buffer;
+        buffer >>= 8;
+    }
+    return out;
+}
+
+unsigned char* putVarint(unsigned char *out, unsigned long long value) {
+    while (value >= 0x80) {
+        *out++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (unsigned char)value;
+    return out;
+}
+
+int decodeColumns(const char *path, int (*visit)(const user *record, void *context), void *context) {
+    const unsigned char *data, *footer, *next;
+    unsigned long long offset;
+    unsigned int groups, g, i;
+    columnGroup *group;
+    struct stat info;
+    user record;
+    size_t size;
+    char *mapped;
+    int fd, result = 0;
+    
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    size = info.st_size;
+    if (size < 2 * sizeof(COLUMNAR_MAGIC) + sizeof(groups)) {
+        close(fd);
+        return -1;
+    }
+    mapped = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return -1;
+    data = (const unsigned char*)mapped;
+    
+    /* The footer is read from the end: magic, group count, then the group offsets before them. */
+    memcpy(&groups, data + size - sizeof(COLUMNAR_MAGIC) - sizeof(groups), sizeof(groups));
+    if (memcmp(data, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC)) != 0 ||
+        memcmp(data + size - sizeof(COLUMNAR_MAGIC), COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC)) != 0 ||
+        groups > (size - 2 * sizeof(COLUMNAR_MAGIC) - sizeof(groups)) / sizeof(offset)) {
+        munmap(mapped, size);
+        return -1;
+    }
+    footer = data + size - sizeof(COLUMNAR_MAGIC) - sizeof(groups) - groups * sizeof(offset);
+    
+    group = (columnGroup*)malloc(sizeof(columnGroup));
+    next = data + sizeof(COLUMNAR_MAGIC);
+    for (g = 0; g < groups && result == 0; g++) {
+        memcpy(&offset, footer + g * sizeof(offset), sizeof(offset));
+        if (offset != (unsigned long long)(next - data) || (next = readColumnGroup(next, footer, group)) == NULL) {
+            result = -1;
+            break;
+        }
+        for (i = 0; i < group->rows && result == 0; i++) {
+            memset(&record, 0, sizeof(record));
+            record.username = group->names[i];
+            record.place = group->dictionary[group->places[i]][0] != '\0' ? group->dictionary[group->places[i]] : noPlace;
+            record.price = (float)(group->prices[i] / 100.0);
+            record.numberTicket = (int)group->tickets[i];
+            result = visit(&record, context);
+        }
+    }
+    if (result == 0 && next != footer)
+        result = -1;
+    free(group);
+    munmap(mapped, size);
+    return result;
+}
+
+const unsigned char* readColumnGroup(const unsigned char *in, const unsigned char *end, columnGroup *group) {
+    unsigned long long indexes[COLUMN_GROUP], shared, length;
+    const unsigned char *chunkEnd, *groupEnd;
+    unsigned int rows, size, chunkLength, i;
+    int column;
+    
+    if (end - in < 8)
+        return NULL;
+    memcpy(&rows, in, 4);
+    memcpy(&size, in + 4, 4);
+    in += 8;
+    if (rows == 0 || rows > COLUMN_GROUP || size > (unsigned long long)(end - in))
+        return NULL;
+    groupEnd = in + size;
+    group->rows = rows;
+    
+    /* Each chunk names its column and must be used up exactly. */
+    for (column = 0; column < 4; column++) {
+        if (groupEnd - in < 6 || in[0] != column)
+            return NULL;
+        memcpy(&chunkLength, in + 2, 4);
+        if (chunkLength > (unsigned long long)(groupEnd - in - 6))
+            return NULL;
+        chunkEnd = in + 6 + chunkLength;
+        
+        if (column == 0 && in[1] == encodingPrefix) {
+            for (in += 6, i = 0; i < rows; i++) {
+                if ((in = getVarint(in, chunkEnd, &shared)) == NULL || (in = getVarint(in, chunkEnd, &length)) == NULL)
+                    return NULL;
+                if (shared > (i > 0 ? strlen(group->names[i - 1]) : 0) || shared + length >= NAME_SIZE ||
+                    length > (unsigned long long)(chunkEnd - in))
+                    return NULL;
+                if (i > 0)
+                    memcpy(group->names[i], group->names[i - 1], shared);
+                memcpy(group->names[i] + shared, in, length);
+                group->names[i][shared + length] = '\0';
+                in += length;
+            }
+        } else if (column == 1 && in[1] == encodingDictionary) {
+            if ((in = getVarint(in + 6, chunkEnd, &length)) == NULL || length == 0 || length > COLUMN_DICTIONARY)
+                return NULL;
+            group->entries = (unsigned int)length;
+            for (i = 0; i < group->entries; i++) {
+                if ((in = getVarint(in, chunkEnd, &length)) == NULL || length >= NAME_SIZE ||
+                    length > (unsigned long long)(chunkEnd - in))
+                    return NULL;
+                memcpy(group->dictionary[i], in, length);
+                group->dictionary[i][length] = '\0';
+                in += length;
+            }
+            if (in == chunkEnd || (in = unpackBits(in + 1, chunkEnd, indexes, rows, in[0])) == NULL)
+                return NULL;
+            for (i = 0; i < rows; i++) {
+                if (indexes[i] >= group->entries)
+                    return NULL;
+                group->places[i] = (unsigned char)indexes[i];
+            }
+        } else if (column >= 2)
+            in = decodeIntegers(in + 6, chunkEnd, in[1], column == 2 ? group->prices : group->tickets, rows);
+        else
+            return NULL;
+        if (in != chunkEnd)
+            return NULL;
+    }
+    return in == groupEnd ? in : NULL;
+}
+
+const unsigned char* decodeIntegers(const unsigned char *in, const unsigned char *end, int encoding,
+                                    long long *values, unsigned int count) {
+    unsigned long long packed[COLUMN_GROUP], first, smallest;
+    unsigned int i;
+    
+    if ((encoding != encodingPacked && encoding != encodingDeltaPacked) || count == 0 || count > COLUMN_GROUP)
+        return NULL;
+    if ((in = getVarint(in, end, &first)) == NULL)
+        return NULL;
+    
+    /* Arithmetic is unsigned, as in encodeIntegers(), so damaged values wrap instead of overflowing. */
+    if (encoding == encodingDeltaPacked) {
+        if ((in = getVarint(in, end, &smallest)) == NULL || in == end ||
+            (in = unpackBits(in + 1, end, packed, count - 1, in[0])) == NULL)
+            return NULL;
+        values[0] = UNZIGZAG(first);
+        for (i = 1; i < count; i++)
+            values[i] = (long long)((unsigned long long)values[i - 1] + (unsigned long long)UNZIGZAG(smallest) + packed[i - 1]);
+        return in;
+    }
+    if (in == end || (in = unpackBits(in + 1, end, packed, count, in[0])) == NULL)
+        return NULL;
+    for (i = 0; i < count; i++)
+        values[i] = (long long)((unsigned long long)UNZIGZAG(first) + packed[i]);
+    return in;
+}
+
+const unsigned char* unpackBits(const unsigned char *in, const unsigned char *end, unsigned long long *values,
+                                unsigned int count, int width) {
+    unsigned long long value, bit = 0;
+    unsigned int i;
+    int got, take, shift;
+    
+    if (width < 0 || width > 64 || ((unsigned long long)count * width + 7) / 8 > (unsigned long long)(end - in))
+        return NULL;
+    
+    /* Least significant bit first, a byte (or what is left of one) at a time. */
+    for (i = 0; i < count; i++) {
+        value = 0;
+        for (got = 0; got < width; got += take) {
+            shift = (int)(bit % 8);
+            take = 8 - shift < width - got ? 8 - shift : width - got;
+            value |= (unsigned long long)((in[bit / 8] >> shift) & ((1u << take) - 1)) << got;
+            bit += take;
+        }
+        values[i] = value;
+    }
+    return in + (bit + 7) / 8;
+}
+
+const unsigned char* getVarint(const unsigned char *in, const unsigned char *end, unsigned long long *value) {
+    int shift;
+    
+    *value = 0;
+    for (shift = 0; in < end && shift < 64; shift += 7) {
+        *value |= (unsigned long long)(*in & 0x7F) << shift;
+        if (!(*in++ & 0x80))
+            return in;
+    }
+    return NULL;
+}
+
+int decodeExport(const char *path, int target, const char *format) {
+    exportState state;
+    int result;
+    
+    memset(&state, 0, sizeof(state));
+    if (format != NULL && (!strcmp(format, "jsonl") || !strcmp(format, "json")))
+        state.kind = exportJsonl;
+    else if (format != NULL && strcmp(format, "csv") != 0) {
+        printf("\nUnknown format %s; use csv or jsonl.\n", format);
+        return 1;
+    }
+    state.target = target;
+    state.output = (char*)malloc(EXPORT_BUFFER);
+    state.out = state.output;
+    if (state.kind == exportCsv)
+        state.out += sprintf(state.out, "username,destination,tour,price,tickets,amount\n");
+    
+    result = decodeColumns(path, decodeRow, &state);
+    if (result == 0)
+        result = writeAll(target, state.output, state.out - state.output);
+    free(state.output);
+    if (result != 0) {
+        fprintf(stderr, "\n%s: not a readable columnar export.\n", path);
+        return 1;
+    }
+    fprintf(stderr, "\nDecoded %lu account(s).\n", state.rows);
+    return 0;
+}
+
+int decodeRow(const user *record, void *context) {
+    exportState *state = (exportState*)context;
+    
+    if (state->out - state->output > EXPORT_BUFFER - EXPORT_ROW) {
+        if (writeAll(state->target, state->output, state->out - state->output) != 0)
+            return -1;
+        state->out = state->output;
+    }
+    state->out = formatExportRow(state->out, record, state->kind == exportJsonl);
+    state->rows++;
+    return 0;
+}
+
+int runSelfTest(void) {
+    static const selfCheck checks[] = {
+        {"CRC32C sealing of records and log entries", checkChecksums},
+        {"parallel log replay against serial replay", checkReplay},
+        {"columnar export against its decoder", checkColumnar},
+        {"import and export round trip", checkImportExport},
+        {"migration of an unsealed store", checkMigration},
+    };
+    const size_t count = sizeof(checks) / sizeof(checks[0]);
+    const char *temporary = getenv("TMPDIR");
+    char scratch[256], directory[300], details[4096];
+    size_t i, passed = 0;
+    ssize_t length;
+    int channel[2], status, quiet;
+    pid_t child;
+    
+    snprintf(scratch, sizeof(scratch), "%s/tms-self-test-XXXXXX", temporary != NULL && temporary[0] ? temporary : "/tmp");
+    if (mkdtemp(scratch) == NULL) {
+        printf("\n%s: cannot be created.\n", scratch);
+        return 1;
+    }
+    
+    for (i = 0; i < count; i++) {
+        snprintf(directory, sizeof(directory), "%s/%zu", scratch, i + 1);
+        if (mkdir(directory, 0755) != 0 || pipe(channel) != 0) {
+            printf("FAILED  %s: %s cannot be set up\n", checks[i].name, directory);
+            continue;
+        }
+        
+        /* A child of its own gives every check fresh globals, locks and working directory. */
+        fflush(stdout);
+        fflush(stderr);
+        child = fork();
+        if (child == 0) {
+            close(channel[0]);
+            selfTestReport = channel[1];
+            quiet = open("/dev/null", O_WRONLY);
+            dup2(quiet, STDOUT_FILENO);
+            dup2(quiet, STDERR_FILENO);
+            _exit(chdir(directory) != 0 ? checkFailed("working directory", directory) : checks[i].run());
+        }
+        close(channel[1]);
+        details[0] = '\0';
+        length = 0;
+        while (child > 0 && length < (ssize_t)sizeof(details) - 1) {
+            ssize_t got = read(channel[0], details + length, sizeof(details) - 1 - length);
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got <= 0)
+                break;
+            length += got;
+        }
+        details[length] = '\0';
+        close(channel[0]);
+        
+        status = -1;
+        while (child > 0 && waitpid(child, &status, 0) < 0 && errno == EINTR)
+            ;
+        if (child > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            printf("ok      %s\n", checks[i].name);
+            passed++;
+        } else {
+            printf("FAILED  %s\n", checks[i].name);
+            if (child > 0 && WIFSIGNALED(status))
+                printf("    killed by signal %d\n", WTERMSIG(status));
+            fputs(details, stdout);
+        }
+    }
+    
+    printf("\n%zu of %zu check(s) passed.\n", passed, count);
+    if (passed == count)
+        nftw(scratch, removeScratch, 16, FTW_DEPTH | FTW_PHYS);
+    else
+        printf("Their files are kept in %s.\n", scratch);
+    return passed == count ? 0 : 1;
+}
+
+int checkFailed(const char *what, const char *detail) {
+    if (selfTestReport >= 0)
+        dprintf(selfTestReport, "    %s: %s\n", what, detail);
+    return 1;
+}
+
+int checkChecksums(void) {
+    static const char accounts[] = "asha,secret\nravi,pw,\"Paris, France\",2\nmeera,pw,7,1\n";
+    unsigned char data[4096];
+    char line[512], sealed[512], *log, *entry;
+    size_t i, length;
+    user record, copy;
+    
+    /* The standard check value, then the table-driven routine against whichever one this CPU uses. */
+    if (crc32c("123456789", 9) != 0xE3069283u)
+        return checkFailed("CRC32C of \"123456789\"", "not E3069283");
+    for (i = 0; i < sizeof(data); i++)
+        data[i] = (unsigned char)(i * 131 + 7);
+    for (i = 0; i < 200; i++) {
+        if (crc32c(data + i % 8, i * 13) != ~crc32cSoftware(~0u, data + i % 8, i * 13)) {
+            snprintf(line, sizeof(line), "the routines differ on %zu bytes at offset %zu", i * 13, i % 8);
+            return checkFailed("CRC32C", line);
+        }
+    }
+    
+    /* A sealed record reads back whole; one changed bit is refused; an unsealed line is legacy. */
+    memset(&record, 0, sizeof(record));
+    record.username = "asha";
+    strcpy(record.password, "two words");
+    record.place = placeList[0];
+    record.price = priceList[0];
+    record.numberTicket = 2;
+    formatRecord(line, sizeof(line), record.username, &record);
+    strcpy(sealed, line);
+    if (!parseUserLine(line, &copy) || strcmp(copy.username, "asha") || strcmp(copy.password, "two words") ||
+        strcmp(copy.place, placeList[0]) || copy.price != priceList[0] || copy.numberTicket != 2)
+        return checkFailed("sealed record", "does not read back as written");
+    sealed[1] ^= 1;
+    if (stripChecksum(sealed) != -1)
+        return checkFailed("sealed record with a changed bit", "not refused");
+    strcpy(line, "asha secret N/A 0.000000 0\n");
+    if (stripChecksum(line) != 0)
+        return checkFailed("unsealed record", "not read as a legacy line");
+    
+    /* A store written by an import verifies; a changed byte in its log does not. */
+    if (writeTextFile("accounts.csv", accounts) != 0 || importUsers("accounts.csv") != 0)
+        return checkFailed("import of three accounts", "failed");
+    if (verifyStore() != 0)
+        return checkFailed("verification of a fresh store", "found problems");
+    log = readTextFile(LOG_FILE, &length);
+    entry = log != NULL ? strstr(log, " ravi ") : NULL;
+    if (entry == NULL) {
+        free(log);
+        return checkFailed(LOG_FILE, "has no entry for ravi");
+    }
+    entry[2] = 'V';
+    if (writeTextFile(LOG_FILE, log) != 0) {
+        free(log);
+        return checkFailed(LOG_FILE, "cannot be rewritten");
+    }
+    free(log);
+    if (verifyStore() == 0)
+        return checkFailed("verification of a log with a changed byte", "found no problem");
+    return 0;
+}
+
+int checkReplay(void) {
+    static char names[SELF_TEST_USERS][16];
+    static user expected[SELF_TEST_USERS];
+    static int present[SELF_TEST_USERS];
+    user *parallel, *serial = NULL, *found, copy, *lists[2];
+    userCursor cursor;
+    unsigned long seq;
+    long long timestamp, now = 1700000000;
+    char *events, *line, *end, detail[256];
+    size_t used = 0, capacity = SELF_TEST_EVENTS * 128, accounts = 0, counted;
+    int e, u, place, l;
+    
+    /* Additions, bookings, cancellations, password changes, transfers away and notices, in a fixed random order. */
+    srand(84);
+    events = (char*)malloc(capacity);
+    for (e = 1; e <= SELF_TEST_EVENTS; e++) {
+        u = rand() % SELF_TEST_USERS;
+        snprintf(names[u], sizeof(names[u]), "traveller%04d", u);
+        expected[u].username = names[u];
+        if (!present[u]) {
+            snprintf(expected[u].password, sizeof(expected[u].password), "pw%d", u);
+            expected[u].place = noPlace;
+            expected[u].price = 0.0f;
+            expected[u].numberTicket = 0;
+            present[u] = 1;
+            used += formatLogEntry(events + used, capacity - used, e, now + e, "ADD", &expected[u]);
+            continue;
+        }
+        switch (rand() % 5) {
+            case 0:
+                place = rand() % PLACE_COUNT;
+                expected[u].place = placeList[place];
+                expected[u].price = priceList[place];
+                expected[u].numberTicket = 1 + rand() % 5;
+                used += formatLogEntry(events + used, capacity - used, e, now + e, "BOOK", &expected[u]);
+                break;
+            case 1:
+                expected[u].place = noPlace;
+                expected[u].price = 0.0f;
+                expected[u].numberTicket = 0;
+                used += formatLogEntry(events + used, capacity - used, e, now + e, "CANCEL", &expected[u]);
+                break;
+            case 2:
+                snprintf(expected[u].password, sizeof(expected[u].password), "pw%d-%d", u, e);
+                used += formatLogEntry(events + used, capacity - used, e, now + e, "PASSWD", &expected[u]);
+                break;
+            case 3:
+                present[u] = 0;
+                used += formatLogEntry(events + used, capacity - used, e, now + e, "DROP", &expected[u]);
+                break;
+            default:
+                l = snprintf(events + used, capacity - used - 12, "%d %lld NOTIFY %s Your booking is confirmed.", e,
+                             now + e, names[u]);
+                used += sealLine(events + used, l, capacity - used);
+                break;
+        }
+    }
+    if (writeAll(open(LOG_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644), events, used) != 0) {
+        free(events);
+        return checkFailed(LOG_FILE, "cannot be written");
+    }
+    
+    /* The start-up replay, partitioned over the CPUs, against the tail follower, one entry at a time. */
+    parallel = replayLog(NULL, 0, -1);
+    for (line = events; (end = (char*)memchr(line, '\n', events + used - line)) != NULL; line = end + 1) {
+        *end = '\0';
+        applyLogEntry(line, &serial, NULL, &seq, &timestamp);
+    }
+    free(events);
+    
+    lists[0] = parallel;
+    lists[1] = serial;
+    for (u = 0; u < SELF_TEST_USERS; u++)
+        accounts += present[u];
+    for (l = 0; l < 2; l++) {
+        startUsers(&cursor, lists[l]);
+        for (counted = 0; nextUser(&cursor, &copy); counted++)
+            ;
+        if (counted != accounts) {
+            snprintf(detail, sizeof(detail), "%zu account(s) instead of %zu", counted, accounts);
+            return checkFailed(l == 0 ? "parallel replay" : "serial replay", detail);
+        }
+        for (u = 0; u < SELF_TEST_USERS; u++) {
+            if (names[u][0] == '\0')
+                continue;
+            found = findUser(lists[l], names[u]);
+            if ((found != NULL) != present[u]) {
+                snprintf(detail, sizeof(detail), "%.15s is %s", names[u], present[u] ? "missing" : "still there after DROP");
+                return checkFailed(l == 0 ? "parallel replay" : "serial replay", detail);
+            }
+            if (found == NULL)
+                continue;
+            snapshotUser(found, &copy);
+            if (strcmp(copy.password, expected[u].password) || strcmp(copy.place, expected[u].place) ||
+                copy.price != expected[u].price || copy.numberTicket != expected[u].numberTicket) {
+                snprintf(detail, sizeof(detail), "%.15s is \"%.40s %.40s %d\" instead of \"%.40s %.40s %d\"", names[u], copy.password,
+                         copy.place, copy.numberTicket, expected[u].password, expected[u].place, expected[u].numberTicket);
+                return checkFailed(l == 0 ? "parallel replay" : "serial replay", detail);
+            }
+        }
+    }
+    return 0;
+}
+
+int checkColumnar(void) {
+    static unsigned long long values[300], decoded[300];
+    static long long integers[COLUMN_GROUP], integersDecoded[COLUMN_GROUP];
+    static unsigned char packed[COLUMN_GROUP * 10 + 64];
+    static const char *shapes[] = {"ascending", "random", "constant", "single"};
+    unsigned long long mask;
+    unsigned char *end, encoding;
+    unsigned int count, i;
+    char detail[256], *accounts, *out, *file;
+    size_t length;
+    int width, shape, fd, result;
+    
+    /* Every width, with counts that leave the last byte partly used. */
+    srand(98);
+    for (width = 0; width <= 64; width++) {
+        mask = width == 64 ? ~0ull : (1ull << width) - 1;
+        count = 1 + (width * 37) % 300;
+        for (i = 0; i < count; i++)
+            values[i] = (((unsigned long long)rand() << 42) ^ ((unsigned long long)rand() << 21) ^ (unsigned long long)rand()) & mask;
+        end = packBits(packed, values, count, width);
+        if ((size_t)(end - packed) != ((size_t)count * width + 7) / 8 ||
+            unpackBits(packed, end, decoded, count, width) != end || memcmp(values, decoded, count * sizeof(values[0]))) {
+            snprintf(detail, sizeof(detail), "%u value(s) of %d bit(s) do not round trip", count, width);
+            return checkFailed("bit packing", detail);
+        }
+    }
+    
+    /* Sorted columns take the delta encoding; the others the plain one. */
+    for (shape = 0; shape < 4; shape++) {
+        count = shape == 3 ? 1 : COLUMN_GROUP;
+        for (i = 0; i < count; i++)
+            integers[i] = shape == 0 ? 1000 + 7 * (long long)i : shape == 1 ? rand() % 10000001 - 5000000 : shape == 2 ? 42 : -7;
+        end = encodeIntegers(packed, &encoding, integers, count);
+        if ((shape == 0) != (encoding == encodingDeltaPacked) ||
+            decodeIntegers(packed, end, encoding, integersDecoded, count) != end ||
+            memcmp(integers, integersDecoded, count * sizeof(integers[0]))) {
+            snprintf(detail, sizeof(detail), "the %s column does not round trip", shapes[shape]);
+            return checkFailed("integer encoding", detail);
+        }
+    }
+    
+    /* A store of several row groups, with and without bookings, exported both ways. */
+    accounts = (char*)malloc(SELF_TEST_ACCOUNTS * 48);
+    out = accounts;
+    for (i = 0; i < SELF_TEST_ACCOUNTS; i++) {
+        if (i % 3 == 0)
+            out += sprintf(out, "guest%06u,pw%u\n", i * 7919 % 1000003, i);
+        else
+            out += sprintf(out, "guest%06u,pw%u,%u,%u\n", i * 7919 % 1000003, i, 1 + i % PLACE_COUNT, 1 + i % 9);
+    }
+    result = writeTextFile("accounts.csv", accounts);
+    free(accounts);
+    if (result != 0 || importUsers("accounts.csv") != 0)
+        return checkFailed("import of the accounts", "failed");
+    if (exportUsers("export.csv", "csv") != 0 || exportUsers("export.jsonl", "jsonl") != 0 ||
+        exportUsers("export.tmscol", "columnar") != 0)
+        return checkFailed("export", "failed");
+    
+    fd = open("decoded.csv", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    result = decodeExport("export.tmscol", fd, "csv");
+    close(fd);
+    if (result != 0 || !sameFiles("export.csv", "decoded.csv"))
+        return checkFailed("columnar export decoded as CSV", "differs from the CSV export");
+    fd = open("decoded.jsonl", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    result = decodeExport("export.tmscol", fd, "jsonl");
+    close(fd);
+    if (result != 0 || !sameFiles("export.jsonl", "decoded.jsonl"))
+        return checkFailed("columnar export decoded as JSON Lines", "differs from the JSON Lines export");
+    
+    /* A file cut short, or a group claiming more rows than it holds, is refused. */
+    file = readTextFile("export.tmscol", &length);
+    if (file == NULL || length < 64)
+        return checkFailed("export.tmscol", "cannot be read back");
+    fd = open("damaged.tmscol", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    result = writeAll(fd, file, length - 1);
+    close(fd);
+    fd = open("/dev/null", O_WRONLY);
+    if (result != 0 || decodeExport("damaged.tmscol", fd, "csv") == 0) {
+        free(file);
+        return checkFailed("columnar file missing its last byte", "not refused");
+    }
+    file[sizeof(COLUMNAR_MAGIC)] ^= 1;
+    result = writeAll(open("damaged.tmscol", O_WRONLY | O_CREAT | O_TRUNC, 0644), file, length);
+    free(file);
+    if (result != 0 || decodeExport("damaged.tmscol", fd, "csv") == 0)
+        return checkFailed("columnar group with a wrong row count", "not refused");
+    close(fd);
+    return 0;
+}
+
+int checkImportExport(void) {
+    static const char accounts[] =
+        "username,password,destination,tickets\n"
+        "asha,secret\n"
+        "ravi,\"pa,ss \"\"quoted\"\"\",\"Paris, France\",2\n"
+        "meera,hunter 2,7,1\n"
+        "\"o\"\"neil\",pw,\"Rome, Italy\",3\n"
+        "back\\slash,pw,,\n"
+        "asha,again\n"
+        "zed,pw,Atlantis,1\n";
+    static const struct {
+        const char *username, *password, *jsonName;
+        int place, tickets;
+    } wanted[] = {
+        {"asha", "secret", "\"asha\"", -1, 0},
+        {"ravi", "pa,ss \"quoted\"", "\"ravi\"", 0, 2},
+        {"meera", "hunter 2", "\"meera\"", 6, 1},
+        {"o\"neil", "pw", "\"o\\\"neil\"", 5, 3},
+        {"back\\slash", "pw", "\"back\\\\slash\"", -1, 0},
+        {"new1", "pw", "\"new1\"", -1, 0},
+    };
+    const size_t count = sizeof(wanted) / sizeof(wanted[0]);
+    char *text, *line, *end, *fields[7], detail[256], expect[64];
+    size_t i, rows;
+    double price;
+    user record;
+    
+    /* A repeated name, an invalid destination and then an existing name are all skipped. */
+    if (writeTextFile("accounts.csv", accounts) != 0 || importUsers("accounts.csv") != 1)
+        return checkFailed("import with a repeated and an invalid row", "did not report them");
+    if (writeTextFile("more.csv", "asha,other\nnew1,pw\n") != 0 || importUsers("more.csv") != 1)
+        return checkFailed("import of an existing name", "did not report it");
+    if (verifyStore() != 0)
+        return checkFailed("verification after the imports", "found problems");
+    
+    /* Passwords are not exported, so the store is checked for them. */
+    text = readTextFile("users.txt", NULL);
+    if (text == NULL)
+        return checkFailed("users.txt", "cannot be read");
+    for (rows = 0, line = text; (end = strchr(line, '\n')) != NULL; line = end + 1, rows++) {
+        *end = '\0';
+        if (!parseUserLine(line, &record))
+            break;
+        for (i = 0; i < count && strcmp(wanted[i].username, record.username); i++)
+            ;
+        if (i == count || strcmp(wanted[i].password, record.password)) {
+            snprintf(detail, sizeof(detail), "%s has password \"%s\"", record.username, record.password);
+            free(text);
+            return checkFailed("users.txt", detail);
+        }
+    }
+    free(text);
+    if (rows != count) {
+        snprintf(detail, sizeof(detail), "%zu account(s) instead of %zu", rows, count);
+        return checkFailed("users.txt", detail);
+    }
+    
+    /* The CSV export, read back with the import's own parser. */
+    if (exportUsers("export.csv", "csv") != 0 || (text = readTextFile("export.csv", NULL)) == NULL)
+        return checkFailed("CSV export", "failed");
+    for (rows = 0, line = strchr(text, '\n') + 1; (end = strchr(line, '\n')) != NULL; line = end + 1, rows++) {
+        *end = '\0';
+        if (splitCsv(line, fields, 6) != 6)
+            break;
+        for (i = 0; i < count && strcmp(wanted[i].username, fields[0]); i++)
+            ;
+        price = wanted[i < count ? i : 0].place >= 0 ? priceList[wanted[i].place] : 0.0;
+        if (i == count || strcmp(fields[1], wanted[i].place >= 0 ? placeList[wanted[i].place] : "") ||
+            atoi(fields[2]) != wanted[i].place + 1 || strtod(fields[3], NULL) != price ||
+            atoi(fields[4]) != wanted[i].tickets || strtod(fields[5], NULL) != price * wanted[i].tickets)
+            break;
+    }
+    free(text);
+    if (rows != count)
+        return checkFailed("CSV export", "does not give back the imported accounts");
+    
+    /* The JSON Lines export escapes names and leaves the booking of an account without one null. */
+    if (exportUsers("export.jsonl", "jsonl") != 0 || (text = readTextFile("export.jsonl", NULL)) == NULL)
+        return checkFailed("JSON Lines export", "failed");
+    for (i = 0; i < count; i++) {
+        snprintf(expect, sizeof(expect), "{\"username\":%s,\"destination\":%s", wanted[i].jsonName,
+                 wanted[i].place >= 0 ? "\"" : "null");
+        if (strstr(text, expect) == NULL) {
+            snprintf(detail, sizeof(detail), "has no row starting %s", expect);
+            free(text);
+            return checkFailed("JSON Lines export", detail);
+        }
+    }
+    free(text);
+    return 0;
+}
+
+int checkMigration(void) {
+    static const char legacy[] =
+        "asha secret N/A 0.000000 0\n"
+        "ravi pa ss paris,  france 400000.000000 2\n"
+        "meera pw Rome, Italy 100000.000000 1\n";
+    char *before, *after, *line, *end, *second;
+    size_t rows = 0;
+    user record;
+    
+    /* A dry run, and a store with a line that is not a record, are left as they were. */
+    if (writeTextFile("users.txt", legacy) != 0 || migrateStore(1) != 0 || (before = readTextFile("users.txt", NULL)) == NULL)
+        return checkFailed("dry run", "failed");
+    if (strcmp(before, legacy) != 0) {
+        free(before);
+        return checkFailed("dry run", "changed users.txt");
+    }
+    free(before);
+    if (writeTextFile("users.txt", "asha secret N/A 0.000000 0\ngarbage\n") != 0 || migrateStore(0) == 0)
+        return checkFailed("store with an unreadable line", "migrated");
+    if ((before = readTextFile("users.txt", NULL)) == NULL || strcmp(before, "asha secret N/A 0.000000 0\ngarbage\n")) {
+        free(before);
+        return checkFailed("store with an unreadable line", "changed");
+    }
+    free(before);
+    
+    /* Every line comes out sealed, with the destination matched against the catalog. */
+    if (writeTextFile("users.txt", legacy) != 0 || migrateStore(0) != 0 || (after = readTextFile("users.txt", NULL)) == NULL)
+        return checkFailed("migration", "failed");
+    for (line = after; (end = strchr(line, '\n')) != NULL; line = end + 1, rows++) {
+        *end = '\0';
+        if (stripChecksum(line) != 1 || !parseUserLine(line, &record))
+            break;
+        if (!strcmp(record.username, "ravi") && (strcmp(record.place, "Paris, France") || strcmp(record.password, "pa ss")))
+            break;
+    }
+    free(after);
+    if (rows != 3)
+        return checkFailed("migrated store", "has a line that is not sealed or not repaired");
+    
+    /* A second run finds everything sealed and writes the same store. */
+    before = readTextFile("users.txt", NULL);
+    if (migrateStore(0) != 0 || (second = readTextFile("users.txt", NULL)) == NULL || before == NULL || strcmp(before, second)) {
+        free(before);
+        return checkFailed("second migration", "changed the store");
+    }
+    free(before);
+    free(second);
+    return 0;
+}
+
+int writeTextFile(const char *path, const char *text) {
+    int fd, result;
+    
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    result = writeAll(fd, text, strlen(text));
+    if (close(fd) != 0)
+        result = -1;
+    return result;
+}
+
+char* readTextFile(const char *path, size_t *length) {
+    struct stat info;
+    char *text;
+    ssize_t got;
+    size_t used = 0;
+    int fd;
+    
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    text = (char*)malloc(info.st_size + 1);
+    while (used < (size_t)info.st_size && ((got = read(fd, text + used, info.st_size - used)) > 0 || (got < 0 && errno == EINTR)))
+        used += got > 0 ? (size_t)got : 0;
+    close(fd);
+    text[used] = '\0';
+    if (length != NULL)
+        *length = used;
+    return text;
+}
+
+int sameFiles(const char *first, const char *second) {
+    char *one, *two;
+    size_t oneLength, twoLength;
+    int same;
+    
+    one = readTextFile(first, &oneLength);
+    two = readTextFile(second, &twoLength);
+    same = one != NULL && two != NULL && oneLength == twoLength && memcmp(one, two, oneLength) == 0;
+    free(one);
+    free(two);
+    return same;
+}
+
+int removeScratch(const char *path, const struct stat *info, int flag, struct FTW *walk) {
+    (void)info;
+    (void)flag;
+    (void)walk;
+    remove(path);
+    return 0;
+}
+
+char* formatExportRow(char *out, const user *record, int json) {
+    int tour = strcmp(record->place, noPlace) ? findPlace(record->place) + 1 : 0;
+    
+    if (json) {
+        out = appendJsonString((char*)memcpy(out, "{\"username\":", 12) + 12, record->username);
+        memcpy(out, ",\"destination\":", 15);
+        out += 15;
+        if (strcmp(record->place, noPlace) != 0)
+            out = appendJsonString(out, record->place);
+        else
+            out = (char*)memcpy(out, "null", 4) + 4;
+        memcpy(out, ",\"tour\":", 8);
+        out += 8;
+        out = tour > 0 ? appendInteger(out, tour) : (char*)memcpy(out, "null", 4) + 4;
+        memcpy(out, ",\"price\":", 9);
+        out = appendAmount(out + 9, record->price);
+        memcpy(out, ",\"tickets\":", 11);
+        out = appendInteger(out + 11, record->numberTicket);
+        memcpy(out, ",\"amount\":", 10);
+        out = appendAmount(out + 10, (double)record->price * record->numberTicket);
+        *out++ = '}';
+    } else {
+        /* An account without a booking has empty booking columns. */
+        out = appendCsvField(out, record->username);
+        *out++ = ',';
+        if (strcmp(record->place, noPlace) != 0)
+            out = appendCsvField(out, record->place);
+        *out++ = ',';
+        if (tour > 0)
+            out = appendInteger(out, tour);
+        *out++ = ',';
+        out = appendAmount(out, record->price);
+        *out++ = ',';
+        out = appendInteger(out, record->numberTicket);
+        *out++ = ',';
+        out = appendAmount(out, (double)record->price * record->numberTicket);
+    }
+    *out++ = '\n';
+    return out;
+}
+
+char* appendInteger(char *out, long long value) {
+    unsigned long long magnitude = value < 0 ? 0 - (unsigned long long)value : (unsigned long long)value;
+    char digits[20];
+    int count = 0;
+    
+    if (value < 0)
+        *out++ = '-';
+    
+    /* Digits come out least significant first, so they are collected and copied back reversed. */
+    do {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    while (count > 0)
+        *out++ = digits[--count];
+    return out;
+}
+
+char* appendAmount(char *out, double amount) {
+    unsigned long long paise;
+    
+    if (amount < 0) {
+        *out++ = '-';
+        amount = -amount;
+    }
+    if (!(amount <= EXPORT_AMOUNT_MAX))
+        amount = EXPORT_AMOUNT_MAX;
+    paise = (unsigned long long)(amount * 100.0 + 0.5);
+    out = appendInteger(out, (long long)(paise / 100));
+    *out++ = '.';
+    *out++ = (char)('0' + paise % 100 / 10);
+    *out++ = (char)('0' + paise % 10);
+    return out;
+}
+
+char* appendCsvField(char *out, const char *text) {
+    if (strpbrk(text, ",\"\r\n") == NULL) {
+        while (*text != '\0')
+            *out++ = *text++;
+        return out;
+    }
+    *out++ = '"';
+    for (; *text != '\0'; text++) {
+        if (*text == '"')
+            *out++ = '"';
+        *out++ = *text;
+    }
+    *out++ = '"';
+    return out;
+}
+
+char* appendJsonString(char *out, const char *text) {
+    static const char hex[] = "0123456789abcdef";
+    unsigned char c;
+    
+    *out++ = '"';
+    for (; *text != '\0'; text++) {
+        c = (unsigned char)*text;
+        if (c == '"' || c == '\\') {
+            *out++ = '\\';
+            *out++ = (char)c;
+        } else if (c < 0x20) {
+            memcpy(out, "\\u00", 4);
+            out[4] = hex[c >> 4];
+            out[5] = hex[c & 15];
+            out += 6;
+        } else
+            *out++ = (char)c;
+    }
+    *out++ = '"';
+    return out;
+}
+
+int writeAll(int fd, const char *data, size_t length) {
+    ssize_t written;
+    
+    while (length > 0) {
+        written = write(fd, data, length);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return -1;
+        data += written;
+        length -= written;
+    }
+    return 0;
+}
+
+int showAudit(const char *username) {
+    auditRecord records[AUDIT_BATCH];
+    unsigned int wanted = username != NULL ? ringHash(username) : 0;
+    char when[32];
+    size_t count, i;
+    time_t moment;
+    int shown = 0;
+    FILE *fp;
+    
+    fp = fopen(AUDIT_FILE, "rb");
+    if (fp == NULL) {
+        printf("\nNo audit records have been written yet.\n");
+        return 0;
+    }
+    
+    printf("\n%-19s  %-8s  %-7s  %-25s %8s %12s\n", "Time", "User ID", "PID", "Destination", "Tickets", "Amount");
+    while ((count = fread(records, sizeof(auditRecord), AUDIT_BATCH, fp)) > 0)
+        for (i = 0; i < count; i++) {
+            if (username != NULL && records[i].userId != wanted)
+                continue;
+            moment = (time_t)(records[i].timestamp / 1000000000LL);
+            strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&moment));
+            printf("%s  %08x  %-7u  %-25s %+8d %12.0f\n", when, records[i].userId, records[i].process,
+                   records[i].tour >= 0 && records[i].tour < PLACE_COUNT ? placeList[records[i].tour] : "?",
+                   records[i].ticketDelta, records[i].amount);
+            shown++;
+        }
+    fclose(fp);
+    
+    printf("\n%d record(s).\n", shown);
+    return 0;
+}
+
+void runSession(session *s, user **userptr) {
+    char line[100];
+    
+    /* Feed standard input to the session until it stops asking for more. */
+    while (s->step != stepDone) {
+        if (!readLine(line, sizeof(line))) {
+            sessionAbort(s);
+            break;
+        }
+        sessionResume(s, userptr, line);
+    }
+}
+
+void sessionAbort(session *s) {
+    /* Nothing has been changed yet: records are only written on a session's last step. */
+    if (s->step != stepDone && s->step != stepLoginUsername)
+        fprintf(s->out, "\nSession closed before completion; no changes were made.\n");
+    s->step = stepDone;
+}
+
+int readLine(char *buffer, int size) {
+    char *start;
+    
+    /* Skip blank lines, mirroring the " %[^\n]" conversions used elsewhere. */
+    do {
+        if (fgets(buffer, size, stdin) == NULL)
+            return 0;
+        buffer[strcspn(buffer, "\r\n")] = '\0';
+        start = buffer + strspn(buffer, " \t");
+    } while (*start == '\0');
+    
+    memmove(buffer, start, strlen(start) + 1);
+    return 1;
+}
+
+void logout(void) {
+    /* Ensure that a user is logged in before attempting to log out. */
+    if (currentStatus == menu || strcmp(currentUser, "\0") == 0) {
+        printf("\nError: No user is currently logged in. Please log in first.\n");
+        return;
+    }
+    
+    strcpy(currentUser, "\0");
+    currentStatus = menu;
+    printf("\nYou have been successfully logged out.\n");
+}
+
+void exitProgram(void) {
+    /* Display project and developer information on exit */
+    printf("\nProgramming Fundamentals Laboratory Project BS(CS)-1E\n");
+    printf("\nDevelopers:\n");
+    printf("Muhammad Talha     --> 21K-3349\n");
+    printf("Muhammad Hamza     --> 21K-4579\n");
+    printf("Muhammad Hasan     --> 21K-4885\n");
+    system("PAUSE");
+    
+    acceptingWork = 0;
+}
+
+void shutdownProgram(user *userptr) {
+    double start, drained, flushed, checkpointed;
+    user *next;
+    int synced, i;
+    
+    /* Stop taking requests; a shard has already drained its connections, the menu has none in flight. */
+    acceptingWork = 0;
+    drained = monotonicMs();
+    start = drainStarted > 0 ? drainStarted : drained;
+    
+    /* Persist the final state and force it to disk. */
+    userptr = persistUsers(userptr, NULL, NULL, NULL, 0);
+    synced = syncStore();
+    stopAudit();
+    stopOutbox();
+    flushed = monotonicMs();
+    
+    if (writeCheckpoint(userptr, "users.chk") != 0)
+        printf("\nWarning: restart checkpoint could not be written.\n");
+    if (synced != 0)
+        printf("\nWarning: user store could not be synced to disk.\n");
+    checkpointed = monotonicMs();
+    
+    /* Detach followers; they keep serving their last replicated state. */
+    if (listenFd >= 0) {
+        close(listenFd);
+        unlink(REPLICATION_SOCKET);
+    }
+    for (i = 0; i < MAX_FOLLOWERS; i++)
+        if (followers[i].fd >= 0)
+            close(followers[i].fd);
+    
+    while (userptr != NULL) {
+        next = userptr->next;
+        free(userptr);
+        userptr = next;
+    }
+    if (coldFd >= 0)
+        close(coldFd);
+    
+    if (drainStarted > 0)
+        printf("\nShutdown complete in %.1f ms (drain %.1f ms, flush %.1f ms, checkpoint %.1f ms).\n",
+               monotonicMs() - start, drained - start, flushed - drained, checkpointed - flushed);
+    else
+        printf("\nShutdown complete in %.1f ms (flush %.1f ms, checkpoint %.1f ms).\n",
+               monotonicMs() - start, flushed - drained, checkpointed - flushed);
+}
+
+void requestShutdown(int signum) {
+    (void)signum;
+    shutdownRequested = 1;
+}
+
+double monotonicMs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+void developers(void) {
+    /* Provide project introduction and developer credits before main menu */
+    printf("\nProject: Tourism Management System\n");
+    printf("\nDevelopers: Talha, Hamza, and Hasan\n");
+    
+    delay(3.5);
+    system("CLS");
+}
+
+void delay(float t) {
+    clock_t start = clock();
+    /* Delay execution for the specified time in seconds */
+    while ((clock() - start) < (t * 1000));
+    return;
 }
\ No newline at end of file